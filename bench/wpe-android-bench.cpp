@@ -0,0 +1,1243 @@
+// Measures the IPC and the commit/release loop of the backend without WebKit, to be run on
+// a device through `adb shell`. Every web process is simulated in this process: it talks to
+// the real renderer host and view backends over their sockets the way EGLTarget does, with
+// real AHardwareBuffers that are committed without ever being rendered into. Recordings made
+// with WPEAndroidRendererHost_startRecording() can be replayed the same way, or dumped.
+//
+//   wpe-android-bench [ipc|frames] [--views N] [--clients M] [--frames F]
+//                     [--messages K] [--size WxH] [--seqpacket] [--ring]
+//   wpe-android-bench replay <recording> [--speed X] [--size WxH] [--seqpacket] [--ring]
+//   wpe-android-bench dump <recording>
+
+#include <algorithm>
+#include <android/hardware_buffer.h>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <gio/gio.h>
+#include <memory>
+#include <new>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include <wpe/wpe.h>
+
+#include <wpe-android/renderer-host.h>
+#include <wpe-android/view-backend.h>
+
+#include "frame-recorder.h"
+#include "ipc.h"
+#include "ipc-messages.h"
+#include "ipc-ring.h"
+#include "tracing.h"
+
+using WPEAndroid::monotonicTime;
+
+// Every allocation of the process goes through these, the backend's included.
+static std::atomic<uint64_t> s_allocationCount { 0 };
+
+void* operator new(size_t size)
+{
+    s_allocationCount++;
+    if (void* pointer = std::malloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+namespace {
+
+struct Options {
+    bool runIPC { true };
+    bool runFrames { true };
+    bool runReplay { false };
+    bool runDump { false };
+    const char* recordingPath { nullptr };
+    double speed { 1 };
+    uint32_t views { 1 };
+    uint32_t clients { 1 };
+    uint32_t frames { 1000 };
+    uint32_t messages { 100000 };
+    uint32_t width { 1080 };
+    uint32_t height { 1920 };
+    bool seqPacket { false };
+    bool messageRing { false };
+};
+
+struct Percentiles {
+    uint64_t p50 { 0 };
+    uint64_t p90 { 0 };
+    uint64_t p99 { 0 };
+    uint64_t max { 0 };
+};
+
+Percentiles percentiles(std::vector<uint64_t>& samples)
+{
+    Percentiles result;
+    if (samples.empty())
+        return result;
+
+    std::sort(samples.begin(), samples.end());
+    auto at = [&samples](double fraction) { return samples[size_t(fraction * (samples.size() - 1))]; };
+    result.p50 = at(0.5);
+    result.p90 = at(0.9);
+    result.p99 = at(0.99);
+    result.max = samples.back();
+    return result;
+}
+
+void iterateUntil(const std::function<bool()>& done)
+{
+    while (!done())
+        g_main_context_iteration(nullptr, TRUE);
+}
+
+// IPC: every pair sends batches of messages in both directions.
+
+struct CountingHandler : IPC::Host::Handler, IPC::Client::Handler {
+    void handleMessage(char*, size_t size) override
+    {
+        if (size == IPC::Message::size)
+            received++;
+    }
+
+    uint64_t received { 0 };
+};
+
+struct IPCPair {
+    IPC::Host host;
+    IPC::Client client;
+    CountingHandler hostHandler;
+    CountingHandler clientHandler;
+};
+
+void runIPCBenchmark(const Options& options)
+{
+    static const uint32_t batchSize = 16;
+    auto transport = options.seqPacket ? IPC::Transport::SeqPacket : IPC::Transport::Stream;
+
+    std::vector<std::unique_ptr<IPCPair>> pairs;
+    for (uint32_t i = 0; i < options.clients; ++i) {
+        pairs.emplace_back(new IPCPair);
+        auto& pair = *pairs.back();
+        pair.host.initialize(pair.hostHandler, transport);
+        pair.client.initialize(pair.clientHandler, pair.host.releaseClientFD(true));
+    }
+
+    std::vector<IPC::Message> batch(batchSize);
+    for (auto& message : batch) {
+        IPC::BufferCommit commit;
+        std::memset(&commit, 0, sizeof(commit));
+        IPC::BufferCommit::construct(message, commit);
+    }
+
+    uint32_t rounds = std::max<uint32_t>(options.messages / (batchSize * options.clients), 1);
+    uint64_t total = uint64_t(rounds) * batchSize * options.clients;
+
+    for (bool toHost : { true, false }) {
+        for (auto& pair : pairs)
+            pair->hostHandler.received = pair->clientHandler.received = 0;
+
+        uint64_t startTime = monotonicTime();
+        for (uint32_t round = 0; round < rounds; ++round) {
+            for (auto& pair : pairs) {
+                if (toHost)
+                    pair->client.sendMessages(batch.data(), batchSize);
+                else
+                    pair->host.sendMessages(batch.data(), batchSize);
+            }
+            uint64_t expected = uint64_t(round + 1) * batchSize;
+            iterateUntil([&pairs, toHost, expected] {
+                for (auto& pair : pairs) {
+                    if ((toHost ? pair->hostHandler.received : pair->clientHandler.received) < expected)
+                        return false;
+                }
+                return true;
+            });
+        }
+        double seconds = (monotonicTime() - startTime) / 1e9;
+
+        std::printf("ipc %s, %s: %" PRIu64 " messages over %u sockets, %.0f messages/s\n",
+            toHost ? "web -> ui" : "ui -> web", options.seqPacket ? "seqpacket" : "stream",
+            total, options.clients, total / seconds);
+    }
+
+    for (auto& pair : pairs) {
+        pair->client.deinitialize();
+        pair->host.deinitialize();
+    }
+}
+
+// Frames: simulated web processes commit to real view backends, whose commit handlers
+// release the buffer and complete the frame right away.
+
+// Like EGLTarget, only that nothing is ever rendered into the buffers.
+AHardwareBuffer* allocateHardwareBuffer(uint32_t width, uint32_t height, uint32_t format, uint32_t usage)
+{
+    AHardwareBuffer_Desc description;
+    std::memset(&description, 0, sizeof(description));
+    description.width = width;
+    description.height = height;
+    description.layers = 1;
+    description.format = format;
+    description.usage = AHARDWAREBUFFER_USAGE_GPU_FRAMEBUFFER | AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE | AHARDWAREBUFFER_USAGE_COMPOSER_OVERLAY | usage;
+
+    AHardwareBuffer* object = nullptr;
+    if (AHardwareBuffer_allocate(&description, &object)) {
+        std::fprintf(stderr, "failed to allocate a %ux%u buffer\n", width, height);
+        std::exit(EXIT_FAILURE);
+    }
+    return object;
+}
+
+void sendBufferAllocation(IPC::Client& client, uint32_t poolID, uint32_t bufferID, AHardwareBuffer* object)
+{
+    IPC::BufferAllocation allocation;
+    std::memset(&allocation, 0, sizeof(allocation));
+    allocation.poolID = poolID;
+    allocation.bufferID = bufferID;
+
+    IPC::Message message;
+    IPC::BufferAllocation::construct(message, allocation);
+    client.sendMessage(IPC::Message::data(message), IPC::Message::size);
+
+    while (true) {
+        int ret = AHardwareBuffer_sendHandleToUnixSocket(object, client.socketFd());
+        if (!ret || ret != -EAGAIN)
+            break;
+    }
+}
+
+// The handle of a BufferAdoption follows on the socket and has to be read in any case.
+void dropAdoptedBuffer(IPC::Client& client)
+{
+    AHardwareBuffer* object = nullptr;
+    while (true) {
+        int ret = AHardwareBuffer_recvHandleFromUnixSocket(client.socketFd(), &object);
+        if (!ret || ret != -EAGAIN)
+            break;
+    }
+    if (object)
+        AHardwareBuffer_release(object);
+}
+
+struct WebProcess;
+
+struct NullHandler : IPC::Client::Handler {
+    void handleMessage(char*, size_t) override { }
+};
+
+struct View {
+    WebProcess* process { nullptr };
+    WPEAndroidViewBackend* backend { nullptr };
+    IPC::Client viewClient;
+    NullHandler viewHandler;
+
+    uint32_t poolID { 0 };
+    uint32_t width { 0 };
+    uint32_t height { 0 };
+    std::vector<AHardwareBuffer*> buffers;
+    std::vector<bool> locked;
+
+    bool framePending { false };
+    uint32_t committedFrames { 0 };
+    uint32_t completedFrames { 0 };
+    uint64_t commitTime { 0 };
+
+    std::vector<uint64_t>* latencies { nullptr };
+    uint64_t* messageCount { nullptr };
+
+    void commit();
+};
+
+// One connection to the renderer host, handling its messages like RendererBackend.
+struct WebProcess : IPC::Client::Handler, IPC::MessageRing::Handler {
+    IPC::Client client;
+    std::unique_ptr<IPC::MessageRing> messageRing;
+
+    std::deque<uint32_t> reservedPoolIDs;
+    std::deque<View*> poolRequests;
+    std::vector<View*> views;
+
+    uint32_t frames { 0 };
+    uint64_t* messageCount { nullptr };
+
+    View* findView(uint32_t poolID)
+    {
+        auto it = std::find_if(views.begin(), views.end(), [poolID](View* view) { return view->poolID == poolID; });
+        return it != views.end() ? *it : nullptr;
+    }
+
+    void constructPools()
+    {
+        while (!poolRequests.empty() && !reservedPoolIDs.empty()) {
+            auto& view = *poolRequests.front();
+            poolRequests.pop_front();
+            view.poolID = reservedPoolIDs.front();
+            reservedPoolIDs.pop_front();
+
+            IPC::PoolConstruction construction;
+            std::memset(&construction, 0, sizeof(construction));
+            construction.viewToken = view.viewClient.token();
+            construction.poolID = view.poolID;
+
+            IPC::Message message;
+            IPC::PoolConstruction::construct(message, construction);
+            client.sendMessage(IPC::Message::data(message), IPC::Message::size);
+
+            IPC::RegisterPool registerPool;
+            std::memset(&registerPool, 0, sizeof(registerPool));
+            registerPool.poolID = view.poolID;
+
+            IPC::Message registerMessage;
+            IPC::RegisterPool::construct(registerMessage, registerPool);
+            view.viewClient.sendMessage(IPC::Message::data(registerMessage), IPC::Message::size);
+        }
+    }
+
+    void allocateBuffers(View& view, const IPC::PoolConstructionReply& reply)
+    {
+        for (uint32_t bufferID = 0; bufferID < reply.bufferCount; ++bufferID) {
+            auto* object = allocateHardwareBuffer(view.width, view.height, reply.format, reply.usage);
+            view.buffers.push_back(object);
+            view.locked.push_back(false);
+            sendBufferAllocation(client, view.poolID, bufferID, object);
+        }
+    }
+
+    void handleMessage(char* data, size_t size) override
+    {
+        if (size != IPC::Message::size)
+            return;
+
+        auto& message = IPC::Message::cast(data);
+        switch (message.messageCode) {
+        case IPC::MessageRingSetup::code:
+        {
+            int memoryFd = client.takeFileDescriptor(0);
+            int doorbellFd = client.takeFileDescriptor(1);
+            int spaceFd = client.takeFileDescriptor(2);
+            messageRing.reset(new IPC::MessageRing);
+            if (!messageRing->attach(*this, memoryFd, doorbellFd, spaceFd))
+                messageRing = nullptr;
+            break;
+        }
+        case IPC::PoolIDReservation::code:
+        {
+            auto reservation = IPC::PoolIDReservation::from(message);
+            for (uint32_t i = 0; i < std::min<uint32_t>(reservation.count, G_N_ELEMENTS(reservation.poolIDs)); ++i)
+                reservedPoolIDs.push_back(reservation.poolIDs[i]);
+            constructPools();
+            break;
+        }
+        case IPC::PoolConstructionReply::code:
+        {
+            auto reply = IPC::PoolConstructionReply::from(message);
+            if (auto* view = findView(reply.poolID)) {
+                allocateBuffers(*view, reply);
+                view->commit();
+            }
+            break;
+        }
+        case IPC::ReleaseBuffer::code:
+        {
+            (*messageCount)++;
+            auto release = IPC::ReleaseBuffer::from(message);
+            int releaseFenceFD = client.takeFileDescriptor();
+            if (releaseFenceFD != -1)
+                close(releaseFenceFD);
+            auto* view = findView(release.poolID);
+            if (view && release.bufferID < view->locked.size()) {
+                view->locked[release.bufferID] = false;
+                view->commit();
+            }
+            break;
+        }
+        case IPC::FrameComplete::code:
+        {
+            (*messageCount)++;
+            auto frameComplete = IPC::FrameComplete::from(message);
+            if (auto* view = findView(frameComplete.poolID)) {
+                view->framePending = false;
+                view->completedFrames++;
+                view->commit();
+            }
+            break;
+        }
+        case IPC::BufferAdoption::code:
+            // Nothing is cached for a fresh view.
+            dropAdoptedBuffer(client);
+            break;
+        default:
+            break;
+        }
+    }
+};
+
+void View::commit()
+{
+    if (framePending || committedFrames >= process->frames)
+        return;
+
+    auto it = std::find(locked.begin(), locked.end(), false);
+    if (it == locked.end())
+        return;
+    *it = true;
+
+    IPC::BufferCommit commit;
+    std::memset(&commit, 0, sizeof(commit));
+    commit.poolID = poolID;
+    commit.bufferID = uint32_t(it - locked.begin());
+    commit.width = width;
+    commit.height = height;
+    commit.renderedTime = commitTime = monotonicTime();
+
+    IPC::Message message;
+    IPC::BufferCommit::construct(message, commit);
+    process->client.sendMessage(IPC::Message::data(message), IPC::Message::size);
+    (*messageCount)++;
+
+    framePending = true;
+    committedFrames++;
+}
+
+void commitBuffer(void* context, WPEAndroidBuffer* buffer, int fenceFD)
+{
+    auto& view = *static_cast<View*>(context);
+    view.latencies->push_back(monotonicTime() - view.commitTime);
+
+    if (fenceFD != -1)
+        close(fenceFD);
+    WPEAndroidViewBackend_dispatchReleaseBuffer(view.backend, buffer);
+    WPEAndroidViewBackend_dispatchFrameComplete(view.backend);
+}
+
+void runFrameBenchmark(const Options& options)
+{
+    WPEAndroidRendererHost_setIPCTransport(options.seqPacket ? WPEAndroidIPCTransport_SeqPacket : WPEAndroidIPCTransport_Stream);
+    WPEAndroidRendererHost_setMessageRingEnabled(options.messageRing);
+
+    std::vector<uint64_t> latencies;
+    latencies.reserve(size_t(options.views) * options.frames);
+    uint64_t messageCount = 0;
+
+    std::vector<std::unique_ptr<WebProcess>> processes;
+    for (uint32_t i = 0; i < options.clients; ++i) {
+        processes.emplace_back(new WebProcess);
+        auto& process = *processes.back();
+        process.frames = options.frames;
+        process.messageCount = &messageCount;
+        process.client.initialize(process, wpe_renderer_host_create_client());
+    }
+
+    // Views are spread over the web processes like tabs over WebKit's.
+    std::vector<std::unique_ptr<View>> views;
+    for (uint32_t i = 0; i < options.views; ++i) {
+        views.emplace_back(new View);
+        auto& view = *views.back();
+        view.process = processes[i % processes.size()].get();
+        view.width = options.width;
+        view.height = options.height;
+        view.latencies = &latencies;
+        view.messageCount = &messageCount;
+
+        view.backend = WPEAndroidViewBackend_create(options.width, options.height);
+        WPEAndroidViewBackend_setCommitBufferHandler(view.backend, &view, commitBuffer);
+        auto* wpeBackend = WPEAndroidViewBackend_getWPEViewBackend(view.backend);
+        wpe_view_backend_initialize(wpeBackend);
+        view.viewClient.initialize(view.viewHandler, wpe_view_backend_get_renderer_host_fd(wpeBackend));
+
+        view.process->views.push_back(&view);
+        view.process->poolRequests.push_back(&view);
+    }
+    for (auto& process : processes)
+        process->constructPools();
+
+    // Pools are constructed and buffers allocated before the clock starts.
+    auto allViews = [&views](const std::function<bool(const View&)>& predicate) {
+        return std::all_of(views.begin(), views.end(), [&predicate](const std::unique_ptr<View>& view) { return predicate(*view); });
+    };
+    iterateUntil([&allViews] { return allViews([](const View& view) { return view.committedFrames > 0; }); });
+
+    latencies.clear();
+    messageCount = 0;
+    uint64_t startAllocationCount = s_allocationCount.load();
+    uint64_t startTime = monotonicTime();
+
+    iterateUntil([&allViews, &options] {
+        return allViews([&options](const View& view) { return view.completedFrames >= options.frames; });
+    });
+
+    double seconds = (monotonicTime() - startTime) / 1e9;
+    uint64_t allocationCount = s_allocationCount.load() - startAllocationCount;
+    uint64_t frameCount = latencies.size();
+    auto latency = percentiles(latencies);
+
+    std::printf("frames, %s%s: %u views over %u clients, %ux%u\n",
+        options.seqPacket ? "seqpacket" : "stream", options.messageRing ? " + ring" : "",
+        options.views, options.clients, options.width, options.height);
+    std::printf("  %" PRIu64 " frames, %.0f frames/s, %.0f messages/s\n", frameCount, frameCount / seconds, messageCount / seconds);
+    std::printf("  commit to callback: p50 %.1fus, p90 %.1fus, p99 %.1fus, max %.1fus\n",
+        latency.p50 / 1e3, latency.p90 / 1e3, latency.p99 / 1e3, latency.max / 1e3);
+    std::printf("  %.2f allocations per frame\n", frameCount ? double(allocationCount) / frameCount : 0.0);
+
+    for (auto& view : views) {
+        WPEAndroidViewBackend_destroy(view->backend);
+        view->viewClient.deinitialize();
+        for (auto* object : view->buffers)
+            AHardwareBuffer_release(object);
+    }
+    for (auto& process : processes) {
+        process->messageRing = nullptr;
+        process->client.deinitialize();
+    }
+}
+
+// Replay: reads a ring written by WPEAndroidRendererHost_startRecording() and sends what the
+// web processes sent back then at the same pace, with buffer releases and frame completions
+// dispatched when the UI process gave them back then. Pool IDs are handed out anew and
+// mapped, layers are left out since the views have no layer handler.
+
+struct Recording {
+    // The snapshot of the pools set up before the oldest record of the ring comes first.
+    std::vector<WPEAndroid::FrameRecorder::Record> records;
+    size_t snapshotCount { 0 };
+    // Of the oldest record in the ring, snapshot records are older.
+    uint64_t startTime { 0 };
+};
+
+bool readRecording(const char* path, Recording& recording)
+{
+    using WPEAndroid::FrameRecorder;
+
+    FILE* file = std::fopen(path, "rb");
+    if (!file) {
+        std::fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    FrameRecorder::Header header;
+    if (std::fread(&header, sizeof(header), 1, file) != 1 || header.magic != FrameRecorder::magic
+        || header.version != FrameRecorder::version || header.recordSize != sizeof(FrameRecorder::Record) || !header.capacity
+        || header.snapshotCount.load() > header.snapshotCapacity) {
+        std::fprintf(stderr, "%s is not a frame recording\n", path);
+        std::fclose(file);
+        return false;
+    }
+
+    std::vector<FrameRecorder::Record> snapshot(header.snapshotCapacity);
+    uint64_t writeCount = header.writeCount.load();
+    uint64_t count = std::min<uint64_t>(writeCount, header.capacity);
+    std::vector<FrameRecorder::Record> slots(count);
+    if (std::fread(snapshot.data(), sizeof(FrameRecorder::Record), snapshot.size(), file) != snapshot.size()
+        || std::fread(slots.data(), sizeof(FrameRecorder::Record), count, file) != count) {
+        std::fprintf(stderr, "%s is truncated\n", path);
+        std::fclose(file);
+        return false;
+    }
+    std::fclose(file);
+
+    recording.snapshotCount = header.snapshotCount.load();
+    recording.records.reserve(recording.snapshotCount + count);
+    recording.records.insert(recording.records.end(), snapshot.begin(), snapshot.begin() + recording.snapshotCount);
+
+    // Oldest first.
+    uint64_t first = writeCount > header.capacity ? writeCount % header.capacity : 0;
+    for (uint64_t i = 0; i < count; ++i)
+        recording.records.push_back(slots[(first + i) % count]);
+    recording.startTime = count ? recording.records[recording.snapshotCount].time : header.startTime;
+    return true;
+}
+
+const char* messageName(uint64_t code)
+{
+    switch (code) {
+    case IPC::MessageRingSetup::code: return "MessageRingSetup";
+    case IPC::PoolIDReservation::code: return "PoolIDReservation";
+    case IPC::PoolConstruction::code: return "PoolConstruction";
+    case IPC::PoolConstructionReply::code: return "PoolConstructionReply";
+    case IPC::PoolUsageChange::code: return "PoolUsageChange";
+    case IPC::PoolPurge::code: return "PoolPurge";
+    case IPC::RegisterPool::code: return "RegisterPool";
+    case IPC::UnregisterPool::code: return "UnregisterPool";
+    case IPC::TrimMemory::code: return "TrimMemory";
+    case IPC::BufferAllocation::code: return "BufferAllocation";
+    case IPC::BufferAdoption::code: return "BufferAdoption";
+    case IPC::BufferDestruction::code: return "BufferDestruction";
+    case IPC::BufferCommit::code: return "BufferCommit";
+    case IPC::ReleaseBuffer::code: return "ReleaseBuffer";
+    case IPC::BufferDamage::code: return "BufferDamage";
+    case IPC::BufferWait::code: return "BufferWait";
+    case IPC::LayerCommit::code: return "LayerCommit";
+    case IPC::LayerRemoval::code: return "LayerRemoval";
+    case IPC::FrameComplete::code: return "FrameComplete";
+    default: return "unknown";
+    }
+}
+
+// Every message about a pool starts with its ID, except for the construction.
+bool messagePoolID(const IPC::Message& message, uint32_t& poolID)
+{
+    switch (message.messageCode) {
+    case IPC::MessageRingSetup::code:
+    case IPC::PoolIDReservation::code:
+        return false;
+    case IPC::PoolConstruction::code:
+        poolID = IPC::PoolConstruction::from(message).poolID;
+        return true;
+    default:
+        std::memcpy(&poolID, message.messageData, sizeof(poolID));
+        return true;
+    }
+}
+
+void setMessagePoolID(IPC::Message& message, uint32_t poolID)
+{
+    if (message.messageCode == IPC::PoolConstruction::code) {
+        auto construction = IPC::PoolConstruction::from(message);
+        construction.poolID = poolID;
+        IPC::PoolConstruction::construct(message, construction);
+        return;
+    }
+    std::memcpy(message.messageData, &poolID, sizeof(poolID));
+}
+
+void dumpRecording(const char* path)
+{
+    using WPEAndroid::FrameRecorder;
+
+    Recording recording;
+    if (!readRecording(path, recording))
+        std::exit(EXIT_FAILURE);
+
+    static const char* directions[] = { "web -> ui", "ui -> web", "view -> ui" };
+    if (recording.snapshotCount)
+        std::printf("%zu records from the snapshot of the pools set up before the ring wrapped around\n", recording.snapshotCount);
+
+    for (auto& record : recording.records) {
+        auto& message = record.message;
+        std::printf("%12.3fms %-10s client %-3u %-21s", (int64_t(record.time) - int64_t(recording.startTime)) / 1e6,
+            directions[std::min<size_t>(size_t(record.direction), G_N_ELEMENTS(directions) - 1)], record.clientID,
+            messageName(message.messageCode));
+
+        uint32_t poolID;
+        if (messagePoolID(message, poolID))
+            std::printf(" pool %u", poolID);
+
+        switch (message.messageCode) {
+        case IPC::BufferAllocation::code:
+        case IPC::BufferAdoption::code:
+        case IPC::BufferDestruction::code:
+        case IPC::BufferDamage::code:
+        {
+            uint32_t bufferID;
+            std::memcpy(&bufferID, message.messageData + sizeof(uint32_t), sizeof(bufferID));
+            std::printf(" buffer %u", bufferID);
+            break;
+        }
+        case IPC::BufferCommit::code:
+        {
+            auto commit = IPC::BufferCommit::from(message);
+            std::printf(" buffer %u %ux%u skipped %u", commit.bufferID, commit.width, commit.height, commit.skippedFrames);
+            break;
+        }
+        case IPC::ReleaseBuffer::code:
+        {
+            auto release = IPC::ReleaseBuffer::from(message);
+            std::printf(" buffer %u layer %u", release.bufferID, release.layerID);
+            if (record.fenceSignalTime)
+                std::printf(" fence signalled at %.3fms", (int64_t(record.fenceSignalTime) - int64_t(recording.startTime)) / 1e6);
+            break;
+        }
+        case IPC::LayerCommit::code:
+        {
+            auto commit = IPC::LayerCommit::from(message);
+            std::printf(" layer %u buffer %u", commit.layerID, commit.bufferID);
+            break;
+        }
+        case IPC::BufferWait::code:
+        {
+            auto wait = IPC::BufferWait::from(message);
+            std::printf(" waited %.3fms%s", wait.waitTime / 1e6, wait.timedOut ? " timed out" : "");
+            break;
+        }
+        default:
+            break;
+        }
+        std::printf("\n");
+    }
+}
+
+struct ReplayPool;
+
+struct ReplayView {
+    WPEAndroidViewBackend* backend { nullptr };
+    IPC::Client viewClient;
+    NullHandler viewHandler;
+
+    // Commits the view backend hasn't handed to the commit handler yet, in order.
+    struct PendingCommit {
+        ReplayPool* pool;
+        uint32_t bufferID;
+        uint64_t sendTime;
+    };
+    std::deque<PendingCommit> pendingCommits;
+
+    std::vector<uint64_t>* commitLatencies { nullptr };
+    uint64_t unexpectedCommits { 0 };
+};
+
+struct ReplayProcess;
+
+struct ReplayPool {
+    uint32_t poolID { 0 };
+    ReplayProcess* process { nullptr };
+    ReplayView* view { nullptr };
+
+    bool constructed { false };
+    bool registered { false };
+    uint32_t format { 0 };
+    uint32_t usage { 0 };
+    std::array<AHardwareBuffer*, IPC::maxPoolBufferCount> buffers;
+
+    // Held by the commit handler, to be released when the recording says so.
+    std::array<WPEAndroidBuffer*, IPC::maxPoolBufferCount> heldBuffers;
+    std::array<uint64_t, IPC::maxPoolBufferCount> releaseDispatchTimes;
+    uint64_t completeDispatchTime { 0 };
+
+    ReplayPool()
+    {
+        buffers.fill(nullptr);
+        heldBuffers.fill(nullptr);
+        releaseDispatchTimes.fill(0);
+    }
+};
+
+struct ReplayStats {
+    std::vector<uint64_t> commitLatencies;
+    std::vector<uint64_t> releaseLatencies;
+    std::vector<uint64_t> completeLatencies;
+    std::vector<uint64_t> lateness;
+    std::vector<uint64_t> recordedFenceWaits;
+    uint64_t replayed { 0 };
+    uint64_t skipped { 0 };
+    uint64_t unmatchedReleases { 0 };
+};
+
+struct ReplayProcess : IPC::Client::Handler, IPC::MessageRing::Handler {
+    IPC::Client client;
+    std::unique_ptr<IPC::MessageRing> messageRing;
+    std::deque<uint32_t> reservedPoolIDs;
+
+    // Pools by the IDs the renderer host of the replay gave out.
+    std::unordered_map<uint32_t, ReplayPool*> pools;
+    ReplayStats* stats { nullptr };
+
+    ReplayPool* findPool(uint32_t poolID)
+    {
+        auto it = pools.find(poolID);
+        return it != pools.end() ? it->second : nullptr;
+    }
+
+    void handleMessage(char* data, size_t size) override
+    {
+        if (size != IPC::Message::size)
+            return;
+
+        auto& message = IPC::Message::cast(data);
+        switch (message.messageCode) {
+        case IPC::MessageRingSetup::code:
+        {
+            int memoryFd = client.takeFileDescriptor(0);
+            int doorbellFd = client.takeFileDescriptor(1);
+            int spaceFd = client.takeFileDescriptor(2);
+            messageRing.reset(new IPC::MessageRing);
+            if (!messageRing->attach(*this, memoryFd, doorbellFd, spaceFd))
+                messageRing = nullptr;
+            break;
+        }
+        case IPC::PoolIDReservation::code:
+        {
+            auto reservation = IPC::PoolIDReservation::from(message);
+            for (uint32_t i = 0; i < std::min<uint32_t>(reservation.count, G_N_ELEMENTS(reservation.poolIDs)); ++i)
+                reservedPoolIDs.push_back(reservation.poolIDs[i]);
+            break;
+        }
+        case IPC::PoolConstructionReply::code:
+        {
+            auto reply = IPC::PoolConstructionReply::from(message);
+            if (auto* pool = findPool(reply.poolID)) {
+                pool->constructed = true;
+                pool->format = reply.format;
+                pool->usage = reply.usage;
+            }
+            break;
+        }
+        case IPC::ReleaseBuffer::code:
+        {
+            auto release = IPC::ReleaseBuffer::from(message);
+            int releaseFenceFD = client.takeFileDescriptor();
+            if (releaseFenceFD != -1)
+                close(releaseFenceFD);
+            auto* pool = findPool(release.poolID);
+            if (pool && !release.layerID && release.bufferID < IPC::maxPoolBufferCount && pool->releaseDispatchTimes[release.bufferID]) {
+                stats->releaseLatencies.push_back(monotonicTime() - pool->releaseDispatchTimes[release.bufferID]);
+                pool->releaseDispatchTimes[release.bufferID] = 0;
+            }
+            break;
+        }
+        case IPC::FrameComplete::code:
+        {
+            auto frameComplete = IPC::FrameComplete::from(message);
+            auto* pool = findPool(frameComplete.poolID);
+            if (pool && pool->completeDispatchTime) {
+                stats->completeLatencies.push_back(monotonicTime() - pool->completeDispatchTime);
+                pool->completeDispatchTime = 0;
+            }
+            break;
+        }
+        case IPC::BufferAdoption::code:
+            dropAdoptedBuffer(client);
+            break;
+        default:
+            break;
+        }
+    }
+};
+
+void replayCommitBuffer(void* context, WPEAndroidBuffer* buffer, int fenceFD)
+{
+    auto& view = *static_cast<ReplayView*>(context);
+    if (fenceFD != -1)
+        close(fenceFD);
+
+    if (view.pendingCommits.empty()) {
+        view.unexpectedCommits++;
+        WPEAndroidViewBackend_dispatchReleaseBuffer(view.backend, buffer);
+        return;
+    }
+
+    auto commit = view.pendingCommits.front();
+    view.pendingCommits.pop_front();
+    view.commitLatencies->push_back(monotonicTime() - commit.sendTime);
+
+    // A buffer which is still held was never released in the recording window.
+    auto& held = commit.pool->heldBuffers[commit.bufferID];
+    if (held && held != buffer)
+        WPEAndroidViewBackend_dispatchReleaseBuffer(view.backend, held);
+    held = buffer;
+}
+
+struct Replay {
+    const Options& options;
+    ReplayStats stats;
+
+    std::unordered_map<uint32_t, std::unique_ptr<ReplayProcess>> processes;
+    std::unordered_map<uint64_t, std::unique_ptr<ReplayView>> views;
+    // By the pool IDs of the recording.
+    std::unordered_map<uint32_t, std::unique_ptr<ReplayPool>> pools;
+
+    // When the buffers were last committed in the recording, by recorded pool and buffer ID.
+    std::unordered_map<uint64_t, uint64_t> recordedCommitTimes;
+
+    explicit Replay(const Options& options)
+        : options(options) { }
+
+    ReplayProcess& process(uint32_t clientID)
+    {
+        auto& process = processes[clientID];
+        if (!process) {
+            process.reset(new ReplayProcess);
+            process->stats = &stats;
+            process->client.initialize(*process, wpe_renderer_host_create_client());
+        }
+        return *process;
+    }
+
+    ReplayView& view(uint64_t viewToken)
+    {
+        auto& view = views[viewToken];
+        if (!view) {
+            view.reset(new ReplayView);
+            view->commitLatencies = &stats.commitLatencies;
+            view->backend = WPEAndroidViewBackend_create(options.width, options.height);
+            WPEAndroidViewBackend_setCommitBufferHandler(view->backend, view.get(), replayCommitBuffer);
+            auto* wpeBackend = WPEAndroidViewBackend_getWPEViewBackend(view->backend);
+            wpe_view_backend_initialize(wpeBackend);
+            view->viewClient.initialize(view->viewHandler, wpe_view_backend_get_renderer_host_fd(wpeBackend));
+        }
+        return *view;
+    }
+
+    ReplayPool* findPool(uint32_t recordedPoolID)
+    {
+        auto it = pools.find(recordedPoolID);
+        return it != pools.end() ? it->second.get() : nullptr;
+    }
+
+    void allocate(ReplayPool& pool, uint32_t bufferID)
+    {
+        if (bufferID >= IPC::maxPoolBufferCount)
+            return;
+        iterateUntil([&pool] { return pool.constructed; });
+
+        if (pool.buffers[bufferID])
+            AHardwareBuffer_release(pool.buffers[bufferID]);
+        pool.buffers[bufferID] = allocateHardwareBuffer(options.width, options.height, pool.format, pool.usage);
+        sendBufferAllocation(pool.process->client, pool.poolID, bufferID, pool.buffers[bufferID]);
+    }
+
+    void replayFromWebProcess(const WPEAndroid::FrameRecorder::Record& record)
+    {
+        IPC::Message message = record.message;
+        auto& process = this->process(record.clientID);
+
+        if (message.messageCode == IPC::PoolConstruction::code) {
+            auto construction = IPC::PoolConstruction::from(message);
+            iterateUntil([&process] { return !process.reservedPoolIDs.empty(); });
+
+            std::unique_ptr<ReplayPool> pool(new ReplayPool);
+            pool->poolID = process.reservedPoolIDs.front();
+            process.reservedPoolIDs.pop_front();
+            pool->process = &process;
+            pool->view = &view(construction.viewToken);
+            process.pools[pool->poolID] = pool.get();
+
+            construction.viewToken = pool->view->viewClient.token();
+            construction.poolID = pool->poolID;
+            IPC::PoolConstruction::construct(message, construction);
+            process.client.sendMessage(IPC::Message::data(message), IPC::Message::size);
+            pools[IPC::PoolConstruction::from(record.message).poolID] = std::move(pool);
+            stats.replayed++;
+            return;
+        }
+
+        uint32_t recordedPoolID;
+        ReplayPool* pool = messagePoolID(message, recordedPoolID) ? findPool(recordedPoolID) : nullptr;
+        if (!pool || pool->process != &process) {
+            stats.skipped++;
+            return;
+        }
+
+        switch (message.messageCode) {
+        case IPC::BufferAllocation::code:
+        {
+            auto allocation = IPC::BufferAllocation::from(message);
+            if (allocation.layerID) {
+                stats.skipped++;
+                return;
+            }
+            allocate(*pool, allocation.bufferID);
+            stats.replayed++;
+            return;
+        }
+        case IPC::BufferDestruction::code:
+        {
+            auto destruction = IPC::BufferDestruction::from(message);
+            if (destruction.bufferID < IPC::maxPoolBufferCount && pool->buffers[destruction.bufferID]) {
+                AHardwareBuffer_release(pool->buffers[destruction.bufferID]);
+                pool->buffers[destruction.bufferID] = nullptr;
+            }
+            break;
+        }
+        case IPC::BufferCommit::code:
+        {
+            auto commit = IPC::BufferCommit::from(message);
+            commit.renderedTime = monotonicTime();
+            IPC::BufferCommit::construct(message, commit);
+            // Only those the view backend will hand to the commit handler.
+            if (commit.bufferID < IPC::maxPoolBufferCount && pool->buffers[commit.bufferID] && pool->registered)
+                pool->view->pendingCommits.push_back({ pool, commit.bufferID, commit.renderedTime });
+            recordedCommitTimes[uint64_t(recordedPoolID) << 32 | commit.bufferID] = record.time;
+            break;
+        }
+        case IPC::LayerCommit::code:
+        case IPC::LayerRemoval::code:
+            stats.skipped++;
+            return;
+        default:
+            break;
+        }
+
+        setMessagePoolID(message, pool->poolID);
+        process.client.sendMessage(IPC::Message::data(message), IPC::Message::size);
+        stats.replayed++;
+    }
+
+    void replayToWebProcess(const WPEAndroid::FrameRecorder::Record& record)
+    {
+        auto& message = record.message;
+        uint32_t recordedPoolID;
+        ReplayPool* pool = messagePoolID(message, recordedPoolID) ? findPool(recordedPoolID) : nullptr;
+        if (!pool)
+            return;
+
+        switch (message.messageCode) {
+        case IPC::ReleaseBuffer::code:
+        {
+            auto release = IPC::ReleaseBuffer::from(message);
+            if (release.layerID || release.bufferID >= IPC::maxPoolBufferCount)
+                return;
+
+            auto it = recordedCommitTimes.find(uint64_t(recordedPoolID) << 32 | release.bufferID);
+            if (record.fenceSignalTime && it != recordedCommitTimes.end() && record.fenceSignalTime >= it->second)
+                stats.recordedFenceWaits.push_back(record.fenceSignalTime - it->second);
+
+            auto& held = pool->heldBuffers[release.bufferID];
+            if (!held) {
+                stats.unmatchedReleases++;
+                return;
+            }
+            pool->releaseDispatchTimes[release.bufferID] = monotonicTime();
+            WPEAndroidViewBackend_dispatchReleaseBuffer(pool->view->backend, held);
+            held = nullptr;
+            stats.replayed++;
+            break;
+        }
+        case IPC::FrameComplete::code:
+            pool->completeDispatchTime = monotonicTime();
+            WPEAndroidViewBackend_dispatchFrameComplete(pool->view->backend);
+            stats.replayed++;
+            break;
+        case IPC::BufferAdoption::code:
+        {
+            // There is no cache to adopt from in the replay, the web process allocates instead.
+            auto adoption = IPC::BufferAdoption::from(message);
+            allocate(*pool, adoption.bufferID);
+            stats.replayed++;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    void replayFromView(const WPEAndroid::FrameRecorder::Record& record)
+    {
+        IPC::Message message = record.message;
+        uint32_t recordedPoolID;
+        ReplayPool* pool = messagePoolID(message, recordedPoolID) ? findPool(recordedPoolID) : nullptr;
+        if (!pool) {
+            stats.skipped++;
+            return;
+        }
+
+        pool->registered = message.messageCode == IPC::RegisterPool::code;
+        setMessagePoolID(message, pool->poolID);
+        pool->view->viewClient.sendMessage(IPC::Message::data(message), IPC::Message::size);
+        stats.replayed++;
+    }
+
+    void finish()
+    {
+        // Let whatever is still in flight arrive.
+        uint64_t deadline = monotonicTime() + 100000000;
+        iterateUntil([deadline] { return monotonicTime() >= deadline; });
+
+        for (auto& entry : views)
+            WPEAndroidViewBackend_destroy(entry.second->backend);
+        for (auto& entry : pools) {
+            for (auto* object : entry.second->buffers) {
+                if (object)
+                    AHardwareBuffer_release(object);
+            }
+        }
+        for (auto& entry : views)
+            entry.second->viewClient.deinitialize();
+        for (auto& entry : processes) {
+            entry.second->messageRing = nullptr;
+            entry.second->client.deinitialize();
+        }
+    }
+};
+
+GSourceFuncs timerSourceFuncs = {
+    nullptr, // prepare
+    nullptr, // check
+    // dispatch
+    [] (GSource* source, GSourceFunc callback, gpointer data) -> gboolean
+    {
+        g_source_set_ready_time(source, -1);
+        return callback(data);
+    },
+    nullptr, // finalize
+    nullptr, // closure_callback
+    nullptr, // closure_marshall
+};
+
+// Dispatches the main context until the given CLOCK_MONOTONIC time, which is also the clock
+// of g_get_monotonic_time().
+void dispatchUntil(GSource* timer, uint64_t time)
+{
+    if (monotonicTime() >= time)
+        return;
+
+    bool fired = false;
+    g_source_set_callback(timer, [] (gpointer data) -> gboolean {
+        *static_cast<bool*>(data) = true;
+        return G_SOURCE_CONTINUE;
+    }, &fired, nullptr);
+    g_source_set_ready_time(timer, gint64(time / 1000));
+    iterateUntil([&fired] { return fired; });
+}
+
+void printPercentiles(const char* label, std::vector<uint64_t>& samples)
+{
+    auto result = percentiles(samples);
+    std::printf("  %s: %zu, p50 %.1fus, p90 %.1fus, p99 %.1fus, max %.1fus\n", label, samples.size(),
+        result.p50 / 1e3, result.p90 / 1e3, result.p99 / 1e3, result.max / 1e3);
+}
+
+void runReplay(const Options& options)
+{
+    using WPEAndroid::FrameRecorder;
+
+    Recording recording;
+    if (!readRecording(options.recordingPath, recording))
+        std::exit(EXIT_FAILURE);
+
+    WPEAndroidRendererHost_setIPCTransport(options.seqPacket ? WPEAndroidIPCTransport_SeqPacket : WPEAndroidIPCTransport_Stream);
+    WPEAndroidRendererHost_setMessageRingEnabled(options.messageRing);
+
+    GSource* timer = g_source_new(&timerSourceFuncs, sizeof(GSource));
+    g_source_set_name(timer, "wpe-android-bench::replay");
+    g_source_attach(timer, nullptr);
+
+    Replay replay(options);
+    uint64_t startTime = monotonicTime();
+    for (size_t i = 0; i < recording.records.size(); ++i) {
+        auto& record = recording.records[i];
+        // The snapshot sets the pools up right away.
+        if (i >= recording.snapshotCount) {
+            uint64_t scheduledTime = startTime + uint64_t((record.time - recording.startTime) / options.speed);
+            dispatchUntil(timer, scheduledTime);
+            replay.stats.lateness.push_back(monotonicTime() - scheduledTime);
+        }
+
+        switch (record.direction) {
+        case FrameRecorder::Direction::FromWebProcess:
+            replay.replayFromWebProcess(record);
+            break;
+        case FrameRecorder::Direction::ToWebProcess:
+            replay.replayToWebProcess(record);
+            break;
+        case FrameRecorder::Direction::FromView:
+            replay.replayFromView(record);
+            break;
+        }
+    }
+    double seconds = (monotonicTime() - startTime) / 1e9;
+    replay.finish();
+
+    g_source_destroy(timer);
+    g_source_unref(timer);
+
+    uint64_t unexpectedCommits = 0;
+    for (auto& entry : replay.views)
+        unexpectedCommits += entry.second->unexpectedCommits;
+
+    auto& stats = replay.stats;
+    std::printf("replay of %s: %zu records over %.3fs at %.2fx, %zu clients, %zu views, %zu pools\n",
+        options.recordingPath, recording.records.size(), seconds, options.speed,
+        replay.processes.size(), replay.views.size(), replay.pools.size());
+    std::printf("  %" PRIu64 " replayed, %" PRIu64 " skipped, %" PRIu64 " releases of buffers not held, %" PRIu64 " unexpected commits\n",
+        stats.replayed, stats.skipped, stats.unmatchedReleases, unexpectedCommits);
+    printPercentiles("commit to callback", stats.commitLatencies);
+    printPercentiles("release to web process", stats.releaseLatencies);
+    printPercentiles("frame complete to web process", stats.completeLatencies);
+    printPercentiles("schedule lateness", stats.lateness);
+    printPercentiles("recorded commit to fence signal", stats.recordedFenceWaits);
+}
+
+bool parseSize(const char* value, uint32_t& width, uint32_t& height)
+{
+    return std::sscanf(value, "%ux%u", &width, &height) == 2 && width && height && width <= UINT16_MAX && height <= UINT16_MAX;
+}
+
+void usage(const char* program)
+{
+    std::fprintf(stderr, "usage: %s [ipc|frames] [--views N] [--clients M] [--frames F] [--messages K] [--size WxH] [--seqpacket] [--ring]\n", program);
+    std::fprintf(stderr, "       %s replay <recording> [--speed X] [--size WxH] [--seqpacket] [--ring]\n", program);
+    std::fprintf(stderr, "       %s dump <recording>\n", program);
+    std::exit(EXIT_FAILURE);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const char* argument = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        auto number = [&](uint32_t& result) {
+            if (!value || (result = uint32_t(std::strtoul(value, nullptr, 10))) == 0)
+                usage(argv[0]);
+            ++i;
+        };
+
+        if (!std::strcmp(argument, "ipc"))
+            options.runFrames = false;
+        else if (!std::strcmp(argument, "frames"))
+            options.runIPC = false;
+        else if (!std::strcmp(argument, "replay") || !std::strcmp(argument, "dump")) {
+            if (!value)
+                usage(argv[0]);
+            options.runIPC = options.runFrames = false;
+            options.runReplay = !std::strcmp(argument, "replay");
+            options.runDump = !options.runReplay;
+            options.recordingPath = value;
+            ++i;
+        } else if (!std::strcmp(argument, "--speed")) {
+            if (!value || (options.speed = std::strtod(value, nullptr)) <= 0)
+                usage(argv[0]);
+            ++i;
+        }
+        else if (!std::strcmp(argument, "--views"))
+            number(options.views);
+        else if (!std::strcmp(argument, "--clients"))
+            number(options.clients);
+        else if (!std::strcmp(argument, "--frames"))
+            number(options.frames);
+        else if (!std::strcmp(argument, "--messages"))
+            number(options.messages);
+        else if (!std::strcmp(argument, "--size")) {
+            if (!value || !parseSize(value, options.width, options.height))
+                usage(argv[0]);
+            ++i;
+        } else if (!std::strcmp(argument, "--seqpacket"))
+            options.seqPacket = true;
+        else if (!std::strcmp(argument, "--ring"))
+            options.messageRing = true;
+        else
+            usage(argv[0]);
+    }
+
+    if (options.runDump) {
+        dumpRecording(options.recordingPath);
+        return EXIT_SUCCESS;
+    }
+
+    if (!wpe_loader_init("libWPEBackend-android.so")) {
+        std::fprintf(stderr, "failed to load libWPEBackend-android.so\n");
+        return EXIT_FAILURE;
+    }
+
+    if (options.runIPC)
+        runIPCBenchmark(options);
+    if (options.runFrames)
+        runFrameBenchmark(options);
+    if (options.runReplay)
+        runReplay(options);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,62 @@
+#ifndef WPE_ANDROID_RENDERER_BACKEND_EGL_H
+#define WPE_ANDROID_RENDERER_BACKEND_EGL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct wpe_renderer_backend_egl_target;
+
+typedef struct AHardwareBuffer AHardwareBuffer;
+
+// Web process side, for the renderer drawing into a target between the frame_will_render
+// and frame_rendered calls of the frame.
+
+// Adds to the part of the frame which changed since the previous one, in pixels with a
+// top-left origin. Frames without any damage are treated as fully changed.
+void WPEAndroidRendererBackendEGLTarget_addDamage(struct wpe_renderer_backend_egl_target*,
+    int32_t x, int32_t y, int32_t width, int32_t height);
+
+// How many frames ago the buffer being rendered into was last rendered, like EGL_BUFFER_AGE_EXT.
+// 0 means its contents are undefined and the whole frame has to be drawn.
+uint32_t WPEAndroidRendererBackendEGLTarget_getBufferAge(struct wpe_renderer_backend_egl_target*);
+
+// Whether the target renders into protected buffers, which takes an EGL context created with
+// EGL_PROTECTED_CONTENT_EXT. False until the target has its buffer pool, if the device can't
+// allocate protected buffers, or once a frame was rendered with an unprotected context.
+bool WPEAndroidRendererBackendEGLTarget_isProtected(struct wpe_renderer_backend_egl_target*);
+
+// Layers show buffers which the renderer didn't draw, such as decoded video frames, beside
+// the page content. The UI process can put them on a hardware overlay instead of having them
+// composited into every frame. To be called from the thread the target renders on.
+
+// False until the target has its buffer pool, or if the view has nowhere to put layers.
+bool WPEAndroidRendererBackendEGLTarget_supportsLayers(struct wpe_renderer_backend_egl_target*);
+
+// Shows the buffer as layer layerID, which is non-zero, at the given position and size in
+// view pixels. zOrder stacks it relative to the page content at 0, layers below need the
+// page to be transparent over them. Takes ownership of the acquire fence, -1 for none, and
+// holds on to the buffer until the release handler gets it back. Returns false, leaving both
+// with the caller, when layers aren't supported or every buffer of the layer is still in use.
+bool WPEAndroidRendererBackendEGLTarget_commitLayer(struct wpe_renderer_backend_egl_target*, uint32_t layerID,
+    AHardwareBuffer*, int fenceFD, int32_t x, int32_t y, uint32_t width, uint32_t height, int32_t zOrder);
+
+// The ID can be used again once every buffer of the layer has been released.
+void WPEAndroidRendererBackendEGLTarget_removeLayer(struct wpe_renderer_backend_egl_target*, uint32_t layerID);
+
+// Called once the UI process is done with a buffer of a layer, which can then be reused for
+// the next frame of its producer after waiting for the release fence, -1 if there is none.
+// The handler takes ownership of the fence.
+typedef void (*WPEAndroidRendererBackendEGLTarget_ReleaseLayerBuffer)(void* context, uint32_t layerID,
+    AHardwareBuffer*, int releaseFenceFD);
+void WPEAndroidRendererBackendEGLTarget_setReleaseLayerBufferHandler(struct wpe_renderer_backend_egl_target*,
+    void* context, WPEAndroidRendererBackendEGLTarget_ReleaseLayerBuffer func);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WPE_ANDROID_RENDERER_BACKEND_EGL_H
@@ -0,0 +1,41 @@
+#ifndef WPE_ANDROID_RENDERER_HOST_H
+#define WPE_ANDROID_RENDERER_HOST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    WPEAndroidIPCTransport_Stream,
+    WPEAndroidIPCTransport_SeqPacket,
+} WPEAndroidIPCTransport;
+
+// Socket type used for connections to web processes and view backends created after the call.
+void WPEAndroidRendererHost_setIPCTransport(WPEAndroidIPCTransport);
+
+// Delivers buffer releases and frame completions to web processes connected after the call
+// through a shared memory ring, waking them up once per burst instead of once per message.
+void WPEAndroidRendererHost_setMessageRingEnabled(bool enabled);
+
+// Handles web process connections created after the call on a dedicated thread instead of
+// the thread default main context. The WPEAndroidViewBackend_CommitBuffer handlers are then
+// invoked on that thread and must not block on threads calling into the view backends.
+void WPEAndroidRendererHost_setIPCThreadEnabled(bool enabled);
+
+// Records every message exchanged with the web processes and the view backends, with its
+// timestamp and the signal time of the fences buffers were committed with, into a ring of the
+// last capacity messages in the file at path, which is created or truncated. The file is
+// 64 bytes per message, plus 16KiB for the setup of the pools still alive which the ring
+// no longer holds, and can be replayed with `wpe-android-bench replay <path>`.
+// Returns false if the file can't be created or a recording is already running.
+bool WPEAndroidRendererHost_startRecording(const char* path, uint32_t capacity);
+void WPEAndroidRendererHost_stopRecording(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WPE_ANDROID_RENDERER_HOST_H
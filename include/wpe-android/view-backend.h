@@ -5,9 +5,11 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
 #include <wpe/wpe.h>
 
 typedef struct AHardwareBuffer AHardwareBuffer;
+typedef struct ANativeWindow ANativeWindow;
 
 struct WPEAndroidBuffer;
 struct WPEAndroidViewBackend;
@@ -22,15 +24,187 @@ void WPEAndroidViewBackend_destroy(WPEAndroidViewBackend*);
 
 WPEViewBackend* WPEAndroidViewBackend_getWPEViewBackend(WPEAndroidViewBackend*);
 
+// Number of buffers (2-8, default 4) in the pools created for this view after the call.
+void WPEAndroidViewBackend_setBufferCount(WPEAndroidViewBackend*, uint32_t bufferCount);
+
+// Rounds buffer allocations up to multiples of this many pixels so that small resizes
+// reuse the existing buffers. Defaults to 0, allocating at the exact view size.
+void WPEAndroidViewBackend_setResizeBucket(WPEAndroidViewBackend*, uint32_t resizeBucket);
+
+typedef enum {
+    WPEAndroidBufferFormat_RGBA8888,
+    WPEAndroidBufferFormat_RGBX8888,
+    WPEAndroidBufferFormat_RGB565,
+    WPEAndroidBufferFormat_RGBA1010102,
+} WPEAndroidBufferFormat;
+
+// Pixel format of the buffers in the pools created for this view after the call, RGBA8888
+// by default. RGBX8888 and RGB565 are opaque.
+void WPEAndroidViewBackend_setBufferFormat(WPEAndroidViewBackend*, WPEAndroidBufferFormat);
+
+// Promises that the content covers the whole view without transparency, which spares the
+// compositor blending it. Implied by the opaque formats.
+void WPEAndroidViewBackend_setOpaque(WPEAndroidViewBackend*, bool opaque);
+
+// Whether buffers get a depth/stencil attachment, true by default. Pages without 3D CSS
+// transforms, WebGL on the main framebuffer or clipping by stencil can do without it.
+void WPEAndroidViewBackend_setDepthStencilEnabled(WPEAndroidViewBackend*, bool enabled);
+
+// When the application holds on to every buffer, the web process waits up to this many
+// milliseconds (at most 65535) for one to be released before skipping the frame. Defaults
+// to 0, skipping right away. Applies to the pools created for this view after the call.
+void WPEAndroidViewBackend_setBufferReleaseTimeout(WPEAndroidViewBackend*, uint32_t milliseconds);
+
+// Allocates the page buffers of pools created for this view after the call as protected
+// content, so that DRM protected video can be composited into them without ever being
+// readable by the CPU or unprotected GPU contexts. The web process renderer needs a protected
+// EGL context for that, and the buffers can only be shown through the presentation window or
+// a hardware overlay, see WPEAndroidBuffer_isProtected(). Has no effect with a readback handler.
+void WPEAndroidViewBackend_setProtectedContentEnabled(WPEAndroidViewBackend*, bool enabled);
+
+// Mailbox mode, off by default: the web process renders its next frame as soon as one is
+// committed instead of waiting for dispatchFrameComplete(). Frames committed while the
+// application is still busy with the previous one wait for its dispatchFrameComplete(),
+// which calls the commit handler with the newest of them, the older ones are released right
+// away. Trades GPU work for latency, frames that never get shown are rendered too.
+void WPEAndroidViewBackend_setMailboxEnabled(WPEAndroidViewBackend*, bool enabled);
+
 typedef void (*WPEAndroidViewBackend_CommitBuffer)(void* context, WPEAndroidBuffer*, int fenceID);
 void WPEAndroidViewBackend_setCommitBufferHandler(WPEAndroidViewBackend*, void* context, WPEAndroidViewBackend_CommitBuffer func);
 
+// Headless mode: receives the pixels of every committed frame instead of the commit handler,
+// in the buffer format of the view with stride bytes per row, on a thread of the backend's own. The buffer is
+// released and the frame completed once the handler returns. Has to be set before the web
+// view is created, since buffers need to be allocated for CPU reads. The handler must not be
+// changed from within itself, clearing it waits for a frame being handed to it.
+typedef void (*WPEAndroidViewBackend_ReadbackFrame)(void* context, const void* pixels, uint32_t width, uint32_t height, uint32_t stride);
+void WPEAndroidViewBackend_setReadbackHandler(WPEAndroidViewBackend*, void* context, WPEAndroidViewBackend_ReadbackFrame func);
+
 void WPEAndroidViewBackend_dispatchReleaseBuffer(WPEAndroidViewBackend*, WPEAndroidBuffer*);
 
+// Releases the buffer before the consumer is done with it, the web process waits on the GPU
+// for the fence to signal before rendering into the buffer again. Takes ownership of the fence,
+// -1 behaves like dispatchReleaseBuffer().
+void WPEAndroidViewBackend_dispatchReleaseBufferWithFence(WPEAndroidViewBackend*, WPEAndroidBuffer*, int releaseFenceFD);
+
 void WPEAndroidViewBackend_dispatchFrameComplete(WPEAndroidViewBackend*);
 
+// To be called with the level passed to ComponentCallbacks2.onTrimMemory(). From
+// TRIM_MEMORY_RUNNING_MODERATE on, the web process frees the buffers of the view it isn't
+// using down to one, or all of them from TRIM_MEMORY_UI_HIDDEN on, and drops the EGL images
+// it kept around. Buffers come back as frames need them.
+void WPEAndroidViewBackend_trimMemory(WPEAndroidViewBackend*, int level);
+
+// Presents frames on a child surface of the window through ASurfaceControl (API level 29),
+// bypassing the commit handler. Buffers are released and frames completed by the backend
+// itself then. Passing NULL goes back to the commit handler. Returns false on failure.
+bool WPEAndroidViewBackend_setPresentationWindow(WPEAndroidViewBackend*, ANativeWindow*);
+
+// Completes frames on vsync through AChoreographer, in place of dispatchFrameComplete().
+// Has to be called from a thread with an ALooper, such as the application main thread,
+// returns false if vsync pacing isn't available there.
+bool WPEAndroidViewBackend_setVsyncPacingEnabled(WPEAndroidViewBackend*, bool enabled);
+
+// Paces the view at this rate below the display refresh rate with vsync pacing, 0 by default
+// which means every vsync.
+void WPEAndroidViewBackend_setPreferredFrameRate(WPEAndroidViewBackend*, float frameRate);
+
+typedef struct {
+    // Display.getDisplayId(), 0 being the default display.
+    int32_t id;
+    // DisplayMetrics.density, buffer pixels per view pixel.
+    float deviceScaleFactor;
+    // Display.getRefreshRate(), 0 if unknown.
+    float refreshRate;
+} WPEAndroidDisplay;
+
+// The display the view is shown on, the default display at a scale factor of 1 unless set.
+// To be called again from the view's thread whenever its window moves to another display or
+// the display changes. The web process renders at the view size times the scale factor, so
+// the view size is in device-independent pixels, and buffers are only as large as the display
+// of the view needs. AChoreographer follows the default display, views on other displays are
+// paced at the refresh rate given here with vsync pacing.
+void WPEAndroidViewBackend_setDisplay(WPEAndroidViewBackend*, const WPEAndroidDisplay*);
+
 AHardwareBuffer* WPEAndroidBuffer_getAHardwareBuffer(WPEAndroidBuffer*);
 
+// Size of the rendered content, starting at the buffer origin. Only differs from
+// the AHardwareBuffer size when a resize bucket is set.
+void WPEAndroidBuffer_getContentSize(WPEAndroidBuffer*, uint32_t* width, uint32_t* height);
+
+// Protected buffers can't be sampled by the application's own GL context, they have to go to
+// the compositor as they are, through an ASurfaceControl or a SurfaceView overlay.
+bool WPEAndroidBuffer_isProtected(WPEAndroidBuffer*);
+
+#define WPE_ANDROID_MAX_DAMAGE_RECTS 8
+
+typedef struct {
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+} WPEAndroidRect;
+
+// Part of the content which changed since the previous buffer committed for the view, in
+// content coordinates with a top-left origin. Fills up to capacity rectangles and returns
+// how many there are, at most WPE_ANDROID_MAX_DAMAGE_RECTS. 0 means the whole content.
+uint32_t WPEAndroidBuffer_getDamage(WPEAndroidBuffer*, WPEAndroidRect* rects, uint32_t capacity);
+
+typedef struct {
+    // Chosen by the web process, unique within the view.
+    uint32_t id;
+    // Where the buffer goes, in view pixels.
+    WPEAndroidRect frame;
+    // Stacking relative to the page content at 0, layers below need it to be transparent there.
+    int32_t zOrder;
+} WPEAndroidLayer;
+
+// Receives the layers the web process shows beside the page content, such as video frames
+// which can go on a hardware overlay without being composited into the page first. Every
+// buffer is given back with dispatchReleaseBuffer() like the page buffers, layer commits don't
+// wait for dispatchFrameComplete(). A NULL buffer means the layer was removed. Has to be set
+// before the web view is created, layers are composited into the page otherwise. Layers go to
+// the presentation window instead when there is one.
+typedef void (*WPEAndroidViewBackend_CommitLayer)(void* context, const WPEAndroidLayer*, WPEAndroidBuffer*, int fenceFD);
+void WPEAndroidViewBackend_setCommitLayerHandler(WPEAndroidViewBackend*, void* context, WPEAndroidViewBackend_CommitLayer func);
+
+#define WPE_ANDROID_FRAME_HISTOGRAM_BUCKETS 20
+
+// Durations in nanoseconds. Bucket 0 counts samples under 1us, bucket i those under 2^i us
+// that didn't fit in bucket i - 1, and the last bucket everything longer.
+typedef struct {
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    uint64_t buckets[WPE_ANDROID_FRAME_HISTOGRAM_BUCKETS];
+} WPEAndroidFrameHistogram;
+
+typedef struct {
+    uint64_t framesCommitted;
+    // Frames the web process skipped because the application held on to every buffer.
+    uint64_t framesDropped;
+
+    // Web process done rendering until the commit handler is called.
+    WPEAndroidFrameHistogram commitLatency;
+    // Commit handler called until WPEAndroidViewBackend_dispatchReleaseBuffer().
+    WPEAndroidFrameHistogram bufferHoldTime;
+    // Web process done rendering until the GPU signalled the buffer fence.
+    WPEAndroidFrameHistogram fenceWait;
+
+    // Web process waiting for a buffer to be released, see setBufferReleaseTimeout().
+    WPEAndroidFrameHistogram bufferWait;
+    // Waits which ran out, the frame was dropped then.
+    uint64_t bufferWaitTimeouts;
+
+    // Frames replaced in the mailbox before the application picked them up.
+    uint64_t framesReplaced;
+} WPEAndroidFrameStats;
+
+// Frame statistics are only collected while enabled, which is off by default.
+void WPEAndroidViewBackend_setFrameStatsEnabled(WPEAndroidViewBackend*, bool enabled);
+void WPEAndroidViewBackend_getFrameStats(WPEAndroidViewBackend*, WPEAndroidFrameStats*);
+void WPEAndroidViewBackend_resetFrameStats(WPEAndroidViewBackend*);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,143 @@
+#include "frame-reader.h"
+
+#include <android/hardware_buffer.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "renderer-host-private.h"
+#include "tracing.h"
+#include "view-backend-private.h"
+
+namespace WPEAndroid {
+
+namespace {
+
+GSourceFuncs completionSourceFuncs = {
+    nullptr, // prepare
+    nullptr, // check
+    // dispatch
+    [] (GSource* source, GSourceFunc callback, gpointer data) -> gboolean
+    {
+        g_source_set_ready_time(source, -1);
+        return callback(data);
+    },
+    nullptr, // finalize
+    nullptr, // closure_callback
+    nullptr, // closure_marshall
+};
+
+} // namespace
+
+FrameReader::FrameReader(ViewBackend& viewBackend, GMainContext* context)
+    : m_viewBackend(viewBackend)
+{
+    m_completionSource = g_source_new(&completionSourceFuncs, sizeof(GSource));
+    g_source_set_name(m_completionSource, "WPEBackend-android::readback-completions");
+    g_source_set_callback(m_completionSource, [] (gpointer data) -> gboolean {
+        static_cast<FrameReader*>(data)->dispatchCompletions();
+        return G_SOURCE_CONTINUE;
+    }, this, nullptr);
+    g_source_attach(m_completionSource, context);
+
+    m_thread = std::thread([this] { run(); });
+}
+
+FrameReader::~FrameReader()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stopping = true;
+    }
+    m_condition.notify_one();
+    m_thread.join();
+
+    g_source_destroy(m_completionSource);
+    g_source_unref(m_completionSource);
+
+    // Frames which weren't read anymore are dropped along with their fence.
+    for (auto& frame : m_pendingFrames) {
+        if (frame.fenceFD != -1)
+            close(frame.fenceFD);
+        m_viewBackend.releaseBuffer(frame.buffer);
+    }
+    for (auto* buffer : m_readBuffers)
+        m_viewBackend.releaseBuffer(buffer);
+}
+
+void FrameReader::read(Buffer* buffer, int fenceFD)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_pendingFrames.push_back({ buffer, fenceFD, buffer->contentWidth(), buffer->contentHeight() });
+    }
+    m_condition.notify_one();
+}
+
+void FrameReader::run()
+{
+    while (true) {
+        Frame frame;
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_condition.wait(lock, [this] { return m_stopping || !m_pendingFrames.empty(); });
+            if (m_stopping)
+                return;
+            frame = m_pendingFrames.front();
+            m_pendingFrames.pop_front();
+        }
+
+        readFrame(frame);
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_readBuffers.push_back(frame.buffer);
+        g_source_set_ready_time(m_completionSource, 0);
+    }
+}
+
+void FrameReader::readFrame(const Frame& frame)
+{
+    WPE_ANDROID_TRACE_SCOPE("FrameReader::readFrame");
+
+    if (frame.fenceFD != -1) {
+        struct pollfd pfd = { frame.fenceFD, POLLIN, 0 };
+        while (poll(&pfd, 1, -1) == -1 && errno == EINTR) { }
+        close(frame.fenceFD);
+    }
+
+    AHardwareBuffer* hardwareBuffer = frame.buffer->hardwareBuffer();
+    AHardwareBuffer_Desc description;
+    AHardwareBuffer_describe(hardwareBuffer, &description);
+
+    void* pixels = nullptr;
+    int ret = AHardwareBuffer_lock(hardwareBuffer, AHARDWAREBUFFER_USAGE_CPU_READ_OFTEN, -1, nullptr, &pixels);
+    if (ret || !pixels) {
+        ALOGE("FrameReader: failed to lock buffer for reading: ret %d", ret);
+        return;
+    }
+
+    // The stride is reported in pixels.
+    uint32_t bytesPerPixel = description.format == AHARDWAREBUFFER_FORMAT_R5G6B5_UNORM ? 2 : 4;
+    m_viewBackend.androidBackend()->readbackFrame(pixels, frame.width, frame.height, description.stride * bytesPerPixel);
+
+    AHardwareBuffer_unlock(hardwareBuffer, nullptr);
+}
+
+void FrameReader::dispatchCompletions()
+{
+    std::lock_guard<std::recursive_mutex> hostLock(RendererHost::instance().lock());
+
+    std::vector<Buffer*> buffers;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        buffers.swap(m_readBuffers);
+    }
+
+    for (auto* buffer : buffers) {
+        m_viewBackend.releaseBuffer(buffer);
+        m_viewBackend.framePresented();
+    }
+}
+
+} // namespace WPEAndroid
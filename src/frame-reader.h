@@ -0,0 +1,52 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <gio/gio.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace WPEAndroid {
+
+class Buffer;
+class ViewBackend;
+
+// Reads committed buffers back to memory for views without a screen, in place of the commit
+// handler. Buffers are locked for CPU reads on a thread of its own once their fence has
+// signalled, neither the web process nor the view's thread wait for the GPU. Buffers are
+// released and frames completed on the view's main context after the readback handler ran.
+//
+// Everything but the reader thread runs with the renderer host lock held.
+class FrameReader {
+public:
+    FrameReader(ViewBackend&, GMainContext*);
+    ~FrameReader();
+
+    void read(Buffer*, int fenceFD);
+
+private:
+    struct Frame {
+        Buffer* buffer;
+        int fenceFD;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    void run();
+    void readFrame(const Frame&);
+    void dispatchCompletions();
+
+    ViewBackend& m_viewBackend;
+    GSource* m_completionSource;
+
+    std::mutex m_lock;
+    std::condition_variable m_condition;
+    bool m_stopping { false };
+    std::deque<Frame> m_pendingFrames;
+    std::vector<Buffer*> m_readBuffers;
+
+    std::thread m_thread;
+};
+
+} // namespace WPEAndroid
@@ -0,0 +1,339 @@
+#include "frame-recorder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "frame-stats.h"
+#include "ipc-messages.h"
+#include "logging.h"
+#include "tracing.h"
+
+namespace WPEAndroid {
+
+bool FrameRecorder::start(const char* path, uint32_t capacity)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_memory) {
+        ALOGE("FrameRecorder: already recording");
+        return false;
+    }
+    if (!capacity)
+        return false;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        ALOGE("FrameRecorder: failed to open %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    size_t size = sizeof(Header) + size_t(snapshotCapacity + capacity) * sizeof(Record);
+    if (ftruncate(fd, size) == -1) {
+        ALOGE("FrameRecorder: failed to size %s: %s", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    // The mapping keeps the file alive.
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        ALOGE("FrameRecorder: failed to map %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    m_memory = memory;
+    m_memorySize = size;
+    m_header = static_cast<Header*>(memory);
+    m_snapshot = reinterpret_cast<Record*>(static_cast<char*>(memory) + sizeof(Header));
+    m_records = m_snapshot + snapshotCapacity;
+
+    m_header->magic = magic;
+    m_header->version = version;
+    m_header->capacity = capacity;
+    m_header->recordSize = sizeof(Record);
+    m_header->writeCount.store(0);
+    m_header->startTime = monotonicTime();
+    m_header->snapshotCapacity = snapshotCapacity;
+    m_header->snapshotCount.store(0);
+
+    m_setupRecords.clear();
+    m_overwrittenSetupRecords = 0;
+    m_snapshotChanged = false;
+
+    m_recording.store(true);
+    return true;
+}
+
+void FrameRecorder::stop()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_recording.store(false);
+    closeFences();
+    m_setupRecords.clear();
+    m_overwrittenSetupRecords = 0;
+
+    if (!m_memory)
+        return;
+
+    msync(m_memory, m_memorySize, MS_SYNC);
+    munmap(m_memory, m_memorySize);
+    m_memory = nullptr;
+    m_memorySize = 0;
+    m_header = nullptr;
+    m_snapshot = nullptr;
+    m_records = nullptr;
+}
+
+void FrameRecorder::record(Direction direction, uint32_t clientID, const IPC::Message& message)
+{
+    uint64_t time = monotonicTime();
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!m_memory)
+        return;
+
+    uint64_t signalTime = 0;
+    if (direction == Direction::ToWebProcess && message.messageCode == IPC::ReleaseBuffer::code) {
+        auto release = IPC::ReleaseBuffer::from(message);
+        auto it = m_fences.find(fenceKey(release.poolID, release.layerID, release.bufferID));
+        if (it != m_fences.end()) {
+            signalTime = fenceSignalTime(it->second);
+            close(it->second);
+            m_fences.erase(it);
+        }
+    }
+
+    Record record = Record();
+    record.time = time;
+    record.fenceSignalTime = signalTime;
+    record.clientID = clientID;
+    record.direction = direction;
+    record.message = message;
+
+    uint64_t index = m_header->writeCount.load(std::memory_order_relaxed);
+    trackSetupRecord(index, record);
+
+    // The slot about to be written holds the record from one lap ago.
+    if (index >= m_header->capacity) {
+        uint64_t overwritten = index - m_header->capacity;
+        while (m_overwrittenSetupRecords < m_setupRecords.size() && m_setupRecords[m_overwrittenSetupRecords].index <= overwritten) {
+            m_overwrittenSetupRecords++;
+            m_snapshotChanged = true;
+        }
+    }
+    if (m_snapshotChanged)
+        writeSnapshot();
+
+    m_records[index % m_header->capacity] = record;
+    m_header->writeCount.store(index + 1, std::memory_order_release);
+}
+
+void FrameRecorder::fenceReceived(uint32_t poolID, uint32_t layerID, uint32_t bufferID, int fenceFD)
+{
+    if (fenceFD < 0 || !recording())
+        return;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!m_memory)
+        return;
+
+    int fd = dup(fenceFD);
+    auto result = m_fences.emplace(fenceKey(poolID, layerID, bufferID), fd);
+    if (!result.second) {
+        // The previous commit of the buffer was never released.
+        if (result.first->second != -1)
+            close(result.first->second);
+        result.first->second = fd;
+    }
+}
+
+template<typename Predicate>
+void FrameRecorder::removeSetupRecords(Predicate predicate)
+{
+    size_t kept = 0;
+    size_t overwrittenKept = 0;
+    for (size_t i = 0; i < m_setupRecords.size(); ++i) {
+        bool overwritten = i < m_overwrittenSetupRecords;
+        if (predicate(m_setupRecords[i])) {
+            m_snapshotChanged |= overwritten;
+            continue;
+        }
+        if (overwritten)
+            overwrittenKept++;
+        m_setupRecords[kept++] = m_setupRecords[i];
+    }
+    m_setupRecords.resize(kept);
+    m_overwrittenSetupRecords = overwrittenKept;
+}
+
+template<typename Predicate>
+void FrameRecorder::closeFences(Predicate predicate)
+{
+    for (auto it = m_fences.begin(); it != m_fences.end();) {
+        if (!predicate(it->first)) {
+            ++it;
+            continue;
+        }
+        if (it->second != -1)
+            close(it->second);
+        it = m_fences.erase(it);
+    }
+}
+
+void FrameRecorder::clientDisconnected(uint32_t clientID)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!m_memory)
+        return;
+
+    std::vector<uint32_t> poolIDs;
+    for (auto& setupRecord : m_setupRecords) {
+        if (setupRecord.record.clientID == clientID && setupRecord.record.message.messageCode == IPC::PoolConstruction::code)
+            poolIDs.push_back(IPC::PoolConstruction::from(setupRecord.record.message).poolID);
+    }
+
+    removeSetupRecords([clientID] (const SetupRecord& setupRecord) {
+        return setupRecord.record.clientID == clientID;
+    });
+    for (uint32_t poolID : poolIDs)
+        removePool(poolID);
+
+    if (m_snapshotChanged)
+        writeSnapshot();
+}
+
+// Every message about a pool starts with its ID, see messagePoolID() in the bench.
+static uint32_t messagePoolID(const IPC::Message& message)
+{
+    uint32_t poolID;
+    std::memcpy(&poolID, message.messageData, sizeof(poolID));
+    return poolID;
+}
+
+void FrameRecorder::trackSetupRecord(uint64_t index, const Record& record)
+{
+    auto& message = record.message;
+    switch (message.messageCode) {
+    case IPC::PoolIDReservation::code:
+    {
+        auto reservation = IPC::PoolIDReservation::from(message);
+        uint32_t count = std::min<uint32_t>(reservation.count, G_N_ELEMENTS(reservation.poolIDs));
+        if (count)
+            m_setupRecords.push_back({ index, (1u << count) - 1, record });
+        break;
+    }
+    case IPC::PoolConstruction::code:
+    {
+        // The reservation goes once every pool ID it carried is in use.
+        uint32_t poolID = IPC::PoolConstruction::from(message).poolID;
+        for (auto& setupRecord : m_setupRecords) {
+            if (setupRecord.record.clientID != record.clientID || setupRecord.record.message.messageCode != IPC::PoolIDReservation::code)
+                continue;
+            auto reservation = IPC::PoolIDReservation::from(setupRecord.record.message);
+            for (uint32_t i = 0; i < G_N_ELEMENTS(reservation.poolIDs); ++i) {
+                if (reservation.poolIDs[i] == poolID)
+                    setupRecord.pendingPoolIDs &= ~(1u << i);
+            }
+        }
+        removeSetupRecords([] (const SetupRecord& setupRecord) {
+            return setupRecord.record.message.messageCode == IPC::PoolIDReservation::code && !setupRecord.pendingPoolIDs;
+        });
+        m_setupRecords.push_back({ index, 0, record });
+        break;
+    }
+    case IPC::PoolConstructionReply::code:
+    case IPC::RegisterPool::code:
+        m_setupRecords.push_back({ index, 0, record });
+        break;
+    case IPC::PoolUsageChange::code:
+    {
+        // Only the latest usage matters.
+        uint32_t poolID = messagePoolID(message);
+        removeSetupRecords([poolID] (const SetupRecord& setupRecord) {
+            return setupRecord.record.message.messageCode == IPC::PoolUsageChange::code && messagePoolID(setupRecord.record.message) == poolID;
+        });
+        m_setupRecords.push_back({ index, 0, record });
+        break;
+    }
+    case IPC::BufferAllocation::code:
+    case IPC::BufferDestruction::code:
+    {
+        // Layer buffers come and go with their layers, only those of the page are kept.
+        bool allocated = message.messageCode == IPC::BufferAllocation::code;
+        if (allocated && IPC::BufferAllocation::from(message).layerID)
+            break;
+
+        // Both start with the pool and buffer IDs.
+        auto destruction = IPC::BufferDestruction::from(message);
+        removeSetupRecords([destruction] (const SetupRecord& setupRecord) {
+            if (setupRecord.record.message.messageCode != IPC::BufferAllocation::code)
+                return false;
+            auto allocation = IPC::BufferAllocation::from(setupRecord.record.message);
+            return allocation.poolID == destruction.poolID && allocation.bufferID == destruction.bufferID && !allocation.layerID;
+        });
+        if (allocated)
+            m_setupRecords.push_back({ index, 0, record });
+        else {
+            uint64_t key = fenceKey(destruction.poolID, 0, destruction.bufferID);
+            closeFences([key] (uint64_t fence) { return fence == key; });
+        }
+        break;
+    }
+    case IPC::LayerRemoval::code:
+    {
+        auto removal = IPC::LayerRemoval::from(message);
+        closeFences([removal] (uint64_t key) {
+            return key >> 32 == removal.poolID && (key >> 16 & 0xffff) == (removal.layerID & 0xffff);
+        });
+        break;
+    }
+    case IPC::UnregisterPool::code:
+    case IPC::PoolPurge::code:
+        removePool(messagePoolID(message));
+        break;
+    default:
+        break;
+    }
+}
+
+void FrameRecorder::removePool(uint32_t poolID)
+{
+    removeSetupRecords([poolID] (const SetupRecord& setupRecord) {
+        auto code = setupRecord.record.message.messageCode;
+        return code != IPC::PoolIDReservation::code && messagePoolID(setupRecord.record.message) == poolID;
+    });
+    closeFences([poolID] (uint64_t key) {
+        return key >> 32 == poolID;
+    });
+}
+
+void FrameRecorder::writeSnapshot()
+{
+    m_snapshotChanged = false;
+
+    // The oldest ones are kept, later records like allocations mean little without them.
+    size_t count = std::min<size_t>(m_overwrittenSetupRecords, snapshotCapacity);
+    if (count < m_overwrittenSetupRecords)
+        ALOGW("FrameRecorder: %zu setup records don't fit into the snapshot", m_overwrittenSetupRecords - count);
+
+    // Empty while it is rewritten, should the process die meanwhile.
+    m_header->snapshotCount.store(0, std::memory_order_release);
+    for (size_t i = 0; i < count; ++i)
+        m_snapshot[i] = m_setupRecords[i].record;
+    m_header->snapshotCount.store(count, std::memory_order_release);
+}
+
+void FrameRecorder::closeFences()
+{
+    for (auto& entry : m_fences) {
+        if (entry.second != -1)
+            close(entry.second);
+    }
+    m_fences.clear();
+}
+
+} // namespace WPEAndroid
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "ipc.h"
+
+namespace WPEAndroid {
+
+// Keeps the messages the renderer host exchanges with the web processes and the view backends
+// in a ring of fixed-size records in a memory-mapped file, for the buffer exchange behind a
+// jank report to be pulled off the device and replayed with `wpe-android-bench replay`.
+// Records go straight to the shared mapping, so the file holds everything up to the last
+// message even if the process dies. Recording only takes a lock and a copy per message.
+//
+// The messages setting up pools which are still alive, such as their construction and buffer
+// allocations, would be lost once the ring wraps around. When the ring overwrites one of them,
+// it goes to a snapshot section between the header and the ring instead, which holds them in
+// their original order and is rewritten whenever that set changes.
+class FrameRecorder {
+public:
+    static const uint32_t magic = 0x57504672; // "WPFr"
+    static const uint32_t version = 2;
+    static const uint32_t snapshotCapacity = 256;
+
+    enum class Direction : uint8_t {
+        // Received from a web process on its renderer host socket.
+        FromWebProcess,
+        // Sent to a web process, through the socket or the message ring.
+        ToWebProcess,
+        // Received on the socket of a view backend.
+        FromView,
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t capacity;
+        uint32_t recordSize;
+        // Records written since the recording started, the oldest one left is at
+        // writeCount % capacity once the ring has wrapped around.
+        std::atomic<uint64_t> writeCount;
+        uint64_t startTime;
+        // Records in the snapshot section, which comes before the ring and has room for
+        // snapshotCapacity of them. All of them are older than the ones left in the ring.
+        uint32_t snapshotCapacity;
+        std::atomic<uint32_t> snapshotCount;
+        uint8_t padding[24];
+    };
+    static_assert(sizeof(Header) == 64, "FrameRecorder::Header is of correct size");
+
+    struct Record {
+        // CLOCK_MONOTONIC, in nanoseconds.
+        uint64_t time;
+        // For buffer releases, when the fence the buffer was committed with signalled,
+        // 0 without a fence or if it hadn't signalled by then.
+        uint64_t fenceSignalTime;
+        // Tells the web process connections apart, 0 for view backend sockets.
+        uint32_t clientID;
+        Direction direction;
+        uint8_t padding[11];
+        IPC::Message message;
+    };
+    static_assert(sizeof(Record) == 64, "FrameRecorder::Record is of correct size");
+
+    // Creates or truncates the file at path, room for capacity records.
+    bool start(const char* path, uint32_t capacity);
+    void stop();
+
+    bool recording() const { return m_recording.load(std::memory_order_relaxed); }
+
+    // A new ID for every web process connection.
+    uint32_t nextClientID() { return m_nextClientID++; }
+
+    void record(Direction, uint32_t clientID, const IPC::Message&);
+
+    // The fence a buffer was committed with, read back when the buffer is released.
+    // The descriptor stays with the caller.
+    void fenceReceived(uint32_t poolID, uint32_t layerID, uint32_t bufferID, int fenceFD);
+
+    // The web process went away without unregistering its pools.
+    void clientDisconnected(uint32_t clientID);
+
+private:
+    static uint64_t fenceKey(uint32_t poolID, uint32_t layerID, uint32_t bufferID)
+    {
+        return uint64_t(poolID) << 32 | uint64_t(layerID & 0xffff) << 16 | (bufferID & 0xffff);
+    }
+
+    struct SetupRecord {
+        // Write count of the record, it is gone from the ring once the ring moved past it.
+        uint64_t index;
+        // For PoolIDReservation, the bits of the pool IDs no pool was constructed with yet.
+        uint32_t pendingPoolIDs;
+        Record record;
+    };
+
+    void trackSetupRecord(uint64_t index, const Record&);
+    template<typename Predicate> void removeSetupRecords(Predicate);
+    void removePool(uint32_t poolID);
+    void writeSnapshot();
+
+    void closeFences();
+    template<typename Predicate> void closeFences(Predicate);
+
+    std::atomic<bool> m_recording { false };
+    std::atomic<uint32_t> m_nextClientID { 1 };
+
+    std::mutex m_lock;
+    void* m_memory { nullptr };
+    size_t m_memorySize { 0 };
+    Header* m_header { nullptr };
+    Record* m_snapshot { nullptr };
+    Record* m_records { nullptr };
+
+    // Setup records of the live pools, oldest first. The leading ones the ring overwrote
+    // already make up the snapshot.
+    std::vector<SetupRecord> m_setupRecords;
+    size_t m_overwrittenSetupRecords { 0 };
+    bool m_snapshotChanged { false };
+
+    // Duplicates of the fences of the buffers currently committed.
+    std::unordered_map<uint64_t, int> m_fences;
+};
+
+} // namespace WPEAndroid
@@ -0,0 +1,139 @@
+#include "frame-stats.h"
+
+#include <algorithm>
+#include <cstring>
+#include <linux/sync_file.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "renderer-host-private.h"
+#include "tracing.h"
+
+namespace WPEAndroid {
+
+uint64_t fenceSignalTime(int fenceFD)
+{
+    static const uint32_t maxFences = 4;
+    struct sync_fence_info fences[maxFences];
+    std::memset(fences, 0, sizeof(fences));
+
+    struct sync_file_info info;
+    std::memset(&info, 0, sizeof(info));
+    info.num_fences = maxFences;
+    info.sync_fence_info = reinterpret_cast<uintptr_t>(fences);
+
+    if (ioctl(fenceFD, SYNC_IOC_FILE_INFO, &info) == -1 || info.status != 1)
+        return 0;
+
+    uint64_t signalTime = 0;
+    for (uint32_t i = 0; i < std::min(info.num_fences, maxFences); ++i)
+        signalTime = std::max<uint64_t>(signalTime, fences[i].timestamp_ns);
+    return signalTime;
+}
+
+FrameStats::FrameStats()
+{
+    std::memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void FrameStats::record(WPEAndroidFrameHistogram& histogram, uint64_t duration)
+{
+    histogram.count++;
+    histogram.total += duration;
+    histogram.max = std::max(histogram.max, duration);
+
+    unsigned bucket = 0;
+    for (uint64_t bound = 1000; duration >= bound && bucket < WPE_ANDROID_FRAME_HISTOGRAM_BUCKETS - 1; bound *= 2)
+        ++bucket;
+    histogram.buckets[bucket]++;
+}
+
+void FrameStats::frameCommitted(Buffer& buffer, uint64_t renderedTime, uint32_t skippedFrames, int fenceFD)
+{
+    auto& timing = buffer.timing();
+    if (timing.fenceFD != -1) {
+        close(timing.fenceFD);
+        timing.fenceFD = -1;
+    }
+
+    if (!enabled()) {
+        timing.commitTime = 0;
+        return;
+    }
+
+    timing.renderedTime = renderedTime;
+    timing.commitTime = monotonicTime();
+
+    // The fence itself goes to the application, a duplicate is kept to read its signal time
+    // back once the buffer is released.
+    if (fenceFD >= 0)
+        timing.fenceFD = dup(fenceFD);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_stats.framesCommitted++;
+    m_stats.framesDropped += skippedFrames;
+    if (renderedTime && renderedTime <= timing.commitTime) {
+        record(m_stats.commitLatency, timing.commitTime - renderedTime);
+        WPE_ANDROID_TRACE_COUNTER("WPE commit latency", timing.commitTime - renderedTime);
+    }
+}
+
+void FrameStats::bufferReleased(Buffer& buffer)
+{
+    auto& timing = buffer.timing();
+    if (!timing.commitTime)
+        return;
+
+    uint64_t releaseTime = monotonicTime();
+    uint64_t signalTime = 0;
+    if (timing.fenceFD != -1) {
+        signalTime = fenceSignalTime(timing.fenceFD);
+        close(timing.fenceFD);
+        timing.fenceFD = -1;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        record(m_stats.bufferHoldTime, releaseTime - timing.commitTime);
+        if (signalTime && timing.renderedTime && signalTime >= timing.renderedTime)
+            record(m_stats.fenceWait, signalTime - timing.renderedTime);
+    }
+
+    WPE_ANDROID_TRACE_COUNTER("WPE buffer hold time", releaseTime - timing.commitTime);
+    timing.commitTime = 0;
+}
+
+void FrameStats::bufferWaited(uint64_t waitTime, bool timedOut)
+{
+    WPE_ANDROID_TRACE_COUNTER("WPE buffer wait", waitTime);
+    if (!enabled())
+        return;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    record(m_stats.bufferWait, waitTime);
+    if (timedOut)
+        m_stats.bufferWaitTimeouts++;
+}
+
+void FrameStats::frameReplaced()
+{
+    if (!enabled())
+        return;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_stats.framesReplaced++;
+}
+
+void FrameStats::get(WPEAndroidFrameStats& stats)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    stats = m_stats;
+}
+
+void FrameStats::reset()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    std::memset(&m_stats, 0, sizeof(m_stats));
+}
+
+} // namespace WPEAndroid
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+#include <wpe-android/view-backend.h>
+
+namespace WPEAndroid {
+
+class Buffer;
+
+// Time at which every fence in the sync file signalled, 0 if it is still pending.
+uint64_t fenceSignalTime(int fenceFD);
+
+// Per-view frame timing, fed by the renderer host as buffers are committed and released.
+class FrameStats {
+public:
+    FrameStats();
+
+    bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+    void setEnabled(bool enabled) { m_enabled.store(enabled, std::memory_order_relaxed); }
+
+    // renderedTime is when the web process finished the frame, skippedFrames how many frames
+    // it had to drop since the previous commit because no buffer was available.
+    void frameCommitted(Buffer&, uint64_t renderedTime, uint32_t skippedFrames, int fenceFD);
+    void bufferReleased(Buffer&);
+
+    // The web process waited this long for a buffer, and skipped the frame if it timed out.
+    void bufferWaited(uint64_t waitTime, bool timedOut);
+
+    // A newer frame took the place of one the application never got to see.
+    void frameReplaced();
+
+    void get(WPEAndroidFrameStats&);
+    void reset();
+
+private:
+    static void record(WPEAndroidFrameHistogram&, uint64_t duration);
+
+    std::atomic<bool> m_enabled { false };
+
+    std::mutex m_lock;
+    WPEAndroidFrameStats m_stats;
+};
+
+} // namespace WPEAndroid
@@ -2,9 +2,71 @@
 
 namespace IPC {
 
-struct PoolConstruction {
+// Bounds for the number of buffers in a pool, as negotiated through PoolConstructionReply.
+static const uint32_t minPoolBufferCount = 2;
+static const uint32_t maxPoolBufferCount = 8;
+static const uint32_t defaultPoolBufferCount = 4;
+
+// Damage rectangles of a frame beyond this many are merged into their bounding box.
+static const uint32_t maxDamageRects = 8;
+
+// Layers a pool can have beside the page content, and buffers each of them cycles through.
+static const uint32_t maxPoolLayers = 4;
+static const uint32_t maxLayerBufferCount = 8;
+
+// Sent by the UI process right after the connection is created, carrying the shared
+// memory and the two doorbells of an IPC::MessageRing as file descriptors. It is queued
+// before the web process even gets its end of the socket, which is why nothing on that
+// side may wait for a reply on the socket.
+struct MessageRingSetup {
     uint8_t padding[24];
 
+    static const uint64_t code = 1;
+    static void construct(Message& message, const MessageRingSetup& data)
+    {
+        message.messageCode = code;
+        std::memcpy(&message.messageData, &data, Message::dataSize);
+    }
+
+    static MessageRingSetup from(const Message& message)
+    {
+        MessageRingSetup data;
+        std::memcpy(&data, &message.messageData, Message::dataSize);
+        return data;
+    }
+};
+static_assert(sizeof(MessageRingSetup) == Message::dataSize, "MessageRingSetup is of correct size");
+
+// Pool IDs the UI process set aside for a web process, which constructs pools under them
+// without waiting for a reply. Sent on connection and topped up whenever one is taken.
+struct PoolIDReservation {
+    uint32_t count;
+    uint32_t poolIDs[5];
+
+    static const uint64_t code = 2;
+    static void construct(Message& message, const PoolIDReservation& data)
+    {
+        message.messageCode = code;
+        std::memcpy(&message.messageData, &data, Message::dataSize);
+    }
+
+    static PoolIDReservation from(const Message& message)
+    {
+        PoolIDReservation data;
+        std::memcpy(&data, &message.messageData, Message::dataSize);
+        return data;
+    }
+};
+static_assert(sizeof(PoolIDReservation) == Message::dataSize, "PoolIDReservation is of correct size");
+
+// The PoolConstructionReply with the pool configuration follows asynchronously.
+struct PoolConstruction {
+    // Client::token() of the view backend socket the pool will render for.
+    uint64_t viewToken;
+    // Taken from a PoolIDReservation.
+    uint32_t poolID;
+    uint8_t padding[12];
+
     static const uint64_t code = 4;
     static void construct(Message& message, const PoolConstruction& data)
     {
@@ -21,9 +83,25 @@ struct PoolConstruction {
 };
 static_assert(sizeof(PoolConstruction) == Message::dataSize, "PoolConstruction is of correct size");
 
+enum PoolFlags : uint16_t {
+    PoolDepthStencil = 1 << 0,
+    // The view has somewhere to put layers, see LayerCommit.
+    PoolLayers = 1 << 1,
+};
+
 struct PoolConstructionReply {
     uint32_t poolID;
-    uint8_t padding[20];
+    uint32_t bufferCount;
+    uint32_t resizeBucket;
+    // AHardwareBuffer usage the buffers need on top of rendering and composition.
+    uint32_t usage;
+    // AHardwareBuffer format of the buffers.
+    uint32_t format;
+    // PoolFlags.
+    uint16_t flags;
+    // How long frameWillRender() may wait for a buffer to be released when all of them are
+    // locked, in milliseconds. 0 skips the frame right away.
+    uint16_t releaseWaitTimeout;
 
     static const uint64_t code = 5;
     static void construct(Message& message, const PoolConstructionReply& data)
@@ -41,6 +119,30 @@ struct PoolConstructionReply {
 };
 static_assert(sizeof(PoolConstructionReply) == Message::dataSize, "PoolConstructionReply is of correct size");
 
+// Sent by the web process when it can't allocate buffers with the usage from the
+// PoolConstructionReply, such as protected content without a protected context, along with
+// the usage the buffers of the pool have from then on.
+struct PoolUsageChange {
+    uint32_t poolID;
+    uint32_t usage;
+    uint8_t padding[16];
+
+    static const uint64_t code = 13;
+    static void construct(Message& message, const PoolUsageChange& data)
+    {
+        message.messageCode = code;
+        std::memcpy(&message.messageData, &data, Message::dataSize);
+    }
+
+    static PoolUsageChange from(const Message& message)
+    {
+        PoolUsageChange data;
+        std::memcpy(&data, &message.messageData, Message::dataSize);
+        return data;
+    }
+};
+static_assert(sizeof(PoolUsageChange) == Message::dataSize, "PoolUsageChange is of correct size");
+
 struct PoolPurge {
     uint32_t poolID;
     uint8_t padding[20];
@@ -101,10 +203,36 @@ struct UnregisterPool {
 };
 static_assert(sizeof(UnregisterPool) == Message::dataSize, "UnregisterPool is of correct size");
 
+// Sent by the UI process under memory pressure. The web process frees the buffers of the pool
+// it isn't using until at most keepBufferCount remain allocated, telling the UI process about
+// each with a BufferDestruction, and allocates again only as frames need buffers.
+struct TrimMemory {
+    uint32_t poolID;
+    uint32_t keepBufferCount;
+    uint8_t padding[16];
+
+    static const uint64_t code = 9;
+    static void construct(Message& message, const TrimMemory& data)
+    {
+        message.messageCode = code;
+        std::memcpy(&message.messageData, &data, Message::dataSize);
+    }
+
+    static TrimMemory from(const Message& message)
+    {
+        TrimMemory data;
+        std::memcpy(&data, &message.messageData, Message::dataSize);
+        return data;
+    }
+};
+static_assert(sizeof(TrimMemory) == Message::dataSize, "TrimMemory is of correct size");
+
 struct BufferAllocation {
     uint32_t poolID;
     uint32_t bufferID;
-    uint8_t padding[16];
+    // 0 for the buffers the page is rendered into, the layer the buffer belongs to otherwise.
+    uint32_t layerID;
+    uint8_t padding[12];
 
     static const uint64_t code = 10;
     static void construct(Message& message, const BufferAllocation& data)
@@ -122,11 +250,63 @@ struct BufferAllocation {
 };
 static_assert(sizeof(BufferAllocation) == Message::dataSize, "BufferAllocation is of correct size");
 
-struct BufferCommit {
+// The web process freed the buffer of a slot, the UI process drops its reference as well.
+struct BufferDestruction {
     uint32_t poolID;
     uint32_t bufferID;
     uint8_t padding[16];
 
+    static const uint64_t code = 12;
+    static void construct(Message& message, const BufferDestruction& data)
+    {
+        message.messageCode = code;
+        std::memcpy(&message.messageData, &data, Message::dataSize);
+    }
+
+    static BufferDestruction from(const Message& message)
+    {
+        BufferDestruction data;
+        std::memcpy(&data, &message.messageData, Message::dataSize);
+        return data;
+    }
+};
+static_assert(sizeof(BufferDestruction) == Message::dataSize, "BufferDestruction is of correct size");
+
+// Sent by the UI process to hand a buffer which a previous pool of the same view and web
+// process left behind to an empty slot of a new one, followed by the AHardwareBuffer handle.
+// Carries the fence the buffer was last released with, if it had one.
+struct BufferAdoption {
+    uint32_t poolID;
+    uint32_t bufferID;
+    uint8_t padding[16];
+
+    static const uint64_t code = 11;
+    static void construct(Message& message, const BufferAdoption& data)
+    {
+        message.messageCode = code;
+        std::memcpy(&message.messageData, &data, Message::dataSize);
+    }
+
+    static BufferAdoption from(const Message& message)
+    {
+        BufferAdoption data;
+        std::memcpy(&data, &message.messageData, Message::dataSize);
+        return data;
+    }
+};
+static_assert(sizeof(BufferAdoption) == Message::dataSize, "BufferAdoption is of correct size");
+
+struct BufferCommit {
+    uint32_t poolID;
+    uint32_t bufferID;
+    // Size of the rendered content, which can be smaller than the buffer.
+    uint16_t width;
+    uint16_t height;
+    // Frames skipped since the previous commit because no buffer was available.
+    uint32_t skippedFrames;
+    // CLOCK_MONOTONIC time at which the frame was done rendering, in nanoseconds.
+    uint64_t renderedTime;
+
     static const uint64_t code = 15;
     static void construct(Message& message, const BufferCommit& data)
     {
@@ -143,11 +323,120 @@ struct BufferCommit {
 };
 static_assert(sizeof(BufferCommit) == Message::dataSize, "BufferCommit is of correct size");
 
-struct ReleaseBuffer {
+// Sent right before the BufferCommit of a frame which only changed part of the content,
+// as many times as needed. Rectangles are x, y, width, height in content coordinates with
+// a top-left origin, unused ones are empty. Commits without any are fully damaged.
+struct BufferDamage {
     uint32_t poolID;
     uint32_t bufferID;
+    uint16_t rects[2][4];
+
+    static const uint64_t code = 17;
+    static void construct(Message& message, const BufferDamage& data)
+    {
+        message.messageCode = code;
+        std::memcpy(&message.messageData, &data, Message::dataSize);
+    }
+
+    static BufferDamage from(const Message& message)
+    {
+        BufferDamage data;
+        std::memcpy(&data, &message.messageData, Message::dataSize);
+        return data;
+    }
+};
+static_assert(sizeof(BufferDamage) == Message::dataSize, "BufferDamage is of correct size");
+
+// Sent by the web process to show a buffer it did not render itself, such as a decoded video
+// frame, as a layer of the pool's view. The buffer was handed over once with a BufferAllocation
+// for the layer, the acquire fence travels as SCM_RIGHTS. Layers are created with their first
+// commit and take effect right away, independently of the page frames.
+struct LayerCommit {
+    uint32_t poolID;
+    uint32_t layerID;
+    uint16_t bufferID;
+    // Stacking relative to the page content at 0.
+    int16_t zOrder;
+    // In view coordinates.
+    int16_t x;
+    int16_t y;
+    uint16_t width;
+    uint16_t height;
+    uint8_t padding[4];
+
+    static const uint64_t code = 19;
+    static void construct(Message& message, const LayerCommit& data)
+    {
+        message.messageCode = code;
+        std::memcpy(&message.messageData, &data, Message::dataSize);
+    }
+
+    static LayerCommit from(const Message& message)
+    {
+        LayerCommit data;
+        std::memcpy(&data, &message.messageData, Message::dataSize);
+        return data;
+    }
+};
+static_assert(sizeof(LayerCommit) == Message::dataSize, "LayerCommit is of correct size");
+
+// Buffers of the layer still in use are given back with ReleaseBuffer as usual.
+struct LayerRemoval {
+    uint32_t poolID;
+    uint32_t layerID;
     uint8_t padding[16];
 
+    static const uint64_t code = 20;
+    static void construct(Message& message, const LayerRemoval& data)
+    {
+        message.messageCode = code;
+        std::memcpy(&message.messageData, &data, Message::dataSize);
+    }
+
+    static LayerRemoval from(const Message& message)
+    {
+        LayerRemoval data;
+        std::memcpy(&data, &message.messageData, Message::dataSize);
+        return data;
+    }
+};
+static_assert(sizeof(LayerRemoval) == Message::dataSize, "LayerRemoval is of correct size");
+
+// Sent whenever the web process had to wait for a buffer because all of them were locked,
+// once the wait is over.
+struct BufferWait {
+    uint32_t poolID;
+    // Non-zero when no buffer came back in time and the frame was skipped.
+    uint32_t timedOut;
+    // In nanoseconds.
+    uint64_t waitTime;
+    uint8_t padding[8];
+
+    static const uint64_t code = 18;
+    static void construct(Message& message, const BufferWait& data)
+    {
+        message.messageCode = code;
+        std::memcpy(&message.messageData, &data, Message::dataSize);
+    }
+
+    static BufferWait from(const Message& message)
+    {
+        BufferWait data;
+        std::memcpy(&data, &message.messageData, Message::dataSize);
+        return data;
+    }
+};
+static_assert(sizeof(BufferWait) == Message::dataSize, "BufferWait is of correct size");
+
+struct ReleaseBuffer {
+    uint32_t poolID;
+    uint32_t bufferID;
+    // CLOCK_MONOTONIC time at which the UI process released the buffer, in nanoseconds.
+    uint64_t releaseTime;
+    // See BufferAllocation.
+    uint32_t layerID;
+    uint8_t padding[4];
+
     static const uint64_t code = 16;
     static void construct(Message& message, const ReleaseBuffer& data)
     {
@@ -166,7 +455,10 @@ static_assert(sizeof(ReleaseBuffer) == Message::dataSize, "ReleaseBuffer is of c
 
 struct FrameComplete {
     uint32_t poolID;
-    uint8_t padding[20];
+    uint8_t padding0[4];
+    // CLOCK_MONOTONIC time at which the UI process completed the frame, in nanoseconds.
+    uint64_t completeTime;
+    uint8_t padding[8];
 
     static const uint64_t code = 23;
     static void construct(Message& message, const FrameComplete& data)
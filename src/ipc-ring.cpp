@@ -0,0 +1,230 @@
+#include "ipc-ring.h"
+
+#include <android/sharedmem.h>
+#include <cstring>
+#include <glib-unix.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "logging.h"
+
+namespace IPC {
+
+// The ring is shared between processes, which only works with address-free atomics.
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "std::atomic<uint32_t> is lock-free");
+
+struct MessageRing::Header {
+    uint32_t capacity;
+
+    // Free-running indices, head is only written by the producer and tail only by the
+    // consumer. They live on separate cache lines to keep both sides from contending.
+    alignas(64) std::atomic<uint32_t> head;
+    alignas(64) std::atomic<uint32_t> tail;
+
+    // Set by the producer when it rings the doorbell and cleared by the consumer right
+    // before it drains the ring, messages pushed in between don't need another wakeup.
+    std::atomic<uint32_t> doorbellPending;
+
+    // Set by the producer while messages wait for room, the consumer rings the space
+    // doorbell when it clears it.
+    std::atomic<uint32_t> spaceWanted;
+};
+
+MessageRing::MessageRing() = default;
+
+MessageRing::~MessageRing()
+{
+    if (m_source) {
+        g_source_destroy(m_source);
+        g_source_unref(m_source);
+    }
+
+    if (m_memory)
+        munmap(m_memory, m_memorySize);
+
+    if (m_memoryFd != -1)
+        close(m_memoryFd);
+    if (m_doorbellFd != -1)
+        close(m_doorbellFd);
+    if (m_spaceFd != -1)
+        close(m_spaceFd);
+}
+
+bool MessageRing::create(GMainContext* context, uint32_t capacity)
+{
+    // Indices wrap around at 2^32, which only stays consistent for a power-of-two capacity.
+    if (!capacity || (capacity & (capacity - 1)))
+        return false;
+
+    size_t size = sizeof(Header) + capacity * sizeof(Message);
+    m_memoryFd = ASharedMemory_create("WPEBackend-android::ring", size);
+    if (m_memoryFd < 0) {
+        ALOGE("MessageRing: failed to create shared memory: %s", strerror(errno));
+        m_memoryFd = -1;
+        return false;
+    }
+
+    m_doorbellFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    m_spaceFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_doorbellFd == -1 || m_spaceFd == -1) {
+        ALOGE("MessageRing: failed to create doorbell: %s", strerror(errno));
+        return false;
+    }
+
+    if (!map(size))
+        return false;
+
+    m_capacity = capacity;
+    m_header->capacity = capacity;
+    m_header->head.store(0);
+    m_header->tail.store(0);
+    m_header->doorbellPending.store(0);
+    m_header->spaceWanted.store(0);
+
+    m_source = g_unix_fd_source_new(m_spaceFd, G_IO_IN);
+    g_source_set_name(m_source, "WPEBackend-android::ring-space");
+    g_source_set_callback(m_source, reinterpret_cast<GSourceFunc>(spaceCallback), this, nullptr);
+    g_source_attach(m_source, context);
+    return true;
+}
+
+bool MessageRing::attach(Handler& handler, int memoryFd, int doorbellFd, int spaceFd)
+{
+    m_handler = &handler;
+    m_memoryFd = memoryFd;
+    m_doorbellFd = doorbellFd;
+    m_spaceFd = spaceFd;
+
+    if (m_memoryFd == -1 || m_doorbellFd == -1 || m_spaceFd == -1)
+        return false;
+
+    size_t size = ASharedMemory_getSize(m_memoryFd);
+    if (size < sizeof(Header) || !map(size))
+        return false;
+
+    // Read the capacity once, the header is writable by the other process.
+    uint32_t capacity = m_header->capacity;
+    if (!capacity || (capacity & (capacity - 1)) || sizeof(Header) + size_t(capacity) * sizeof(Message) > size) {
+        ALOGE("MessageRing: invalid capacity %u for %zu bytes", capacity, size);
+        return false;
+    }
+    m_capacity = capacity;
+
+    m_source = g_unix_fd_source_new(m_doorbellFd, G_IO_IN);
+    g_source_set_name(m_source, "WPEBackend-android::ring");
+    g_source_set_callback(m_source, reinterpret_cast<GSourceFunc>(doorbellCallback), this, nullptr);
+    g_source_attach(m_source, g_main_context_get_thread_default());
+    return true;
+}
+
+bool MessageRing::map(size_t size)
+{
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_memoryFd, 0);
+    if (memory == MAP_FAILED) {
+        ALOGE("MessageRing: failed to map shared memory: %s", strerror(errno));
+        return false;
+    }
+
+    m_memory = memory;
+    m_memorySize = size;
+    m_header = static_cast<Header*>(memory);
+    m_slots = reinterpret_cast<Message*>(static_cast<char*>(memory) + sizeof(Header));
+    return true;
+}
+
+void MessageRing::push(const Message& message)
+{
+    std::lock_guard<std::mutex> lock(m_producerLock);
+    if (m_waitingMessages.empty() && tryPush(message))
+        return;
+
+    m_waitingMessages.push_back(message);
+    pushWaitingMessages();
+}
+
+void MessageRing::pushWaitingMessages()
+{
+    while (!m_waitingMessages.empty() && tryPush(m_waitingMessages.front()))
+        m_waitingMessages.pop_front();
+    if (m_waitingMessages.empty())
+        return;
+
+    // The consumer may have made room right before seeing the flag, check once more.
+    m_header->spaceWanted.store(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (!m_waitingMessages.empty() && tryPush(m_waitingMessages.front()))
+        m_waitingMessages.pop_front();
+}
+
+bool MessageRing::tryPush(const Message& message)
+{
+    if (!m_header)
+        return false;
+
+    uint32_t head = m_header->head.load(std::memory_order_relaxed);
+    uint32_t tail = m_header->tail.load(std::memory_order_acquire);
+    if (head - tail >= m_capacity)
+        return false;
+
+    std::memcpy(&m_slots[head & (m_capacity - 1)], &message, sizeof(Message));
+    m_header->head.store(head + 1);
+
+    if (!m_header->doorbellPending.exchange(1)) {
+        uint64_t value = 1;
+        while (write(m_doorbellFd, &value, sizeof(value)) == -1 && errno == EINTR) { }
+    }
+    return true;
+}
+
+void MessageRing::drain()
+{
+    uint64_t value;
+    while (read(m_doorbellFd, &value, sizeof(value)) == -1 && errno == EINTR) { }
+
+    m_header->doorbellPending.store(0);
+
+    uint32_t tail = m_header->tail.load(std::memory_order_relaxed);
+    uint32_t head = m_header->head.load();
+    while (tail != head) {
+        Message message;
+        std::memcpy(&message, &m_slots[tail & (m_capacity - 1)], sizeof(Message));
+        m_header->tail.store(++tail, std::memory_order_release);
+
+        if (m_handler)
+            m_handler->handleMessage(Message::data(message), Message::size);
+
+        if (tail == head)
+            head = m_header->head.load();
+    }
+
+    if (m_header->spaceWanted.exchange(0)) {
+        uint64_t value = 1;
+        while (write(m_spaceFd, &value, sizeof(value)) == -1 && errno == EINTR) { }
+    }
+}
+
+gboolean MessageRing::doorbellCallback(gint, GIOCondition condition, gpointer data)
+{
+    if (!(condition & G_IO_IN))
+        return TRUE;
+
+    static_cast<MessageRing*>(data)->drain();
+    return TRUE;
+}
+
+gboolean MessageRing::spaceCallback(gint fd, GIOCondition condition, gpointer data)
+{
+    if (!(condition & G_IO_IN))
+        return TRUE;
+
+    uint64_t value;
+    while (read(fd, &value, sizeof(value)) == -1 && errno == EINTR) { }
+
+    auto& ring = *static_cast<MessageRing*>(data);
+    std::lock_guard<std::mutex> lock(ring.m_producerLock);
+    ring.pushWaitingMessages();
+    return TRUE;
+}
+
+} // namespace IPC
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <gio/gio.h>
+#include <mutex>
+
+#include "ipc.h"
+
+namespace IPC {
+
+// Single-producer single-consumer queue of messages living in memory shared between
+// the UI process and a web process. The producer only rings the doorbell (an eventfd)
+// when the consumer isn't already about to drain the ring, so a burst of messages costs
+// the consumer a single wakeup and no socket reads. Messages which don't fit wait on the
+// producer side, in order, until the consumer made room and rings a doorbell of its own.
+class MessageRing {
+public:
+    class Handler {
+    public:
+        virtual void handleMessage(char*, size_t) = 0;
+    };
+
+    static const uint32_t defaultCapacity = 64;
+
+    MessageRing();
+    ~MessageRing();
+
+    // Producer side, allocates the shared memory and the doorbells. Waiting messages go
+    // into the ring from the given main context.
+    bool create(GMainContext*, uint32_t capacity = defaultCapacity);
+
+    // Consumer side, takes ownership of the descriptors received from the producer and
+    // dispatches the queued messages to the handler from the thread default main context.
+    bool attach(Handler&, int memoryFd, int doorbellFd, int spaceFd);
+
+    int memoryFd() const { return m_memoryFd; }
+    int doorbellFd() const { return m_doorbellFd; }
+    int spaceFd() const { return m_spaceFd; }
+
+    // Producer side, can be called from any thread. A message which doesn't fit waits
+    // behind the ones already waiting, nothing overtakes it.
+    void push(const Message&);
+
+    // Consumer side, dispatches the queued messages right away instead of waiting for the
+    // main context to notice the doorbell.
+    void drain();
+
+private:
+    struct Header;
+
+    static gboolean doorbellCallback(gint, GIOCondition, gpointer);
+    static gboolean spaceCallback(gint, GIOCondition, gpointer);
+    bool map(size_t size);
+
+    bool tryPush(const Message&);
+    void pushWaitingMessages();
+
+    Handler* m_handler { nullptr };
+
+    int m_memoryFd { -1 };
+    int m_doorbellFd { -1 };
+    // Rung by the consumer once it made room for messages waiting on the producer side.
+    int m_spaceFd { -1 };
+
+    void* m_memory { nullptr };
+    size_t m_memorySize { 0 };
+    Header* m_header { nullptr };
+    Message* m_slots { nullptr };
+    uint32_t m_capacity { 0 };
+
+    // Watches the doorbell on the consumer side, the space doorbell on the producer side.
+    GSource* m_source { nullptr };
+
+    std::mutex m_producerLock;
+    std::deque<Message> m_waitingMessages;
+};
+
+} // namespace IPC
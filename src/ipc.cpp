@@ -26,23 +26,308 @@
 
 #include "ipc.h"
 
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "logging.h"
 
 namespace IPC {
 
+static uint64_t socketToken(int fd)
+{
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1)
+        return 0;
+    return uint64_t(st.st_ino);
+}
+
+// Upper bound of messages dispatched per wakeup, so that a busy peer can't starve the
+// other sources attached to the same main context.
+static const unsigned maxMessagesPerDispatch = 64;
+
+enum class ReceiveResult {
+    Message,
+    WouldBlock,
+    Closed,
+};
+
+static void closeReceivedFileDescriptors(MessageReceiveBuffer& buffer)
+{
+    for (size_t i = 0; i < buffer.fdCount; ++i) {
+        if (buffer.fds[i] != -1)
+            close(buffer.fds[i]);
+        buffer.fds[i] = -1;
+    }
+    buffer.fdCount = 0;
+}
+
+static void setReceivedFileDescriptors(MessageReceiveBuffer& buffer, struct msghdr& msg)
+{
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; ++i) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+            if (buffer.fdCount < MessageReceiveBuffer::maxFileDescriptors)
+                buffer.fds[buffer.fdCount++] = fd;
+            else
+                close(fd);
+        }
+    }
+}
+
+static ReceiveResult receiveMessage(int fd, MessageReceiveBuffer& buffer)
+{
+    // Never read past the end of the current message: BufferAllocation is followed by an
+    // AHardwareBuffer handle which the handler reads from the socket itself, see
+    // Host::Handler::readyForMessage().
+    while (buffer.size < Message::size) {
+        struct iovec io = { Message::data(buffer.message) + buffer.size, Message::size - buffer.size };
+        char control[CMSG_SPACE(sizeof(int) * MessageReceiveBuffer::maxFileDescriptors)];
+
+        struct msghdr msg = { 0 };
+        msg.msg_iov = &io;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t len = recvmsg(fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        if (len > 0) {
+            setReceivedFileDescriptors(buffer, msg);
+
+            // Datagrams are never split, anything but a whole message is a protocol error.
+            if (buffer.transport == Transport::SeqPacket && (len != Message::size || (msg.msg_flags & MSG_TRUNC))) {
+                g_warning("Dropping malformed message of %zd bytes from socket", len);
+                closeReceivedFileDescriptors(buffer);
+                continue;
+            }
+
+            buffer.size += len;
+            continue;
+        }
+
+        if (!len)
+            return ReceiveResult::Closed;
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return ReceiveResult::WouldBlock;
+
+        g_warning("Failed to read message from socket: %s", strerror(errno));
+        return ReceiveResult::Closed;
+    }
+
+    buffer.size = 0;
+    return ReceiveResult::Message;
+}
+
+static bool readyForMessage(Host::Handler* handler)
+{
+    return !handler || handler->readyForMessage();
+}
+
+static bool readyForMessage(Client::Handler*)
+{
+    return true;
+}
+
+template<typename Handler>
+static gboolean dispatchMessages(int fd, MessageReceiveBuffer& buffer, Handler*& handler)
+{
+    for (unsigned i = 0; i < maxMessagesPerDispatch; ++i) {
+        if (!readyForMessage(handler))
+            return TRUE;
+
+        switch (receiveMessage(fd, buffer)) {
+        case ReceiveResult::Closed:
+            return FALSE;
+        case ReceiveResult::WouldBlock:
+            return TRUE;
+        case ReceiveResult::Message:
+            break;
+        }
+
+        // The handler might receive further data from the socket, so it gets its own copy.
+        Message message = buffer.message;
+        if (handler)
+            handler->handleMessage(Message::data(message), Message::size);
+
+        closeReceivedFileDescriptors(buffer);
+    }
+    return TRUE;
+}
+
+static int takeReceivedFileDescriptor(MessageReceiveBuffer& buffer, size_t index)
+{
+    if (index >= buffer.fdCount)
+        return -1;
+
+    int fd = buffer.fds[index];
+    buffer.fds[index] = -1;
+    return fd;
+}
+
+// Writes as much as the socket takes without waiting, returns how much that was or -1 when
+// the socket failed. The descriptors travel with the first bytes written.
+static ssize_t sendAvailableData(int fd, const char* data, size_t size, const int* attachedFds, size_t attachedFdCount)
+{
+    char control[CMSG_SPACE(sizeof(int) * MessageReceiveBuffer::maxFileDescriptors)];
+    memset(control, 0, sizeof(control));
+    attachedFdCount = std::min(attachedFdCount, MessageReceiveBuffer::maxFileDescriptors);
+
+    size_t sent = 0;
+    while (sent < size) {
+        struct iovec io = { const_cast<char*>(data + sent), size - sent };
+
+        struct msghdr msg = { 0 };
+        msg.msg_iov = &io;
+        msg.msg_iovlen = 1;
+
+        if (attachedFdCount) {
+            msg.msg_control = control;
+            msg.msg_controllen = CMSG_SPACE(sizeof(int) * attachedFdCount);
+
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int) * attachedFdCount);
+            memcpy(CMSG_DATA(cmsg), attachedFds, sizeof(int) * attachedFdCount);
+        }
+
+        ssize_t len = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (len >= 0) {
+            sent += len;
+            attachedFdCount = 0;
+            continue;
+        }
+
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+
+        g_warning("Failed to write message to socket: %s", strerror(errno));
+        return -1;
+    }
+    return sent;
+}
+
+// Writes as many whole datagrams as the socket takes without waiting, returns how many that
+// were or -1 when the socket failed. The descriptors travel with the last message.
+static ssize_t sendAvailableDatagrams(int fd, const Message* messages, size_t count, const int* attachedFds, size_t attachedFdCount)
+{
+    char control[CMSG_SPACE(sizeof(int) * MessageReceiveBuffer::maxFileDescriptors)];
+    memset(control, 0, sizeof(control));
+    attachedFdCount = std::min(attachedFdCount, MessageReceiveBuffer::maxFileDescriptors);
+
+    // Each message has to be a datagram of its own, sendmmsg() still writes them in one go.
+    struct iovec io[maxMessagesPerDispatch];
+    struct mmsghdr msgs[maxMessagesPerDispatch];
+    size_t sent = 0;
+    while (sent < count) {
+        size_t batch = std::min<size_t>(count - sent, maxMessagesPerDispatch);
+        memset(msgs, 0, sizeof(msgs[0]) * batch);
+        for (size_t i = 0; i < batch; ++i) {
+            io[i].iov_base = const_cast<Message*>(&messages[sent + i]);
+            io[i].iov_len = Message::size;
+            msgs[i].msg_hdr.msg_iov = &io[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+
+            if (attachedFdCount && sent + i == count - 1) {
+                msgs[i].msg_hdr.msg_control = control;
+                msgs[i].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(int) * attachedFdCount);
+
+                struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type = SCM_RIGHTS;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(int) * attachedFdCount);
+                memcpy(CMSG_DATA(cmsg), attachedFds, sizeof(int) * attachedFdCount);
+            }
+        }
+
+        int len = sendmmsg(fd, msgs, batch, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (len > 0) {
+            sent += len;
+            continue;
+        }
+
+        if (len == -1 && errno == EINTR)
+            continue;
+        if (len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        g_warning("Failed to write messages to socket: %s", strerror(errno));
+        return -1;
+    }
+    return sent;
+}
+
+static void waitUntilWritable(int fd)
+{
+    struct pollfd pfd = { fd, POLLOUT, 0 };
+    while (poll(&pfd, 1, -1) == -1 && errno == EINTR) { }
+}
+
+static void sendData(int fd, const char* data, size_t size, const int* attachedFds = nullptr, size_t attachedFdCount = 0)
+{
+    while (true) {
+        ssize_t sent = sendAvailableData(fd, data, size, attachedFds, attachedFdCount);
+        if (sent < 0 || size_t(sent) == size)
+            return;
+
+        data += sent;
+        size -= sent;
+        if (sent)
+            attachedFdCount = 0;
+        waitUntilWritable(fd);
+    }
+}
+
+static void sendMessageData(int fd, Transport transport, const Message* messages, size_t count, const int* attachedFds, size_t attachedFdCount)
+{
+    if (transport == Transport::Stream) {
+        // Descriptors arrive along with the first byte of a write, the last message needs
+        // its own to keep them.
+        if (attachedFdCount && count > 1) {
+            sendData(fd, reinterpret_cast<const char*>(messages), (count - 1) * Message::size);
+            messages += count - 1;
+            count = 1;
+        }
+        sendData(fd, reinterpret_cast<const char*>(messages), count * Message::size, attachedFds, attachedFdCount);
+        return;
+    }
+
+    while (count) {
+        ssize_t sent = sendAvailableDatagrams(fd, messages, count, attachedFds, attachedFdCount);
+        if (sent < 0)
+            return;
+
+        messages += sent;
+        count -= sent;
+        if (count)
+            waitUntilWritable(fd);
+    }
+}
+
 Host::Host() = default;
 
-void Host::initialize(Handler& handler)
+void Host::initialize(Handler& handler, Transport transport, GMainContext* context)
 {
     m_handler = &handler;
+    m_receiveBuffer.transport = transport;
 
     int sockets[2];
-    int ret = socketpair(AF_UNIX, SOCK_STREAM, 0, sockets);
+    int ret = socketpair(AF_UNIX, transport == Transport::SeqPacket ? SOCK_SEQPACKET : SOCK_STREAM, 0, sockets);
     if (ret == -1)
         return;
 
@@ -53,9 +338,10 @@ void Host::initialize(Handler& handler)
         return;
     }
 
+    m_context = context ? context : g_main_context_get_thread_default();
     m_source = g_socket_create_source(m_socket, G_IO_IN, nullptr);
     g_source_set_callback(m_source, reinterpret_cast<GSourceFunc>(socketCallback), this, nullptr);
-    g_source_attach(m_source, g_main_context_get_thread_default());
+    g_source_attach(m_source, m_context);
 
     m_clientFd = sockets[1];
 }
@@ -65,6 +351,11 @@ void Host::deinitialize()
     if (m_clientFd != -1)
         close(m_clientFd);
 
+    {
+        std::lock_guard<std::mutex> lock(m_sendLock);
+        clearQueue();
+    }
+
     if (m_source)
         g_source_destroy(m_source);
     if (m_socket)
@@ -90,40 +381,174 @@ int Host::releaseClientFD(bool closeSourceFd)
     return fd;
 }
 
+uint64_t Host::clientToken()
+{
+    return socketToken(m_clientFd);
+}
+
 void Host::sendMessage(char* data, size_t size)
 {
-    g_socket_send(m_socket, data, size, nullptr, nullptr);
+    std::lock_guard<std::mutex> lock(m_sendLock);
+    sendOrQueue(data, size, nullptr, 0);
 }
 
-int Host::receiveFileDescriptor()
+// Sends several messages with a single write.
+void Host::sendMessages(const Message* messages, size_t count, const int* fds, size_t fdCount)
 {
-    struct msghdr msg = {0};
+    if (!count)
+        return;
 
-    char m_buffer[1];
-    struct iovec io = { .iov_base = m_buffer, .iov_len = sizeof(m_buffer) };
-    msg.msg_iov = &io;
-    msg.msg_iovlen = 1;
+    std::lock_guard<std::mutex> lock(m_sendLock);
+    if (m_receiveBuffer.transport == Transport::Stream) {
+        // Descriptors arrive along with the first byte of a write, see sendMessageData().
+        const char* data = reinterpret_cast<const char*>(messages);
+        if (fdCount && count > 1) {
+            sendOrQueue(data, (count - 1) * Message::size, nullptr, 0);
+            data += (count - 1) * Message::size;
+            count = 1;
+        }
+        sendOrQueue(data, count * Message::size, fds, fdCount);
+        return;
+    }
 
-    char c_buffer[256];
-    msg.msg_control = c_buffer;
-    msg.msg_controllen = sizeof(c_buffer);
+    if (!m_socket)
+        return;
 
-    int result;
-    do {
-        result = recvmsg(socketFd(), &msg, 0);
-    } while (result == -1 && errno == EINTR);
-    if (result == -1) {
-        result = errno;
-        ALOGV("Error reading ile descriptor from socket: error %#x (%s)",
-                result, strerror(result));
-        return -result;
+    size_t sent = 0;
+    if (m_sendQueue.empty()) {
+        ssize_t len = sendAvailableDatagrams(socketFd(), messages, count, fds, fdCount);
+        if (len < 0)
+            return;
+        sent = len;
+    }
+    for (size_t i = sent; i < count; ++i) {
+        bool last = i == count - 1;
+        queue(reinterpret_cast<const char*>(&messages[i]), Message::size, last ? fds : nullptr, last ? fdCount : 0, nullptr);
     }
+}
 
-    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
-    int fd;
-    memmove(&fd, CMSG_DATA(cmsg), sizeof(fd));
+void Host::sendMessageWithFileDescriptor(char* data, size_t size, int fd)
+{
+    std::lock_guard<std::mutex> lock(m_sendLock);
+    sendOrQueue(data, size, &fd, 1);
+}
 
-    return fd;
+void Host::sendMessageWithFileDescriptors(char* data, size_t size, const int* fds, size_t count)
+{
+    std::lock_guard<std::mutex> lock(m_sendLock);
+    sendOrQueue(data, size, fds, count);
+}
+
+void Host::sendHardwareBuffer(AHardwareBuffer* hardwareBuffer)
+{
+    std::lock_guard<std::mutex> lock(m_sendLock);
+    if (!m_socket)
+        return;
+
+    // The handle is written in a single sendmsg(), it never goes out partially.
+    if (m_sendQueue.empty()) {
+        int ret = AHardwareBuffer_sendHandleToUnixSocket(hardwareBuffer, socketFd());
+        if (ret != -EAGAIN) {
+            if (ret)
+                g_warning("Failed to write buffer handle to socket: %s", strerror(-ret));
+            return;
+        }
+    }
+    queue(nullptr, 0, nullptr, 0, hardwareBuffer);
+}
+
+void Host::sendOrQueue(const char* data, size_t size, const int* fds, size_t fdCount)
+{
+    if (!m_socket)
+        return;
+
+    if (m_sendQueue.empty()) {
+        ssize_t sent = sendAvailableData(socketFd(), data, size, fds, fdCount);
+        if (sent < 0 || size_t(sent) == size)
+            return;
+
+        data += sent;
+        size -= sent;
+        if (sent)
+            fdCount = 0;
+    }
+    queue(data, size, fds, fdCount, nullptr);
+}
+
+void Host::queue(const char* data, size_t size, const int* fds, size_t fdCount, AHardwareBuffer* hardwareBuffer)
+{
+    QueuedSend send { std::vector<char>(data, data + size), 0, { }, hardwareBuffer };
+    for (size_t i = 0; i < fdCount; ++i)
+        send.fds.push_back(fcntl(fds[i], F_DUPFD_CLOEXEC, 0));
+    if (hardwareBuffer)
+        AHardwareBuffer_acquire(hardwareBuffer);
+    m_sendQueue.push_back(std::move(send));
+
+    if (m_writableSource)
+        return;
+
+    m_writableSource = g_socket_create_source(m_socket, G_IO_OUT, nullptr);
+    g_source_set_name(m_writableSource, "WPEBackend-android::socket-writable");
+    g_source_set_callback(m_writableSource, reinterpret_cast<GSourceFunc>(writableCallback), this, nullptr);
+    g_source_attach(m_writableSource, m_context);
+}
+
+void Host::sendQueued()
+{
+    while (!m_sendQueue.empty()) {
+        auto& send = m_sendQueue.front();
+        if (send.hardwareBuffer) {
+            int ret = AHardwareBuffer_sendHandleToUnixSocket(send.hardwareBuffer, socketFd());
+            if (ret == -EAGAIN)
+                return;
+            if (ret)
+                g_warning("Failed to write buffer handle to socket: %s", strerror(-ret));
+        } else {
+            ssize_t sent = sendAvailableData(socketFd(), send.data.data() + send.offset, send.data.size() - send.offset,
+                send.fds.data(), send.fds.size());
+            if (sent > 0) {
+                send.offset += sent;
+                for (int fd : send.fds)
+                    close(fd);
+                send.fds.clear();
+            }
+            // Failed writes drop what is queued, the connection is going away.
+            if (sent >= 0 && send.offset < send.data.size())
+                return;
+        }
+
+        for (int fd : send.fds)
+            close(fd);
+        if (send.hardwareBuffer)
+            AHardwareBuffer_release(send.hardwareBuffer);
+        m_sendQueue.pop_front();
+    }
+
+    g_source_destroy(m_writableSource);
+    g_source_unref(m_writableSource);
+    m_writableSource = nullptr;
+}
+
+void Host::clearQueue()
+{
+    for (auto& send : m_sendQueue) {
+        for (int fd : send.fds)
+            close(fd);
+        if (send.hardwareBuffer)
+            AHardwareBuffer_release(send.hardwareBuffer);
+    }
+    m_sendQueue.clear();
+
+    if (m_writableSource) {
+        g_source_destroy(m_writableSource);
+        g_source_unref(m_writableSource);
+        m_writableSource = nullptr;
+    }
+}
+
+int Host::takeFileDescriptor(size_t index)
+{
+    return takeReceivedFileDescriptor(m_receiveBuffer, index);
 }
 
 gboolean Host::socketCallback(GSocket* socket, GIOCondition condition, gpointer data)
@@ -132,22 +557,20 @@ gboolean Host::socketCallback(GSocket* socket, GIOCondition condition, gpointer
         return TRUE;
 
     auto& host = *static_cast<Host*>(data);
+    if (dispatchMessages(g_socket_get_fd(socket), host.m_receiveBuffer, host.m_handler))
+        return TRUE;
 
-    char* buffer = g_new0(char, Message::size);
-    GInputVector vector = { buffer, Message::size };
-    gssize len = g_socket_receive_message(socket, nullptr, &vector, 1,
-        nullptr, nullptr, nullptr, nullptr, nullptr);
-
-    // If nothing is read, give up.
-    if (len == -1) {
-        g_free(buffer);
-        return FALSE;
-    }
-
-    if (len == Message::size)
-        host.m_handler->handleMessage(buffer, Message::size);
+    // The handler is allowed to destroy the host from here.
+    if (host.m_handler)
+        host.m_handler->connectionClosed();
+    return FALSE;
+}
 
-    g_free(buffer);
+gboolean Host::writableCallback(GSocket*, GIOCondition, gpointer data)
+{
+    auto& host = *static_cast<Host*>(data);
+    std::lock_guard<std::mutex> lock(host.m_sendLock);
+    host.sendQueued();
     return TRUE;
 }
 
@@ -157,6 +580,12 @@ void Client::initialize(Handler& handler, int fd)
 {
     m_handler = &handler;
 
+    // The host picked the transport, the socket type tells which one it is.
+    int type = SOCK_STREAM;
+    socklen_t typeLength = sizeof(type);
+    if (!getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &typeLength) && type == SOCK_SEQPACKET)
+        m_receiveBuffer.transport = Transport::SeqPacket;
+
     m_socket = g_socket_new_from_fd(fd, nullptr);
     if (!m_socket)
         return;
@@ -186,27 +615,18 @@ int Client::socketFd()
     return -1;
 }
 
+uint64_t Client::token()
+{
+    return socketToken(socketFd());
+}
+
 gboolean Client::socketCallback(GSocket* socket, GIOCondition condition, gpointer data)
 {
     if (!(condition & G_IO_IN))
         return TRUE;
 
-    GError* error = nullptr;
-    char* buffer = g_new0(char, Message::size);
-    gssize len = g_socket_receive(socket, buffer, Message::size, nullptr, &error);
-    if (len == -1) {
-        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CONNECTION_CLOSED))
-            g_warning("Failed to read message from socket: %s", error->message);
-        g_error_free(error);
-        return FALSE;
-    }
-
-    auto client = reinterpret_cast<Client*>(data);
-    if (len == Message::size && client->m_handler)
-        client->m_handler->handleMessage(buffer, Message::size);
-
-    g_free(buffer);
-    return TRUE;
+    auto& client = *static_cast<Client*>(data);
+    return dispatchMessages(g_socket_get_fd(socket), client.m_receiveBuffer, client.m_handler);
 }
 
 void Client::sendMessage(char* data, size_t size)
@@ -214,52 +634,31 @@ void Client::sendMessage(char* data, size_t size)
     g_socket_send(m_socket, data, size, nullptr, nullptr);
 }
 
-void Client::sendAndReceiveMessage(char* data, size_t size, std::function<void(char*, size_t)> handler)
+void Client::sendMessages(const Message* messages, size_t count, const int* fds, size_t fdCount)
 {
-    g_socket_send(m_socket, data, size, nullptr, nullptr);
-
-    char* buffer = g_new0(char, Message::size);
-    gssize len = g_socket_receive_with_blocking(m_socket, buffer, Message::size, TRUE, nullptr, nullptr);
-
-    if (len == Message::size)
-        handler(buffer, Message::size);
-
-    g_free(buffer);
+    sendMessageData(socketFd(), m_receiveBuffer.transport, messages, count, fds, fdCount);
 }
 
-int Client::sendFileDescriptor(int fd)
+void Client::sendMessageWithFileDescriptor(char* data, size_t size, int fd)
 {
-    struct msghdr msg = { 0 };
-    char buf[CMSG_SPACE(sizeof(fd))];
-    memset(buf, '\0', sizeof(buf));
-
-    struct iovec io = { .iov_base = (char*)"", .iov_len = 1 };
-
-    msg.msg_iov = &io;
-    msg.msg_iovlen = 1;
-    msg.msg_control = buf;
-    msg.msg_controllen = sizeof(buf);
-
-    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
-    cmsg->cmsg_level = SOL_SOCKET;
-    cmsg->cmsg_type = SCM_RIGHTS;
-    cmsg->cmsg_len = CMSG_LEN(sizeof(fd));
+    sendData(socketFd(), data, size, &fd, 1);
+}
 
-    memmove(CMSG_DATA(cmsg), &fd, sizeof(fd));
+void Client::sendMessageWithFileDescriptors(char* data, size_t size, const int* fds, size_t count)
+{
+    sendData(socketFd(), data, size, fds, count);
+}
 
-    msg.msg_controllen = CMSG_SPACE(sizeof(fd));
+bool Client::dispatchPendingMessages()
+{
+    if (!m_socket)
+        return false;
+    return dispatchMessages(socketFd(), m_receiveBuffer, m_handler);
+}
 
-    int result;
-    do {
-        result = sendmsg(socketFd(), &msg, 0);
-    } while (result == -1 && errno == EINTR);
-    if (result == -1) {
-        result = errno;
-        ALOGV("Error writing file descriptor to socket: error %#x (%s)",
-                result, strerror(result));
-        return -result;
-    }
-    return NO_ERROR;
+int Client::takeFileDescriptor(size_t index)
+{
+    return takeReceivedFileDescriptor(m_receiveBuffer, index);
 }
 
 } // namespace IPC
@@ -26,11 +26,15 @@
 
 #pragma once
 
+#include <android/hardware_buffer.h>
+#include <deque>
 #include <functional>
 #include <gio/gio.h>
 #include <memory>
+#include <mutex>
 #include <stdint.h>
 #include <unistd.h>
+#include <vector>
 
 #define NO_ERROR 0L
 
@@ -48,32 +52,100 @@ struct Message {
 };
 static_assert(sizeof(Message) == Message::size, "Message is of correct size");
 
+enum class Transport {
+    // Messages can be split or coalesced by the socket and are reassembled on receipt.
+    Stream,
+    // Every message is its own datagram and arrives atomically.
+    SeqPacket,
+};
+
+// Holds the message currently being read off a socket, so that messages split across
+// several reads are reassembled without allocating for each of them.
+struct MessageReceiveBuffer {
+    Transport transport { Transport::Stream };
+
+    Message message;
+    size_t size { 0 };
+
+    // File descriptors received as SCM_RIGHTS along with the message.
+    static const size_t maxFileDescriptors = 4;
+    int fds[maxFileDescriptors] { -1, -1, -1, -1 };
+    size_t fdCount { 0 };
+};
+
 class Host {
 public:
     class Handler {
     public:
         virtual void handleMessage(char*, size_t) = 0;
+
+        // The other end of the socket went away, no further messages will be dispatched.
+        virtual void connectionClosed() { }
+
+        // Asked before reading each message. Handlers which read further data off the socket
+        // themselves return false while it hasn't arrived yet, dispatching then resumes once
+        // the socket is readable again.
+        virtual bool readyForMessage() { return true; }
     };
 
     Host();
 
-    void initialize(Handler&);
+    // Messages are dispatched from the given main context, the thread default one if null.
+    void initialize(Handler&, Transport = Transport::Stream, GMainContext* = nullptr);
     void deinitialize();
 
     int socketFd();
     int releaseClientFD(bool closeSourceFd = false);
 
+    // Identifies the client end of the socket pair across processes, see Client::token().
+    uint64_t clientToken();
+
+    // Sending never blocks and can happen from any thread. Whatever the socket doesn't take
+    // right away is queued, in order, and written from the main context messages are
+    // dispatched from once the socket is writable again. Descriptors stay with the caller.
     void sendMessage(char*, size_t);
-    int receiveFileDescriptor();
+    // The descriptors travel with the last message.
+    void sendMessages(const Message*, size_t count, const int* fds = nullptr, size_t fdCount = 0);
+    void sendMessageWithFileDescriptor(char*, size_t, int fd);
+    void sendMessageWithFileDescriptors(char*, size_t, const int* fds, size_t count);
+    // Follows whatever was sent before, see AHardwareBuffer_sendHandleToUnixSocket(). The buffer
+    // is referenced for as long as it is queued.
+    void sendHardwareBuffer(AHardwareBuffer*);
+
+    // Ownership of a file descriptor sent along with the message being handled,
+    // -1 if there is none. Descriptors nobody takes are closed after dispatch.
+    int takeFileDescriptor(size_t index = 0);
 
 private:
     static gboolean socketCallback(GSocket*, GIOCondition, gpointer);
+    static gboolean writableCallback(GSocket*, GIOCondition, gpointer);
+
+    // A single datagram with seqpacket sockets, m_sendLock has to be held.
+    void sendOrQueue(const char*, size_t, const int* fds, size_t fdCount);
+    void queue(const char*, size_t, const int* fds, size_t fdCount, AHardwareBuffer*);
+    void sendQueued();
+    void clearQueue();
 
     Handler* m_handler;
 
     GSocket* m_socket;
     GSource* m_source;
+    GMainContext* m_context { nullptr };
     int m_clientFd { -1 };
+
+    MessageReceiveBuffer m_receiveBuffer;
+
+    struct QueuedSend {
+        std::vector<char> data;
+        size_t offset;
+        // Duplicates, closed once they were sent along with the first bytes of the data.
+        std::vector<int> fds;
+        // Sent instead of data when set.
+        AHardwareBuffer* hardwareBuffer;
+    };
+    std::mutex m_sendLock;
+    std::deque<QueuedSend> m_sendQueue;
+    GSource* m_writableSource { nullptr };
 };
 
 class Client {
@@ -90,9 +162,22 @@ public:
 
     int socketFd();
 
+    // The inode of the socket, which is shared by every process holding a descriptor
+    // for it and thus lets the host side recognize which of its sockets this is.
+    uint64_t token();
+
+    // Sending waits for the socket to take everything.
     void sendMessage(char*, size_t);
-    void sendAndReceiveMessage(char*, size_t, std::function<void(char*, size_t)> handler);
-    int sendFileDescriptor(int fd);
+    // Several messages written at once, the descriptors travel with the last one.
+    void sendMessages(const Message*, size_t count, const int* fds = nullptr, size_t fdCount = 0);
+    void sendMessageWithFileDescriptor(char*, size_t, int fd);
+    void sendMessageWithFileDescriptors(char*, size_t, const int* fds, size_t count);
+
+    // Dispatches whatever has arrived on the socket without waiting for the main context,
+    // returns false once the other end went away.
+    bool dispatchPendingMessages();
+
+    int takeFileDescriptor(size_t index = 0);
 
 private:
     static gboolean socketCallback(GSocket*, GIOCondition, gpointer);
@@ -101,6 +186,8 @@ private:
 
     GSocket* m_socket;
     GSource* m_source;
+
+    MessageReceiveBuffer m_receiveBuffer;
 };
 
 } // namespace IPC
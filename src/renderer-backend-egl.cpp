@@ -1,56 +1,113 @@
 #include "interfaces.h"
 
+#include <algorithm>
 #include <array>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 #include <android/hardware_buffer.h>
+#include <android/native_window.h>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <cstring>
+#include <deque>
+#include <dlfcn.h>
 #include <errno.h>
-#include <unordered_map>
-
+#include <media/NdkImageReader.h>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <unistd.h>
+#include <vector>
+#include <wpe-android/renderer-backend-egl.h>
 
 #include "ipc.h"
 #include "ipc-messages.h"
+#include "ipc-ring.h"
 #include "logging.h"
+#include "slot-table.h"
+#include "tracing.h"
+
+#ifndef EGL_PROTECTED_CONTENT_EXT
+#define EGL_PROTECTED_CONTENT_EXT 0x32C0
+#endif
 
 struct Buffer {
     uint32_t bufferID { 0 };
     bool locked { false };
     AHardwareBuffer* object { nullptr };
 
+    // Allocated size, which can exceed the rendered size when resize buckets are in use.
+    uint32_t width { 0 };
+    uint32_t height { 0 };
+
+    // Signalled once the UI process side is done reading the buffer, rendering waits for it.
+    int releaseFenceFD { -1 };
+
+    // EGLTarget frame count the buffer was last rendered for, 0 while its contents are undefined.
+    uint64_t renderedFrame { 0 };
+
+    // AHardwareBuffer_getId(), 0 when not available.
+    uint64_t hardwareBufferID { 0 };
+
     struct {
+        EGLDisplay display { EGL_NO_DISPLAY };
         EGLImageKHR image { EGL_NO_IMAGE_KHR };
     } egl;
 
     struct {
         GLuint colorBuffer { 0 };
-        GLuint dsBuffer { 0 };
+        // Complete framebuffer of the slot, with the shared depth/stencil attached.
+        GLuint framebuffer { 0 };
     } gl;
 };
 
 class EGLTarget;
 
-class RendererBackend final : public IPC::Client::Handler {
+class RendererBackend final : public IPC::Client::Handler, public IPC::MessageRing::Handler {
 public:
     RendererBackend(int fd);
     ~RendererBackend();
 
     IPC::Client& ipc() { return m_ipcClient; }
 
+    // Held while messages are dispatched, and guards the targets and the pool IDs, which
+    // targets touch from their own thread.
+    std::recursive_mutex& lock() { return m_lock; }
+
     void registerEGLTarget(uint32_t poolId, EGLTarget*);
-    void unregisterEGLTarget(uint32_t poolId);
+    // Only clears the entry if it still is the given target, rather than one constructed
+    // under a later generation of the same slot.
+    void unregisterEGLTarget(uint32_t poolId, EGLTarget*);
+
+    // Has the target construct its pool under an ID reserved by the UI process, right away
+    // or once the next PoolIDReservation arrives.
+    void requestPoolID(EGLTarget&);
+    void cancelPoolIDRequest(EGLTarget&);
+
+    // Whether messages are dispatched on the calling thread, which then can't wait for them.
+    bool dispatchesOnCurrentThread() const { return g_main_context_is_owner(m_context); }
 
 private:
 
-    // IPC::Client::Handle
+    // IPC::Client::Handle, IPC::MessageRing::Handler
     void handleMessage(char*, size_t) override;
 
+    // Where the socket and the message ring are read, the only place messages are dispatched from.
+    GMainContext* m_context;
+
+    std::recursive_mutex m_lock;
+
     IPC::Client m_ipcClient;
+    std::unique_ptr<IPC::MessageRing> m_messageRing;
 
-    // (poolId -> EGLTarget)
-    std::unordered_map<uint32_t, EGLTarget*> m_targetMap;
+    // (poolId -> EGLTarget), indexed by the slot bits of the IDs the UI process hands out.
+    IPC::SlotTable<EGLTarget> m_targets;
+
+    std::deque<uint32_t> m_reservedPoolIDs;
+    std::deque<EGLTarget*> m_poolIDRequests;
 };
 
 class EGLTarget : public IPC::Client::Handler {
@@ -59,6 +116,8 @@ public:
     virtual ~EGLTarget();
 
     void initialize(RendererBackend* backend, uint32_t width, uint32_t height);
+    void constructPool(uint32_t poolID);
+    void poolConstructed(const IPC::PoolConstructionReply&);
     void resize(uint32_t width, uint32_t height);
 
     void frameWillRender();
@@ -66,7 +125,50 @@ public:
 
     void deinitialize();
 
-    void releaseBuffer(uint32_t, uint32_t);
+    void releaseBuffer(uint32_t, uint32_t, int releaseFenceFD);
+    void adoptBuffer(uint32_t, uint32_t, AHardwareBuffer*, int releaseFenceFD);
+
+    void addDamage(int32_t x, int32_t y, int32_t width, int32_t height);
+    uint32_t bufferAge() const;
+    // Fills in the BufferDamage messages of the frame, returns how many there are.
+    size_t damageMessages(IPC::Message*);
+
+    bool supportsLayers() const { return buffers.layers; }
+    bool isProtected() const { return !!(buffers.usage & AHARDWAREBUFFER_USAGE_PROTECTED_CONTENT); }
+    bool commitLayer(uint32_t layerID, AHardwareBuffer*, int fenceFD, int32_t x, int32_t y, uint32_t width, uint32_t height, int32_t zOrder);
+    void removeLayer(uint32_t layerID);
+    void releaseLayerBuffer(uint32_t poolID, uint32_t layerID, uint32_t bufferID, int releaseFenceFD);
+    void setReleaseLayerBufferHandler(void* context, WPEAndroidRendererBackendEGLTarget_ReleaseLayerBuffer);
+
+    bool bufferFitsRenderer(const Buffer&) const;
+    bool allocateBuffer(Buffer&);
+    // Allocates unprotected buffers from then on and tells the UI process about it.
+    void dropProtectedContent();
+    void importBuffer(Buffer&);
+    // Gives the shared depth/stencil storage of the given size, reattached to the framebuffers
+    // of all slots whenever it is reallocated.
+    void ensureDepthStencil(uint32_t width, uint32_t height);
+    void attachDepthStencil(const Buffer&);
+
+    // Readies one more slot after every frame, off the path of the next one, until the whole
+    // pool is allocated at the current size and imported into EGL.
+    void prepareSpareBuffer();
+    void waitForReleaseFence(Buffer&);
+
+    // Frees unused buffers down to the given count. Buffers and EGL images go right away,
+    // their GL objects on the render thread, where the context of the target can be made
+    // current even if the view is hidden and doesn't render anymore. Spare buffers aren't
+    // prepared ahead anymore until the next resize.
+    void trimMemory(uint32_t keepBufferCount);
+    // Deletes the GL objects of the buffers trimmed, with the context of the target current.
+    void deleteTrimmedGLObjects();
+    static gboolean trimmedGLObjectsCallback(gpointer);
+
+    // Picks an unlocked buffer for the frame, preferring one already allocated at the right size.
+    Buffer* findAvailableBuffer();
+    // Waits for the UI process to release a buffer within the timeout of the pool, releases
+    // are dispatched on the thread of the RendererBackend and signal m_bufferReleased.
+    Buffer* waitForAvailableBuffer(std::unique_lock<std::mutex>&);
 
     // IPC::Client::Handle
     void handleMessage(char*, size_t) override;
@@ -77,6 +179,11 @@ public:
 
     IPC::Client ipcClient;
 
+    // Releases and the pool construction reply arrive on the thread of the RendererBackend
+    // while the target renders on its own, taken after the lock of the RendererBackend.
+    std::mutex m_lock;
+    std::condition_variable m_bufferReleased;
+
     struct {
         bool initialized { false };
         uint32_t width { 0 };
@@ -89,91 +196,477 @@ public:
         PFNEGLCREATESYNCKHRPROC createSyncKHR;
         PFNEGLDESTROYSYNCKHRPROC destroySyncKHR;
         PFNEGLDUPNATIVEFENCEFDANDROIDPROC dupNativeFenceFDANDROID;
-
-        GLuint framebuffer { 0 };
+        PFNEGLWAITSYNCKHRPROC waitSyncKHR;
+        PFNGLDISCARDFRAMEBUFFEREXTPROC discardFramebufferEXT { nullptr };
+
+        // EGL_EXT_protected_content, needed to import protected buffers.
+        bool protectedContent { false };
+        // The current context was created with EGL_PROTECTED_CONTENT_EXT, which rendering into
+        // protected buffers takes.
+        bool protectedContext { false };
+
+        // Current during the last frame, which the GL objects of the buffers belong to.
+        EGLDisplay display { EGL_NO_DISPLAY };
+        EGLContext context { EGL_NO_CONTEXT };
+        // Attached to the thread default context of the render thread.
+        GSource* trimSource { nullptr };
+
+        // Only one buffer is rendered at a time and depth/stencil never leaves the web process,
+        // so all of them share one attachment, sized like the buffer currently rendered.
+        struct {
+            GLuint renderbuffer { 0 };
+            uint32_t width { 0 };
+            uint32_t height { 0 };
+        } depthStencil;
     } renderer;
 
     struct {
         Buffer* current { nullptr };
 
         uint32_t poolID { 0 };
-        std::array<Buffer, 4> pool;
+        std::vector<Buffer> pool;
+
+        // Allocation sizes are rounded up to this granularity so that small resizes keep
+        // using the existing buffers, 0 means buffers are allocated at the exact size.
+        uint32_t resizeBucket { 0 };
+
+        // Requested by the UI process on top of what rendering and composition need.
+        uint64_t usage { 0 };
+        uint32_t format { AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM };
+        bool depthStencil { true };
+        // The view takes layers, see commitLayer().
+        bool layers { false };
+
+        // Set by trimMemory(), buffers are then only allocated as frames need them.
+        bool trimmed { false };
+        // Of buffers trimmed while the context wasn't current.
+        std::vector<GLuint> trimmedFramebuffers;
+        std::vector<GLuint> trimmedRenderbuffers;
+
+        // Milliseconds frameWillRender() may wait for a release when every buffer is locked.
+        uint32_t releaseWaitTimeout { 0 };
+
+        // Set when a frame was skipped because every buffer was locked, WPE then
+        // gets its frame-complete once the UI process gives a buffer back.
+        bool frameCompletePending { false };
+
+        // Frames skipped since the last commit, reported along with the next one.
+        uint32_t skippedFrames { 0 };
+
+        // Frames committed so far.
+        uint64_t frameCount { 0 };
+        uint32_t committedWidth { 0 };
+        uint32_t committedHeight { 0 };
     } buffers;
+
+    // Reported by the renderer since the last commit, nothing means the whole frame changed.
+    struct {
+        struct Rect {
+            uint32_t x, y, width, height;
+        };
+        std::array<Rect, IPC::maxDamageRects> rects;
+        uint32_t count { 0 };
+
+        // Set once the next commit can't be a partial update anymore.
+        bool full { false };
+    } damage;
+
+    // Buffers of other producers, handed to the UI process once each and referenced from
+    // then on by their slot. Removed layers linger until all their buffers are released.
+    struct Layer {
+        struct Buffer {
+            AHardwareBuffer* object { nullptr };
+            bool locked { false };
+        };
+
+        uint32_t id { 0 };
+        bool removed { false };
+        std::array<Buffer, IPC::maxLayerBufferCount> buffers;
+
+        bool locked() const
+        {
+            return std::any_of(buffers.begin(), buffers.end(), [](const Buffer& buffer) { return buffer.locked; });
+        }
+    };
+    std::vector<Layer> layers;
+
+    struct {
+        void* context { nullptr };
+        WPEAndroidRendererBackendEGLTarget_ReleaseLayerBuffer func { nullptr };
+    } releaseLayerBufferHandler;
 };
 
-static void destroyBufferPool(std::array<Buffer, 4>& pool, PFNEGLDESTROYIMAGEKHRPROC destroyImageKHR)
+// Window surface for contexts which render offscreen, such as WebGL canvases and headless
+// pages. Those draw into framebuffer objects, the surface is only there to be made current,
+// so it is a tiny AHardwareBuffer queue whose images are dropped as soon as they arrive.
+class EGLOffscreenTarget {
+public:
+    ~EGLOffscreenTarget()
+    {
+        if (m_imageReader)
+            AImageReader_delete(m_imageReader);
+    }
+
+    void initialize()
+    {
+        if (m_imageReader)
+            return;
+
+        media_status_t status = AImageReader_newWithUsage(1, 1, AIMAGE_FORMAT_RGBA_8888,
+            AHARDWAREBUFFER_USAGE_GPU_FRAMEBUFFER, 2, &m_imageReader);
+        if (status != AMEDIA_OK || !m_imageReader) {
+            ALOGE("EGLOffscreenTarget: failed to create image reader: status %d", status);
+            m_imageReader = nullptr;
+            return;
+        }
+
+        AImageReader_ImageListener listener { nullptr, [] (void*, AImageReader* reader) {
+            AImage* image = nullptr;
+            if (AImageReader_acquireLatestImage(reader, &image) == AMEDIA_OK && image)
+                AImage_delete(image);
+        } };
+        AImageReader_setImageListener(m_imageReader, &listener);
+    }
+
+    EGLNativeWindowType nativeWindow()
+    {
+        // WebKit may ask before libwpe initialized the target.
+        initialize();
+
+        ANativeWindow* window = nullptr;
+        if (m_imageReader)
+            AImageReader_getWindow(m_imageReader, &window);
+        return reinterpret_cast<EGLNativeWindowType>(window);
+    }
+
+private:
+    AImageReader* m_imageReader { nullptr };
+};
+
+// The public entry points only get the libwpe target, guarded since each web page may
+// render on a thread of its own.
+static std::mutex s_eglTargetsLock;
+static std::vector<EGLTarget*> s_eglTargets;
+
+static EGLTarget* findEGLTarget(struct wpe_renderer_backend_egl_target* target)
 {
-    for (auto& buffer : pool) {
-        if (buffer.gl.colorBuffer)
-            glDeleteRenderbuffers(1, &buffer.gl.colorBuffer);
-        if (buffer.gl.dsBuffer)
-            glDeleteRenderbuffers(1, &buffer.gl.dsBuffer);
-        buffer.gl = { };
+    std::lock_guard<std::mutex> lock(s_eglTargetsLock);
+    auto it = std::find_if(s_eglTargets.begin(), s_eglTargets.end(),
+        [target] (EGLTarget* eglTarget) { return eglTarget->target == target; });
+    return it != s_eglTargets.end() ? *it : nullptr;
+}
 
-        if (buffer.egl.image)
-            destroyImageKHR(eglGetCurrentDisplay(), buffer.egl.image);
-        buffer.egl = { };
+// EGLImages of the buffers targets let go of, keyed by AHardwareBuffer ID. The UI process
+// hands the same buffers to the next target of a view through BufferAdoption, which then
+// skips importing them again. An image keeps the buffer memory alive, so entries expire.
+struct CachedImage {
+    EGLDisplay display;
+    uint64_t hardwareBufferID;
+    EGLImageKHR image;
+    uint64_t cachedTime;
+};
 
-        if (buffer.object)
-            AHardwareBuffer_release(buffer.object);
+static std::mutex s_imageCacheLock;
+static std::vector<CachedImage> s_imageCache;
+static PFNEGLDESTROYIMAGEKHRPROC s_imageCacheDestroyImageKHR { nullptr };
 
-        buffer.locked = false;
-        buffer.object = nullptr;
+static const size_t maxCachedImages = IPC::maxPoolBufferCount;
+// Five seconds, in nanoseconds.
+static const uint64_t cachedImageLifetime = 5000000000ull;
+
+static uint64_t hardwareBufferID(const AHardwareBuffer* object)
+{
+    // AHardwareBuffer_getId() needs API level 31.
+    using GetId = int (*)(const AHardwareBuffer*, uint64_t*);
+    static GetId getId = reinterpret_cast<GetId>(dlsym(RTLD_DEFAULT, "AHardwareBuffer_getId"));
+
+    uint64_t id = 0;
+    if (!getId || getId(object, &id))
+        return 0;
+    return id;
+}
+
+static void expireCachedImages(uint64_t now)
+{
+    auto it = std::remove_if(s_imageCache.begin(), s_imageCache.end(), [now] (const CachedImage& cachedImage) {
+        if (now - cachedImage.cachedTime < cachedImageLifetime)
+            return false;
+        s_imageCacheDestroyImageKHR(cachedImage.display, cachedImage.image);
+        return true;
+    });
+    s_imageCache.erase(it, s_imageCache.end());
+}
+
+static void cacheImageForAdoption(EGLDisplay display, uint64_t hardwareBufferID, EGLImageKHR image, PFNEGLDESTROYIMAGEKHRPROC destroyImageKHR)
+{
+    if (!hardwareBufferID) {
+        destroyImageKHR(display, image);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(s_imageCacheLock);
+    s_imageCacheDestroyImageKHR = destroyImageKHR;
+
+    uint64_t now = WPEAndroid::monotonicTime();
+    expireCachedImages(now);
+    if (s_imageCache.size() >= maxCachedImages) {
+        destroyImageKHR(s_imageCache.front().display, s_imageCache.front().image);
+        s_imageCache.erase(s_imageCache.begin());
+    }
+    s_imageCache.push_back({ display, hardwareBufferID, image, now });
+}
+
+static void flushCachedImages()
+{
+    std::lock_guard<std::mutex> lock(s_imageCacheLock);
+    for (auto& cachedImage : s_imageCache)
+        s_imageCacheDestroyImageKHR(cachedImage.display, cachedImage.image);
+    s_imageCache.clear();
+}
+
+static EGLImageKHR takeCachedImage(EGLDisplay display, uint64_t hardwareBufferID)
+{
+    if (!hardwareBufferID)
+        return EGL_NO_IMAGE_KHR;
+
+    std::lock_guard<std::mutex> lock(s_imageCacheLock);
+    if (s_imageCache.empty())
+        return EGL_NO_IMAGE_KHR;
+
+    expireCachedImages(WPEAndroid::monotonicTime());
+    for (auto it = s_imageCache.begin(); it != s_imageCache.end(); ++it) {
+        if (it->display == display && it->hardwareBufferID == hardwareBufferID) {
+            EGLImageKHR image = it->image;
+            s_imageCache.erase(it);
+            return image;
+        }
+    }
+    return EGL_NO_IMAGE_KHR;
+}
+
+// Images of buffers which are thrown away for not fitting anymore are of no further use,
+// those of a pool going away may come back with the next target of the view.
+static void destroyBuffer(Buffer& buffer, PFNEGLDESTROYIMAGEKHRPROC destroyImageKHR, bool cacheImage = false)
+{
+    if (buffer.gl.framebuffer)
+        glDeleteFramebuffers(1, &buffer.gl.framebuffer);
+    if (buffer.gl.colorBuffer)
+        glDeleteRenderbuffers(1, &buffer.gl.colorBuffer);
+    buffer.gl = { };
+
+    if (buffer.egl.image) {
+        if (cacheImage)
+            cacheImageForAdoption(buffer.egl.display, buffer.hardwareBufferID, buffer.egl.image, destroyImageKHR);
+        else
+            destroyImageKHR(buffer.egl.display, buffer.egl.image);
     }
+    buffer.egl = { };
+    buffer.hardwareBufferID = 0;
+
+    if (buffer.object)
+        AHardwareBuffer_release(buffer.object);
+
+    if (buffer.releaseFenceFD != -1)
+        close(buffer.releaseFenceFD);
+    buffer.releaseFenceFD = -1;
+
+    buffer.locked = false;
+    buffer.object = nullptr;
+    buffer.width = buffer.height = 0;
+    buffer.renderedFrame = 0;
+}
+
+static void destroyBufferPool(std::vector<Buffer>& pool, PFNEGLDESTROYIMAGEKHRPROC destroyImageKHR)
+{
+    for (auto& buffer : pool)
+        destroyBuffer(buffer, destroyImageKHR, true);
+}
+
+static GSourceFuncs trimSourceFuncs = {
+    nullptr, // prepare
+    nullptr, // check
+    // dispatch
+    [] (GSource* source, GSourceFunc callback, gpointer data) -> gboolean
+    {
+        g_source_set_ready_time(source, -1);
+        return callback(data);
+    },
+    nullptr, // finalize
+    nullptr, // closure_callback
+    nullptr, // closure_marshall
+};
+
+static uint32_t bucketSize(uint32_t size, uint32_t bucket)
+{
+    if (!bucket)
+        return size;
+    return ((size + bucket - 1) / bucket) * bucket;
 }
 
-RendererBackend::RendererBackend(int fd) {
+RendererBackend::RendererBackend(int fd)
+    : m_context(g_main_context_ref_thread_default())
+{
     m_ipcClient.initialize(*this, fd);
 }
 
 RendererBackend::~RendererBackend() {
     m_ipcClient.deinitialize();
+    g_main_context_unref(m_context);
 }
 
 void RendererBackend::registerEGLTarget(uint32_t poolId, EGLTarget* target) {
-    m_targetMap.insert({poolId, target});
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+    m_targets.set(poolId, target);
+}
+
+void RendererBackend::unregisterEGLTarget(uint32_t poolId, EGLTarget* target) {
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+    if (m_targets.get(poolId) == target)
+        m_targets.set(poolId, nullptr);
 }
 
-void RendererBackend::unregisterEGLTarget(uint32_t poolId) {
-    auto it = m_targetMap.find(poolId);
-    if (it != m_targetMap.end()) {
-        m_targetMap.erase(it);
+void RendererBackend::requestPoolID(EGLTarget& target) {
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+    if (m_reservedPoolIDs.empty()) {
+        m_poolIDRequests.push_back(&target);
+        return;
     }
+
+    uint32_t poolID = m_reservedPoolIDs.front();
+    m_reservedPoolIDs.pop_front();
+    target.constructPool(poolID);
+}
+
+void RendererBackend::cancelPoolIDRequest(EGLTarget& target) {
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+    m_poolIDRequests.erase(std::remove(m_poolIDRequests.begin(), m_poolIDRequests.end(), &target), m_poolIDRequests.end());
 }
 
 void RendererBackend::handleMessage(char* data, size_t size) {
     if (size != IPC::Message::size)
         return;
 
+    // Targets going away on their thread wait for the message to be handled.
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+
     auto& message = IPC::Message::cast(data);
     switch (message.messageCode) {
+    case IPC::MessageRingSetup::code:
+    {
+        ALOGV("RendererBackend::handleMessage(): MessageRingSetup");
+        int memoryFd = m_ipcClient.takeFileDescriptor(0);
+        int doorbellFd = m_ipcClient.takeFileDescriptor(1);
+        int spaceFd = m_ipcClient.takeFileDescriptor(2);
+
+        m_messageRing.reset(new IPC::MessageRing);
+        if (!m_messageRing->attach(*this, memoryFd, doorbellFd, spaceFd))
+            m_messageRing = nullptr;
+        break;
+    }
+    case IPC::PoolIDReservation::code:
+    {
+        auto reservation = IPC::PoolIDReservation::from(message);
+        ALOGV("RendererBackend::handleMessage(): PoolIDReservation { count %u }", reservation.count);
+        for (uint32_t i = 0; i < std::min<uint32_t>(reservation.count, G_N_ELEMENTS(reservation.poolIDs)); ++i)
+            m_reservedPoolIDs.push_back(reservation.poolIDs[i]);
+
+        while (!m_poolIDRequests.empty() && !m_reservedPoolIDs.empty()) {
+            auto* target = m_poolIDRequests.front();
+            m_poolIDRequests.pop_front();
+            requestPoolID(*target);
+        }
+        break;
+    }
+    case IPC::TrimMemory::code:
+    {
+        auto trim = IPC::TrimMemory::from(message);
+        ALOGV("RendererBackend::handleMessage(): TrimMemory { poolID %u, keepBufferCount %u }", trim.poolID, trim.keepBufferCount);
+        // EGL images don't need a context to be destroyed.
+        flushCachedImages();
+        auto* target = m_targets.get(trim.poolID);
+        if (target)
+            target->trimMemory(trim.keepBufferCount);
+        break;
+    }
+    case IPC::PoolConstructionReply::code:
+    {
+        auto reply = IPC::PoolConstructionReply::from(message);
+        auto* target = m_targets.get(reply.poolID);
+        if (target)
+            target->poolConstructed(reply);
+        break;
+    }
     case IPC::FrameComplete::code:
     {   auto frameComplete = IPC::FrameComplete::from(message);
         ALOGV("RendererBackend::handleMessage(): FrameComplete { poolID %u }", frameComplete.poolID);
-        auto it = m_targetMap.find(frameComplete.poolID);
-        if (it == m_targetMap.end()) {
+        WPE_ANDROID_TRACE_SCOPE("RendererBackend FrameComplete");
+        if (frameComplete.completeTime)
+            WPE_ANDROID_TRACE_COUNTER("WPE frame complete latency", WPEAndroid::monotonicTime() - frameComplete.completeTime);
+        auto* target = m_targets.get(frameComplete.poolID);
+        if (!target) {
             // This situation can happen if during intensive rendering page is destroyed while frame is still
             // being processed by UIProcess. This used to be g_error but we must not crash in such situation.
             g_warning("RendererBackend - Cannot find buffer pool with poolId %" PRIu32 " in renderer backend.", frameComplete.poolID);
             return;
         }
 
-        wpe_renderer_backend_egl_target_dispatch_frame_complete(it->second->target);
+        wpe_renderer_backend_egl_target_dispatch_frame_complete(target->target);
         break;
     }
     case IPC::ReleaseBuffer::code:
     {
         auto release = IPC::ReleaseBuffer::from(message);
         ALOGV("RendererBackend::handleMessage(): BufferRelease { poolID %u, bufferID %u }", release.poolID, release.bufferID);
-        auto it = m_targetMap.find(release.poolID);
-        if (it == m_targetMap.end()) {
+        // Only present when the release came through the socket.
+        int releaseFenceFD = m_ipcClient.takeFileDescriptor();
+        if (release.releaseTime)
+            WPE_ANDROID_TRACE_COUNTER("WPE release latency", WPEAndroid::monotonicTime() - release.releaseTime);
+        auto* target = m_targets.get(release.poolID);
+        if (!target) {
             // This situation can happen if during intensive rendering page is destroyed while frame is still
             // being processed by UIProcess. This used to be g_error but we must not crash in such situation.
             g_warning("RendererBackend - Cannot find buffer pool with poolId %" PRIu32 " in renderer backend.", release.poolID);
+            if (releaseFenceFD != -1)
+                close(releaseFenceFD);
             return;
         }
 
-        it->second->releaseBuffer(release.poolID, release.bufferID);
+        if (release.layerID)
+            target->releaseLayerBuffer(release.poolID, release.layerID, release.bufferID, releaseFenceFD);
+        else
+            target->releaseBuffer(release.poolID, release.bufferID, releaseFenceFD);
+        break;
+    }
+    case IPC::BufferAdoption::code:
+    {
+        auto adoption = IPC::BufferAdoption::from(message);
+        ALOGV("RendererBackend::handleMessage(): BufferAdoption { poolID %u, bufferID %u }", adoption.poolID, adoption.bufferID);
+
+        int releaseFenceFD = m_ipcClient.takeFileDescriptor();
+
+        // The handle follows on the socket and has to be read in any case. It is sent right
+        // after the message, waiting on the socket doesn't take long.
+        AHardwareBuffer* object = nullptr;
+        while (true) {
+            int ret = AHardwareBuffer_recvHandleFromUnixSocket(m_ipcClient.socketFd(), &object);
+            if (ret != -EAGAIN)
+                break;
+
+            struct pollfd pfd = { m_ipcClient.socketFd(), POLLIN, 0 };
+            if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+                break;
+        }
+
+        auto* target = object ? m_targets.get(adoption.poolID) : nullptr;
+        if (!target) {
+            if (object)
+                AHardwareBuffer_release(object);
+            if (releaseFenceFD != -1)
+                close(releaseFenceFD);
+            return;
+        }
+
+        target->adoptBuffer(adoption.poolID, adoption.bufferID, object, releaseFenceFD);
         break;
     }
     default:
@@ -187,25 +680,53 @@ EGLTarget::EGLTarget(struct wpe_renderer_backend_egl_target* target, int hostFd)
 {
     ipcClient.initialize(*this, hostFd);
 
-    for (auto& buffer : buffers.pool)
-        buffer.bufferID = uint32_t(std::distance(buffers.pool.begin(), &buffer));
+    std::lock_guard<std::mutex> lock(s_eglTargetsLock);
+    s_eglTargets.push_back(this);
 }
 
 EGLTarget::~EGLTarget()
 {
-    IPC::UnregisterPool unregisterPool;
-    unregisterPool.poolID = buffers.poolID;
+    {
+        std::lock_guard<std::mutex> lock(s_eglTargetsLock);
+        s_eglTargets.erase(std::remove(s_eglTargets.begin(), s_eglTargets.end(), this), s_eglTargets.end());
+    }
 
-    IPC::Message message;
-    IPC::UnregisterPool::construct(message, unregisterPool);
-    ipcClient.sendMessage(IPC::Message::data(message), IPC::Message::size);
+    // Nothing dispatches into the target anymore from then on, and the pool ID can't be
+    // assigned meanwhile.
+    if (m_backend) {
+        std::lock_guard<std::recursive_mutex> lock(m_backend->lock());
+        if (buffers.poolID)
+            m_backend->unregisterEGLTarget(buffers.poolID, this);
+        else
+            m_backend->cancelPoolIDRequest(*this);
+    }
+
+    if (buffers.poolID) {
+        IPC::UnregisterPool unregisterPool;
+        unregisterPool.poolID = buffers.poolID;
+
+        IPC::Message message;
+        IPC::UnregisterPool::construct(message, unregisterPool);
+        ipcClient.sendMessage(IPC::Message::data(message), IPC::Message::size);
+    }
 
     ipcClient.deinitialize();
 
-    m_backend->unregisterEGLTarget(buffers.poolID);
+    if (renderer.trimSource) {
+        g_source_destroy(renderer.trimSource);
+        g_source_unref(renderer.trimSource);
+    }
     for (auto& buffer : buffers.pool) {
         if (buffer.object)
             AHardwareBuffer_release(buffer.object);
+        if (buffer.releaseFenceFD != -1)
+            close(buffer.releaseFenceFD);
+    }
+    for (auto& layer : layers) {
+        for (auto& buffer : layer.buffers) {
+            if (buffer.object)
+                AHardwareBuffer_release(buffer.object);
+        }
     }
 }
 
@@ -216,60 +737,96 @@ void EGLTarget::initialize(RendererBackend* backend, uint32_t width, uint32_t he
     renderer.width = width;
     renderer.height = height;
 
+    // Frames rendered before the pool is constructed go into the void, WPE gets their
+    // frame-complete once the UI process has answered.
+    backend->requestPoolID(*this);
+}
+
+void EGLTarget::constructPool(uint32_t poolID)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        buffers.poolID = poolID;
+    }
+    m_backend->registerEGLTarget(poolID, this);
+
     IPC::PoolConstruction poolConstruction;
+    poolConstruction.viewToken = ipcClient.token();
+    poolConstruction.poolID = poolID;
 
     IPC::Message message;
     IPC::PoolConstruction::construct(message, poolConstruction);
+    m_backend->ipc().sendMessage(IPC::Message::data(message), IPC::Message::size);
 
-    // We can safely assume that returned message is PoolConstructionReply because there are no
-    // other messages coming this way in this socket at this point
-    backend->ipc().sendAndReceiveMessage(IPC::Message::data(message), IPC::Message::size, [&] (char* data, size_t size) {
-        ALOGV("EGLTarget::initialize - handleMessage() %p[%zu]", data, size);
-        if (size != IPC::Message::size)
-            return;
+    IPC::RegisterPool registerPool;
+    registerPool.poolID = poolID;
+
+    IPC::Message registerMessage;
+    IPC::RegisterPool::construct(registerMessage, registerPool);
+    ipcClient.sendMessage(IPC::Message::data(registerMessage), IPC::Message::size);
+}
 
-        auto& message = IPC::Message::cast(data);
-        switch (message.messageCode) {
-            case IPC::PoolConstructionReply::code:
-            {
-                auto reply = IPC::PoolConstructionReply::from(message);
-                ALOGV("  PoolConstructionReply: poolID %u", reply.poolID);
+void EGLTarget::poolConstructed(const IPC::PoolConstructionReply& reply)
+{
+    ALOGV("EGLTarget::poolConstructed() poolID %u, bufferCount %u, resizeBucket %u, usage 0x%x, format %u, flags 0x%x",
+        reply.poolID, reply.bufferCount, reply.resizeBucket, reply.usage, reply.format, reply.flags);
 
-                buffers.poolID = reply.poolID;
+    // The render thread may be in the middle of a frame, which doesn't have a buffer from
+    // the pool though as long as it's empty.
+    std::unique_lock<std::mutex> lock(m_lock);
+    if (!buffers.pool.empty())
+        return;
 
-                m_backend->registerEGLTarget(buffers.poolID, this);
+    buffers.resizeBucket = reply.resizeBucket;
+    buffers.usage = reply.usage;
+    if (reply.format)
+        buffers.format = reply.format;
+    buffers.depthStencil = !!(reply.flags & IPC::PoolDepthStencil);
+    buffers.layers = !!(reply.flags & IPC::PoolLayers);
+    buffers.releaseWaitTimeout = reply.releaseWaitTimeout;
 
-                IPC::RegisterPool registerPool;
-                registerPool.poolID = reply.poolID;
+    buffers.pool.resize(std::min(std::max(reply.bufferCount, IPC::minPoolBufferCount), IPC::maxPoolBufferCount));
+    for (auto& buffer : buffers.pool)
+        buffer.bufferID = uint32_t(std::distance(buffers.pool.data(), &buffer));
 
-                IPC::Message message;
-                IPC::RegisterPool::construct(message, registerPool);
-                ipcClient.sendMessage(IPC::Message::data(message), IPC::Message::size);
-            }
-        }
-    });
+    bool frameCompletePending = buffers.frameCompletePending;
+    buffers.frameCompletePending = false;
+    lock.unlock();
+
+    if (frameCompletePending)
+        wpe_renderer_backend_egl_target_dispatch_frame_complete(target);
 }
 
 void EGLTarget::resize(uint32_t width, uint32_t height)
 {
+    std::lock_guard<std::mutex> lock(m_lock);
     if (renderer.width == width && renderer.height == height)
         return;
     ALOGV("EGLTarget::resize() (%u,%u)", width, height);
     renderer.width = width;
     renderer.height = height;
+    buffers.trimmed = false;
 
-    destroyBufferPool(buffers.pool, renderer.destroyImageKHR);
-
-    IPC::PoolPurge poolPurge;
-    poolPurge.poolID = buffers.poolID;
+    // Buffers still held by the UI process are left alone and get reallocated once they
+    // are released and picked again, the rest is freed right away unless it still fits.
+    // The UI process drops its reference to the old AHardwareBuffer when it receives the
+    // BufferAllocation for the same slot, so no PoolPurge is needed.
+    for (auto& buffer : buffers.pool) {
+        if (buffer.object && !buffer.locked && !bufferFitsRenderer(buffer))
+            destroyBuffer(buffer, renderer.destroyImageKHR);
+    }
+}
 
-    IPC::Message message;
-    IPC::PoolPurge::construct(message, poolPurge);
-    m_backend->ipc().sendMessage(IPC::Message::data(message), IPC::Message::size);
+bool EGLTarget::bufferFitsRenderer(const Buffer& buffer) const
+{
+    return buffer.width == bucketSize(renderer.width, buffers.resizeBucket)
+        && buffer.height == bucketSize(renderer.height, buffers.resizeBucket);
 }
 
 void EGLTarget::frameWillRender()
 {
+    WPE_ANDROID_TRACE_SCOPE("EGLTarget::frameWillRender");
+    std::unique_lock<std::mutex> lock(m_lock);
     if (!renderer.initialized) {
         renderer.initialized = true;
 
@@ -287,89 +844,391 @@ void EGLTarget::frameWillRender()
             eglGetProcAddress("eglDestroySyncKHR"));
         renderer.dupNativeFenceFDANDROID = reinterpret_cast<PFNEGLDUPNATIVEFENCEFDANDROIDPROC>(
             eglGetProcAddress("eglDupNativeFenceFDANDROID"));
+        renderer.waitSyncKHR = reinterpret_cast<PFNEGLWAITSYNCKHRPROC>(
+            eglGetProcAddress("eglWaitSyncKHR"));
+
+        // eglGetProcAddress() may hand out entrypoints for extensions the driver doesn't have.
+        const char* glExtensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+        if (glExtensions && strstr(glExtensions, "GL_EXT_discard_framebuffer")) {
+            renderer.discardFramebufferEXT = reinterpret_cast<PFNGLDISCARDFRAMEBUFFEREXTPROC>(
+                eglGetProcAddress("glDiscardFramebufferEXT"));
+        }
 
-        GLuint framebuffer { 0 };
-        glGenFramebuffers(1, &framebuffer);
-        renderer.framebuffer = framebuffer;
+        const char* extensions = eglQueryString(eglGetCurrentDisplay(), EGL_EXTENSIONS);
+        renderer.protectedContent = extensions && strstr(extensions, "EGL_EXT_protected_content");
+
+        ALOGV("  initialized, entrypoints %p/%p/%p/%p",
+            renderer.getNativeClientBufferANDROID, renderer.createImageKHR, renderer.destroyImageKHR, renderer.imageTargetRenderbufferStorageOES);
+    }
+
+    renderer.display = eglGetCurrentDisplay();
+    EGLContext context = eglGetCurrentContext();
+    if (context != renderer.context) {
+        renderer.context = context;
+        EGLint protectedContext = EGL_FALSE;
+        renderer.protectedContext = renderer.protectedContent
+            && eglQueryContext(renderer.display, context, EGL_PROTECTED_CONTENT_EXT, &protectedContext) && protectedContext == EGL_TRUE;
+    }
+    if (!renderer.trimSource) {
+        renderer.trimSource = g_source_new(&trimSourceFuncs, sizeof(GSource));
+        g_source_set_name(renderer.trimSource, "WPEBackend-android::trim");
+        g_source_set_callback(renderer.trimSource, trimmedGLObjectsCallback, this, nullptr);
+        g_source_attach(renderer.trimSource, g_main_context_get_thread_default());
+    }
+    deleteTrimmedGLObjects();
 
-        ALOGV("  initialized, entrypoints %p/%p/%p/%p, framebuffer %u",
-            renderer.getNativeClientBufferANDROID, renderer.createImageKHR, renderer.destroyImageKHR, renderer.imageTargetRenderbufferStorageOES,
-            renderer.framebuffer);
+    buffers.current = findAvailableBuffer();
+    if (!buffers.current && buffers.releaseWaitTimeout && !buffers.pool.empty())
+        buffers.current = waitForAvailableBuffer(lock);
+    if (!buffers.current) {
+        // Render this frame into the void rather than into a buffer the UI process is still using.
+        ALOGV("  no available current-buffer found, skipping frame");
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return;
     }
 
+    auto& current = *buffers.current;
+
+    if (current.object && !bufferFitsRenderer(current))
+        destroyBuffer(current, renderer.destroyImageKHR);
+
+    if (!current.object && !allocateBuffer(current))
+        return;
+
+    // Usually done after an earlier frame already, see prepareSpareBuffer().
+    if (!current.egl.image)
+        importBuffer(current);
+
+    if (current.releaseFenceFD != -1)
+        waitForReleaseFence(current);
+
+    // The framebuffer of the slot was put together and validated along with the import,
+    // the shared depth/stencil only needs new storage when coming back from another size,
+    // which attaches it to this framebuffer again as well.
+    if (buffers.depthStencil)
+        ensureDepthStencil(current.width, current.height);
+    glBindFramebuffer(GL_FRAMEBUFFER, current.gl.framebuffer);
+}
+
+Buffer* EGLTarget::findAvailableBuffer()
+{
+    Buffer* availableBuffer = nullptr;
     for (auto& buffer : buffers.pool) {
         if (buffer.locked)
             continue;
 
-        buffers.current = &buffer;
-        break;
+        if (buffer.object && bufferFitsRenderer(buffer))
+            return &buffer;
+        if (!availableBuffer)
+            availableBuffer = &buffer;
     }
-    if (!buffers.current) {
-        ALOGV("  no available current-buffer found");
-        std::abort();
+    return availableBuffer;
+}
+
+Buffer* EGLTarget::waitForAvailableBuffer(std::unique_lock<std::mutex>& lock)
+{
+    WPE_ANDROID_TRACE_SCOPE("EGLTarget::waitForAvailableBuffer");
+
+    // Nobody would dispatch the release while rendering on the thread reading the messages.
+    if (m_backend->dispatchesOnCurrentThread())
+        return nullptr;
+
+    uint64_t startTime = WPEAndroid::monotonicTime();
+    Buffer* buffer = nullptr;
+    m_bufferReleased.wait_for(lock, std::chrono::milliseconds(buffers.releaseWaitTimeout),
+        [this, &buffer] { return !!(buffer = findAvailableBuffer()); });
+
+    IPC::BufferWait wait;
+    wait.poolID = buffers.poolID;
+    wait.timedOut = !buffer;
+    wait.waitTime = WPEAndroid::monotonicTime() - startTime;
+
+    IPC::Message message;
+    IPC::BufferWait::construct(message, wait);
+    m_backend->ipc().sendMessage(IPC::Message::data(message), IPC::Message::size);
+    return buffer;
+}
+
+void EGLTarget::ensureDepthStencil(uint32_t width, uint32_t height)
+{
+    auto& depthStencil = renderer.depthStencil;
+    if (depthStencil.renderbuffer && depthStencil.width == width && depthStencil.height == height)
         return;
+
+    if (!depthStencil.renderbuffer)
+        glGenRenderbuffers(1, &depthStencil.renderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthStencil.renderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8_OES, width, height);
+    depthStencil.width = width;
+    depthStencil.height = height;
+
+    // Framebuffers keep the attachment across the new storage, those of slots which still
+    // have the previous size would be incomplete with it and get it detached until they are
+    // reallocated.
+    GLint boundFramebuffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &boundFramebuffer);
+    for (auto& buffer : buffers.pool) {
+        if (buffer.gl.framebuffer)
+            attachDepthStencil(buffer);
     }
+    glBindFramebuffer(GL_FRAMEBUFFER, boundFramebuffer);
+}
 
-    auto& current = *buffers.current;
+void EGLTarget::attachDepthStencil(const Buffer& buffer)
+{
+    auto& depthStencil = renderer.depthStencil;
+    GLuint renderbuffer = buffer.width == depthStencil.width && buffer.height == depthStencil.height ? depthStencil.renderbuffer : 0;
 
-    if (!current.object) {
-        AHardwareBuffer_Desc description;
-        description.width = renderer.width;
-        description.height = renderer.height;
-        description.layers = 1;
-        description.format = AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM;
-        description.usage = AHARDWAREBUFFER_USAGE_GPU_FRAMEBUFFER | AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE | AHARDWAREBUFFER_USAGE_COMPOSER_OVERLAY;
-        description.stride = description.rfu0 = description.rfu1 = 0;
-
-        int ret = AHardwareBuffer_allocate(&description, &current.object);
-        if (!!ret || !current.object) {
-            ALOGV("  failed to allocate AHardwareBuffer: ret %d", ret);
-            return;
-        }
+    glBindFramebuffer(GL_FRAMEBUFFER, buffer.gl.framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, renderbuffer);
+}
 
-        EGLClientBuffer clientBuffer = renderer.getNativeClientBufferANDROID(current.object);
-        current.egl.image = renderer.createImageKHR(eglGetCurrentDisplay(),
-            EGL_NO_CONTEXT, EGL_NATIVE_BUFFER_ANDROID, clientBuffer, nullptr);
+bool EGLTarget::allocateBuffer(Buffer& buffer)
+{
+    if (isProtected() && !renderer.protectedContext) {
+        ALOGE("EGLTarget: the context is not protected, falling back to unprotected buffers");
+        dropProtectedContent();
+    }
 
-        std::array<GLuint, 2> renderbuffers { 0, 0 };
-        glGenRenderbuffers(2, renderbuffers.data());
-        current.gl.colorBuffer = renderbuffers[0];
-        current.gl.dsBuffer = renderbuffers[1];
+    AHardwareBuffer_Desc description;
+    description.width = bucketSize(renderer.width, buffers.resizeBucket);
+    description.height = bucketSize(renderer.height, buffers.resizeBucket);
+    description.layers = 1;
+    description.format = buffers.format;
+    description.usage = AHARDWAREBUFFER_USAGE_GPU_FRAMEBUFFER | AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE | AHARDWAREBUFFER_USAGE_COMPOSER_OVERLAY | buffers.usage;
+    description.stride = description.rfu0 = description.rfu1 = 0;
+
+    int ret = AHardwareBuffer_allocate(&description, &buffer.object);
+    if ((!!ret || !buffer.object) && (description.usage & AHARDWAREBUFFER_USAGE_PROTECTED_CONTENT)) {
+        // Better unprotected content than none, protected video then fails to play instead.
+        ALOGE("EGLTarget: protected buffers are not supported, falling back to unprotected ones");
+        dropProtectedContent();
+        description.usage &= ~uint64_t(AHARDWAREBUFFER_USAGE_PROTECTED_CONTENT);
+        ret = AHardwareBuffer_allocate(&description, &buffer.object);
+    }
+    if (!!ret || !buffer.object) {
+        ALOGV("  failed to allocate AHardwareBuffer: ret %d", ret);
+        buffer.object = nullptr;
+        return false;
+    }
+    buffer.width = description.width;
+    buffer.height = description.height;
+    buffer.hardwareBufferID = hardwareBufferID(buffer.object);
 
-        glBindRenderbuffer(GL_RENDERBUFFER, current.gl.colorBuffer);
-        renderer.imageTargetRenderbufferStorageOES(GL_RENDERBUFFER, current.egl.image);
+    IPC::BufferAllocation allocation;
+    allocation.poolID = buffers.poolID;
+    allocation.bufferID = buffer.bufferID;
+    allocation.layerID = 0;
 
-        glBindRenderbuffer(GL_RENDERBUFFER, current.gl.dsBuffer);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8_OES, renderer.width, renderer.height);
+    IPC::Message message;
+    IPC::BufferAllocation::construct(message, allocation);
+    m_backend->ipc().sendMessage(IPC::Message::data(message), IPC::Message::size);
 
-        {
-            IPC::BufferAllocation allocation;
-            allocation.poolID = buffers.poolID;
-            allocation.bufferID = current.bufferID;
-
-            IPC::Message message;
-            IPC::BufferAllocation::construct(message, allocation);
-            m_backend->ipc().sendMessage(IPC::Message::data(message), IPC::Message::size);
-
-            while (true) {
-                int ret = AHardwareBuffer_sendHandleToUnixSocket(current.object, m_backend->ipc().socketFd());
-                if (!ret || ret != -EAGAIN)
-                    break;
-            }
-        }
+    while (true) {
+        int ret = AHardwareBuffer_sendHandleToUnixSocket(buffer.object, m_backend->ipc().socketFd());
+        if (!ret || ret != -EAGAIN)
+            break;
+    }
+    return true;
+}
+
+void EGLTarget::dropProtectedContent()
+{
+    buffers.usage &= ~uint64_t(AHARDWAREBUFFER_USAGE_PROTECTED_CONTENT);
+
+    // The pool's buffers are matched against its usage when they are kept for adoption.
+    IPC::PoolUsageChange change;
+    change.poolID = buffers.poolID;
+    change.usage = uint32_t(buffers.usage);
+
+    IPC::Message message;
+    IPC::PoolUsageChange::construct(message, change);
+    m_backend->ipc().sendMessage(IPC::Message::data(message), IPC::Message::size);
+}
+
+void EGLTarget::importBuffer(Buffer& buffer)
+{
+    WPE_ANDROID_TRACE_SCOPE("EGLTarget::importBuffer");
+
+    buffer.egl.display = eglGetCurrentDisplay();
+    buffer.egl.image = takeCachedImage(buffer.egl.display, buffer.hardwareBufferID);
+    if (!buffer.egl.image) {
+        EGLClientBuffer clientBuffer = renderer.getNativeClientBufferANDROID(buffer.object);
+        EGLint protectedAttributes[] = { EGL_PROTECTED_CONTENT_EXT, EGL_TRUE, EGL_NONE };
+        bool protectedImage = isProtected() && renderer.protectedContext;
+        buffer.egl.image = renderer.createImageKHR(buffer.egl.display,
+            EGL_NO_CONTEXT, EGL_NATIVE_BUFFER_ANDROID, clientBuffer, protectedImage ? protectedAttributes : nullptr);
     }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, renderer.framebuffer);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, current.gl.colorBuffer);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, current.gl.dsBuffer);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, current.gl.dsBuffer);
+    glGenRenderbuffers(1, &buffer.gl.colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, buffer.gl.colorBuffer);
+    renderer.imageTargetRenderbufferStorageOES(GL_RENDERBUFFER, buffer.egl.image);
+
+    // Keeps whatever framebuffer WPE has bound, this may run right after a frame.
+    GLint boundFramebuffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &boundFramebuffer);
+
+    glGenFramebuffers(1, &buffer.gl.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, buffer.gl.framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, buffer.gl.colorBuffer);
+    if (buffers.depthStencil) {
+        ensureDepthStencil(buffer.width, buffer.height);
+        attachDepthStencil(buffer);
+    }
 
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
         ALOGV("EGLTarget: GL_FRAMEBUFFER not COMPLETE");
+
+    glBindFramebuffer(GL_FRAMEBUFFER, boundFramebuffer);
+}
+
+void EGLTarget::prepareSpareBuffer()
+{
+    if (buffers.trimmed)
+        return;
+
+    for (auto& buffer : buffers.pool) {
+        if (buffer.locked || (buffer.object && bufferFitsRenderer(buffer) && buffer.egl.image))
+            continue;
+
+        if (buffer.object && !bufferFitsRenderer(buffer))
+            destroyBuffer(buffer, renderer.destroyImageKHR);
+        if (!buffer.object && !allocateBuffer(buffer))
+            return;
+        importBuffer(buffer);
+        return;
+    }
+}
+
+void EGLTarget::trimMemory(uint32_t keepBufferCount)
+{
+    WPE_ANDROID_TRACE_SCOPE("EGLTarget::trimMemory");
+    std::lock_guard<std::mutex> lock(m_lock);
+    buffers.trimmed = true;
+
+    uint32_t allocated = std::count_if(buffers.pool.begin(), buffers.pool.end(), [](const Buffer& buffer) { return !!buffer.object; });
+    for (auto& buffer : buffers.pool) {
+        if (allocated <= keepBufferCount)
+            break;
+        if (!buffer.object || buffer.locked || &buffer == buffers.current)
+            continue;
+
+        // EGL images and buffers don't need the context, their memory is only freed once the
+        // renderbuffer sharing the image is deleted as well though.
+        if (buffer.gl.framebuffer)
+            buffers.trimmedFramebuffers.push_back(buffer.gl.framebuffer);
+        if (buffer.gl.colorBuffer)
+            buffers.trimmedRenderbuffers.push_back(buffer.gl.colorBuffer);
+        buffer.gl = { };
+        destroyBuffer(buffer, renderer.destroyImageKHR);
+        --allocated;
+
+        IPC::BufferDestruction destruction;
+        destruction.poolID = buffers.poolID;
+        destruction.bufferID = buffer.bufferID;
+
+        IPC::Message message;
+        IPC::BufferDestruction::construct(message, destruction);
+        m_backend->ipc().sendMessage(IPC::Message::data(message), IPC::Message::size);
+    }
+
+    // Framebuffers of the remaining slots have the depth/stencil attached.
+    if (!allocated && renderer.depthStencil.renderbuffer) {
+        buffers.trimmedRenderbuffers.push_back(renderer.depthStencil.renderbuffer);
+        renderer.depthStencil = { };
+    }
+
+    if (buffers.trimmedFramebuffers.empty() && buffers.trimmedRenderbuffers.empty())
+        return;
+    if (renderer.context != EGL_NO_CONTEXT && eglGetCurrentContext() == renderer.context)
+        deleteTrimmedGLObjects();
+    else if (renderer.trimSource)
+        g_source_set_ready_time(renderer.trimSource, 0);
+}
+
+void EGLTarget::deleteTrimmedGLObjects()
+{
+    if (!buffers.trimmedFramebuffers.empty())
+        glDeleteFramebuffers(buffers.trimmedFramebuffers.size(), buffers.trimmedFramebuffers.data());
+    if (!buffers.trimmedRenderbuffers.empty())
+        glDeleteRenderbuffers(buffers.trimmedRenderbuffers.size(), buffers.trimmedRenderbuffers.data());
+    buffers.trimmedFramebuffers.clear();
+    buffers.trimmedRenderbuffers.clear();
+}
+
+gboolean EGLTarget::trimmedGLObjectsCallback(gpointer data)
+{
+    auto& target = *static_cast<EGLTarget*>(data);
+    std::lock_guard<std::mutex> lock(target.m_lock);
+    if (target.buffers.trimmedFramebuffers.empty() && target.buffers.trimmedRenderbuffers.empty())
+        return G_SOURCE_CONTINUE;
+
+    // WPE usually leaves the context current on the render thread, where it can be made
+    // current again otherwise since no other thread uses it.
+    EGLDisplay display = target.renderer.display;
+    EGLDisplay previousDisplay = eglGetCurrentDisplay();
+    EGLContext previousContext = eglGetCurrentContext();
+    EGLSurface previousDrawSurface = eglGetCurrentSurface(EGL_DRAW);
+    EGLSurface previousReadSurface = eglGetCurrentSurface(EGL_READ);
+    if (previousContext != target.renderer.context
+        && !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, target.renderer.context)) {
+        ALOGV("EGLTarget: failed to make the context current, trimmed GL objects wait for the next frame");
+        return G_SOURCE_CONTINUE;
+    }
+
+    target.deleteTrimmedGLObjects();
+
+    if (previousContext != target.renderer.context)
+        eglMakeCurrent(previousDisplay != EGL_NO_DISPLAY ? previousDisplay : display, previousDrawSurface, previousReadSurface, previousContext);
+    return G_SOURCE_CONTINUE;
+}
+
+void EGLTarget::waitForReleaseFence(Buffer& buffer)
+{
+    int fenceFD = buffer.releaseFenceFD;
+    buffer.releaseFenceFD = -1;
+
+    if (renderer.waitSyncKHR) {
+        // EGL owns the descriptor once the sync has been created, the wait is queued on the
+        // GPU and only holds back the commands rendering into the buffer.
+        EGLint attributes[] = { EGL_SYNC_NATIVE_FENCE_FD_ANDROID, fenceFD, EGL_NONE };
+        EGLSyncKHR sync = renderer.createSyncKHR(eglGetCurrentDisplay(), EGL_SYNC_NATIVE_FENCE_ANDROID, attributes);
+        if (sync != EGL_NO_SYNC_KHR) {
+            renderer.waitSyncKHR(eglGetCurrentDisplay(), sync, 0);
+            renderer.destroySyncKHR(eglGetCurrentDisplay(), sync);
+            return;
+        }
+        ALOGV("EGLTarget: failed to import release fence, waiting on the CPU");
+    }
+
+    struct pollfd pfd = { fenceFD, POLLIN, 0 };
+    while (poll(&pfd, 1, -1) == -1 && errno == EINTR) { }
+    close(fenceFD);
 }
 
 void EGLTarget::frameRendered()
 {
+    WPE_ANDROID_TRACE_SCOPE("EGLTarget::frameRendered");
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!buffers.current) {
+        buffers.frameCompletePending = true;
+        buffers.skippedFrames++;
+
+        // What the renderer drew into the void is missing from every buffer now.
+        for (auto& buffer : buffers.pool)
+            buffer.renderedFrame = 0;
+        damage.full = true;
+        return;
+    }
+
+    // Tiled GPUs can then skip writing depth/stencil back to memory.
+    if (buffers.depthStencil && renderer.discardFramebufferEXT) {
+        static const GLenum attachments[] = { GL_DEPTH_ATTACHMENT, GL_STENCIL_ATTACHMENT };
+        glBindFramebuffer(GL_FRAMEBUFFER, buffers.current->gl.framebuffer);
+        renderer.discardFramebufferEXT(GL_FRAMEBUFFER, 2, attachments);
+    }
+
     EGLSyncKHR sync = renderer.createSyncKHR(eglGetCurrentDisplay(), EGL_SYNC_NATIVE_FENCE_ANDROID, nullptr);
 
     glFlush();
@@ -390,38 +1249,325 @@ void EGLTarget::frameRendered()
         IPC::BufferCommit commit;
         commit.poolID = buffers.poolID;
         commit.bufferID = buffers.current->bufferID;
+        commit.width = renderer.width;
+        commit.height = renderer.height;
+        commit.skippedFrames = buffers.skippedFrames;
+        commit.renderedTime = WPEAndroid::monotonicTime();
+        buffers.skippedFrames = 0;
+
+        // The damage and the commit go out with a single write, the fence along with the
+        // commit.
+        std::array<IPC::Message, (IPC::maxDamageRects + 1) / 2 + 1> messages;
+        size_t count = damageMessages(messages.data());
+        IPC::BufferCommit::construct(messages[count++], commit);
+        m_backend->ipc().sendMessages(messages.data(), count, &syncFd, syncFd >= 0 ? 1 : 0);
+    }
+
+    if (syncFd >= 0)
+        close(syncFd);
+
+    buffers.current->locked = true;
+    buffers.current->renderedFrame = ++buffers.frameCount;
+    buffers.current = nullptr;
+
+    prepareSpareBuffer();
+
+    buffers.committedWidth = renderer.width;
+    buffers.committedHeight = renderer.height;
+    damage.count = 0;
+    damage.full = false;
+}
+
+void EGLTarget::addDamage(int32_t x, int32_t y, int32_t width, int32_t height)
+{
+    if (damage.full)
+        return;
+
+    int32_t left = std::max(x, 0);
+    int32_t top = std::max(y, 0);
+    int32_t right = std::min<int64_t>(int64_t(x) + width, renderer.width);
+    int32_t bottom = std::min<int64_t>(int64_t(y) + height, renderer.height);
+    if (right <= left || bottom <= top)
+        return;
+
+    decltype(damage)::Rect rect { uint32_t(left), uint32_t(top), uint32_t(right - left), uint32_t(bottom - top) };
+    if (damage.count < damage.rects.size()) {
+        damage.rects[damage.count++] = rect;
+        return;
+    }
+
+    // Past the limit everything is merged into the bounding box.
+    uint32_t x0 = rect.x, y0 = rect.y, x1 = rect.x + rect.width, y1 = rect.y + rect.height;
+    for (auto& other : damage.rects) {
+        x0 = std::min(x0, other.x);
+        y0 = std::min(y0, other.y);
+        x1 = std::max(x1, other.x + other.width);
+        y1 = std::max(y1, other.y + other.height);
+    }
+    damage.rects[0] = { x0, y0, x1 - x0, y1 - y0 };
+    damage.count = 1;
+}
+
+uint32_t EGLTarget::bufferAge() const
+{
+    if (!buffers.current || !buffers.current->renderedFrame)
+        return 0;
+    return uint32_t(buffers.frameCount + 1 - buffers.current->renderedFrame);
+}
+
+size_t EGLTarget::damageMessages(IPC::Message* messages)
+{
+    // A resized frame has nothing to be compared against.
+    if (damage.full || !damage.count
+        || renderer.width != buffers.committedWidth || renderer.height != buffers.committedHeight)
+        return 0;
+
+    size_t count = 0;
+    for (uint32_t i = 0; i < damage.count; i += 2) {
+        IPC::BufferDamage bufferDamage;
+        bufferDamage.poolID = buffers.poolID;
+        bufferDamage.bufferID = buffers.current->bufferID;
+        for (uint32_t j = 0; j < 2; ++j) {
+            auto* rect = i + j < damage.count ? &damage.rects[i + j] : nullptr;
+            bufferDamage.rects[j][0] = rect ? rect->x : 0;
+            bufferDamage.rects[j][1] = rect ? rect->y : 0;
+            bufferDamage.rects[j][2] = rect ? rect->width : 0;
+            bufferDamage.rects[j][3] = rect ? rect->height : 0;
+        }
+
+        IPC::BufferDamage::construct(messages[count++], bufferDamage);
+    }
+    return count;
+}
+
+bool EGLTarget::commitLayer(uint32_t layerID, AHardwareBuffer* object, int fenceFD, int32_t x, int32_t y, uint32_t width, uint32_t height, int32_t zOrder)
+{
+    WPE_ANDROID_TRACE_SCOPE("EGLTarget::commitLayer");
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!buffers.layers || !layerID || !object)
+        return false;
+
+    auto it = std::find_if(layers.begin(), layers.end(), [layerID](const Layer& layer) { return layer.id == layerID; });
+    if (it == layers.end()) {
+        if (layers.size() >= IPC::maxPoolLayers)
+            return false;
+        layers.emplace_back();
+        it = std::prev(layers.end());
+        it->id = layerID;
+    } else if (it->removed)
+        return false;
+    auto& layer = *it;
+
+    // Producers cycle through a fixed set of buffers, those already known to the UI process
+    // are only referenced by their slot.
+    Layer::Buffer* buffer = nullptr;
+    for (auto& layerBuffer : layer.buffers) {
+        if (layerBuffer.object == object) {
+            buffer = &layerBuffer;
+            break;
+        }
+    }
+    if (buffer && buffer->locked)
+        return false;
+
+    if (!buffer) {
+        for (auto& layerBuffer : layer.buffers) {
+            if (!layerBuffer.object) {
+                buffer = &layerBuffer;
+                break;
+            }
+        }
+    }
+    if (!buffer) {
+        // The UI process drops its reference along with the BufferAllocation for the slot.
+        for (auto& layerBuffer : layer.buffers) {
+            if (!layerBuffer.locked) {
+                AHardwareBuffer_release(layerBuffer.object);
+                layerBuffer.object = nullptr;
+                buffer = &layerBuffer;
+                break;
+            }
+        }
+    }
+    if (!buffer)
+        return false;
+
+    uint32_t bufferID = uint32_t(std::distance(layer.buffers.data(), buffer));
+    if (!buffer->object) {
+        AHardwareBuffer_acquire(object);
+        buffer->object = object;
+
+        IPC::BufferAllocation allocation;
+        allocation.poolID = buffers.poolID;
+        allocation.bufferID = bufferID;
+        allocation.layerID = layerID;
 
         IPC::Message message;
-        IPC::BufferCommit::construct(message, commit);
+        IPC::BufferAllocation::construct(message, allocation);
         m_backend->ipc().sendMessage(IPC::Message::data(message), IPC::Message::size);
-        m_backend->ipc().sendFileDescriptor(syncFd);
+
+        while (true) {
+            int ret = AHardwareBuffer_sendHandleToUnixSocket(object, m_backend->ipc().socketFd());
+            if (!ret || ret != -EAGAIN)
+                break;
+        }
     }
+    buffer->locked = true;
+
+    IPC::LayerCommit commit;
+    commit.poolID = buffers.poolID;
+    commit.layerID = layerID;
+    commit.bufferID = bufferID;
+    commit.zOrder = int16_t(std::min(std::max(zOrder, int32_t(INT16_MIN)), int32_t(INT16_MAX)));
+    commit.x = int16_t(std::min(std::max(x, int32_t(INT16_MIN)), int32_t(INT16_MAX)));
+    commit.y = int16_t(std::min(std::max(y, int32_t(INT16_MIN)), int32_t(INT16_MAX)));
+    commit.width = uint16_t(std::min<uint32_t>(width, UINT16_MAX));
+    commit.height = uint16_t(std::min<uint32_t>(height, UINT16_MAX));
 
-    buffers.current->locked = true;
-    buffers.current = nullptr;
+    IPC::Message message;
+    IPC::LayerCommit::construct(message, commit);
+    if (fenceFD >= 0) {
+        m_backend->ipc().sendMessageWithFileDescriptor(IPC::Message::data(message), IPC::Message::size, fenceFD);
+        close(fenceFD);
+    } else
+        m_backend->ipc().sendMessage(IPC::Message::data(message), IPC::Message::size);
+    return true;
+}
+
+void EGLTarget::removeLayer(uint32_t layerID)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto it = std::find_if(layers.begin(), layers.end(), [layerID](const Layer& layer) { return layer.id == layerID; });
+    if (it == layers.end() || it->removed)
+        return;
+
+    IPC::LayerRemoval removal;
+    removal.poolID = buffers.poolID;
+    removal.layerID = layerID;
+
+    IPC::Message message;
+    IPC::LayerRemoval::construct(message, removal);
+    m_backend->ipc().sendMessage(IPC::Message::data(message), IPC::Message::size);
+
+    for (auto& buffer : it->buffers) {
+        if (buffer.object && !buffer.locked) {
+            AHardwareBuffer_release(buffer.object);
+            buffer.object = nullptr;
+        }
+    }
+    if (it->locked())
+        it->removed = true;
+    else
+        layers.erase(it);
+}
+
+void EGLTarget::releaseLayerBuffer(uint32_t poolID, uint32_t layerID, uint32_t bufferID, int releaseFenceFD)
+{
+    // Producers commit layers from threads of their own, the handler is called without the
+    // lock so that it can commit the next buffer right away.
+    std::unique_lock<std::mutex> lock(m_lock);
+    auto it = std::find_if(layers.begin(), layers.end(), [layerID](const Layer& layer) { return layer.id == layerID; });
+    if (buffers.poolID != poolID || it == layers.end() || bufferID >= it->buffers.size() || !it->buffers[bufferID].locked) {
+        if (releaseFenceFD != -1)
+            close(releaseFenceFD);
+        return;
+    }
+
+    auto& buffer = it->buffers[bufferID];
+    buffer.locked = false;
+
+    // Keeps its own reference for the handler, a removed layer drops the target's one.
+    AHardwareBuffer* object = buffer.object;
+    AHardwareBuffer_acquire(object);
+    if (it->removed) {
+        AHardwareBuffer_release(buffer.object);
+        buffer.object = nullptr;
+        if (!it->locked())
+            layers.erase(it);
+    }
+    auto handler = releaseLayerBufferHandler;
+    lock.unlock();
+
+    if (handler.func)
+        handler.func(handler.context, layerID, object, releaseFenceFD);
+    else if (releaseFenceFD != -1)
+        close(releaseFenceFD);
+    AHardwareBuffer_release(object);
+}
+
+void EGLTarget::setReleaseLayerBufferHandler(void* context, WPEAndroidRendererBackendEGLTarget_ReleaseLayerBuffer func)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    releaseLayerBufferHandler.context = context;
+    releaseLayerBufferHandler.func = func;
 }
 
 void EGLTarget::deinitialize()
 {
     ALOGD("EGLTarget::deinitialize()");
+    std::lock_guard<std::mutex> lock(m_lock);
+    deleteTrimmedGLObjects();
     destroyBufferPool(buffers.pool, renderer.destroyImageKHR);
 
-    if (renderer.framebuffer)
-        glDeleteFramebuffers(1, &renderer.framebuffer);
-    renderer.framebuffer = 0;
+    if (renderer.depthStencil.renderbuffer)
+        glDeleteRenderbuffers(1, &renderer.depthStencil.renderbuffer);
+    renderer.depthStencil = { };
 }
 
-void EGLTarget::releaseBuffer(uint32_t poolID, uint32_t bufferID)
+void EGLTarget::releaseBuffer(uint32_t poolID, uint32_t bufferID, int releaseFenceFD)
 {
-    if (buffers.poolID != poolID)
+    std::unique_lock<std::mutex> lock(m_lock);
+    if (buffers.poolID != poolID) {
+        if (releaseFenceFD != -1)
+            close(releaseFenceFD);
         return;
+    }
 
     for (auto& buffer : buffers.pool) {
         if (buffer.bufferID == bufferID) {
             buffer.locked = false;
+            if (buffer.releaseFenceFD != -1)
+                close(buffer.releaseFenceFD);
+            buffer.releaseFenceFD = releaseFenceFD;
+            releaseFenceFD = -1;
             break;
         }
     }
+    if (releaseFenceFD != -1)
+        close(releaseFenceFD);
+    m_bufferReleased.notify_one();
+
+    bool frameCompletePending = buffers.frameCompletePending;
+    buffers.frameCompletePending = false;
+    lock.unlock();
+
+    if (frameCompletePending)
+        wpe_renderer_backend_egl_target_dispatch_frame_complete(target);
+}
+
+void EGLTarget::adoptBuffer(uint32_t poolID, uint32_t bufferID, AHardwareBuffer* object, int releaseFenceFD)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    // The slot may have been allocated meanwhile, the UI process then replaces its buffer
+    // with the one from the BufferAllocation.
+    if (buffers.poolID != poolID || bufferID >= buffers.pool.size() || buffers.pool[bufferID].object) {
+        AHardwareBuffer_release(object);
+        if (releaseFenceFD != -1)
+            close(releaseFenceFD);
+        return;
+    }
+
+    AHardwareBuffer_Desc description;
+    AHardwareBuffer_describe(object, &description);
+
+    auto& buffer = buffers.pool[bufferID];
+    buffer.object = object;
+    buffer.width = description.width;
+    buffer.height = description.height;
+    buffer.hardwareBufferID = hardwareBufferID(object);
+    // Rendering waits for the previous user of the buffer to be done reading it.
+    buffer.releaseFenceFD = releaseFenceFD;
+    ALOGV("EGLTarget::adoptBuffer() poolID %u, bufferID %u, (%u,%u)", poolID, bufferID, buffer.width, buffer.height);
 }
 
 void EGLTarget::handleMessage(char* data, size_t size)
@@ -508,21 +1654,83 @@ struct wpe_renderer_backend_egl_target_interface android_renderer_backend_egl_ta
     },
 };
 
+extern "C" {
+
+__attribute__((visibility("default")))
+void WPEAndroidRendererBackendEGLTarget_addDamage(struct wpe_renderer_backend_egl_target* target,
+    int32_t x, int32_t y, int32_t width, int32_t height)
+{
+    if (auto* eglTarget = findEGLTarget(target))
+        eglTarget->addDamage(x, y, width, height);
+}
+
+__attribute__((visibility("default")))
+uint32_t WPEAndroidRendererBackendEGLTarget_getBufferAge(struct wpe_renderer_backend_egl_target* target)
+{
+    auto* eglTarget = findEGLTarget(target);
+    return eglTarget ? eglTarget->bufferAge() : 0;
+}
+
+__attribute__((visibility("default")))
+bool WPEAndroidRendererBackendEGLTarget_isProtected(struct wpe_renderer_backend_egl_target* target)
+{
+    auto* eglTarget = findEGLTarget(target);
+    return eglTarget && eglTarget->isProtected();
+}
+
+__attribute__((visibility("default")))
+bool WPEAndroidRendererBackendEGLTarget_supportsLayers(struct wpe_renderer_backend_egl_target* target)
+{
+    auto* eglTarget = findEGLTarget(target);
+    return eglTarget && eglTarget->supportsLayers();
+}
+
+__attribute__((visibility("default")))
+bool WPEAndroidRendererBackendEGLTarget_commitLayer(struct wpe_renderer_backend_egl_target* target, uint32_t layerID,
+    AHardwareBuffer* buffer, int fenceFD, int32_t x, int32_t y, uint32_t width, uint32_t height, int32_t zOrder)
+{
+    auto* eglTarget = findEGLTarget(target);
+    return eglTarget && eglTarget->commitLayer(layerID, buffer, fenceFD, x, y, width, height, zOrder);
+}
+
+__attribute__((visibility("default")))
+void WPEAndroidRendererBackendEGLTarget_removeLayer(struct wpe_renderer_backend_egl_target* target, uint32_t layerID)
+{
+    if (auto* eglTarget = findEGLTarget(target))
+        eglTarget->removeLayer(layerID);
+}
+
+__attribute__((visibility("default")))
+void WPEAndroidRendererBackendEGLTarget_setReleaseLayerBufferHandler(struct wpe_renderer_backend_egl_target* target,
+    void* context, WPEAndroidRendererBackendEGLTarget_ReleaseLayerBuffer func)
+{
+    if (auto* eglTarget = findEGLTarget(target))
+        eglTarget->setReleaseLayerBufferHandler(context, func);
+}
+
+} // extern "C"
+
 struct wpe_renderer_backend_egl_offscreen_target_interface android_renderer_backend_egl_offscreen_target_impl = {
     // create
     [] () -> void*
     {
-        return nullptr;
+        ALOGD("android_renderer_backend_egl_offscreen_target_impl::create()");
+        return new EGLOffscreenTarget;
     },
     // destroy
-    [] (void*)
-    { },
+    [] (void* data)
+    {
+        ALOGD("android_renderer_backend_egl_offscreen_target_impl::destroy()");
+        delete static_cast<EGLOffscreenTarget*>(data);
+    },
     // initialize
-    [] (void*, void*)
-    { },
+    [] (void* data, void*)
+    {
+        static_cast<EGLOffscreenTarget*>(data)->initialize();
+    },
     // get_native_window
-    [] (void*) -> EGLNativeWindowType
+    [] (void* data) -> EGLNativeWindowType
     {
-        return nullptr;
+        return static_cast<EGLOffscreenTarget*>(data)->nativeWindow();
     },
 };
@@ -3,10 +3,18 @@
 #include <array>
 #include <cstdint>
 #include <memory>
+#include <mutex>
 #include <sys/types.h>
 #include <unordered_map>
 #include <vector>
 
+#include <wpe-android/view-backend.h>
+
+#include "frame-recorder.h"
+#include "ipc.h"
+#include "ipc-messages.h"
+#include "slot-table.h"
+
 struct AHardwareBuffer;
 
 namespace WPEAndroid {
@@ -17,47 +25,123 @@ class ViewBackend;
 
 class Buffer {
 public:
-    Buffer(AHardwareBuffer* hardwareBuffer, uint32_t poolID, uint32_t bufferID);
+    Buffer(AHardwareBuffer* hardwareBuffer, RendererHostClientProxy* client, uint32_t poolID, uint32_t bufferID);
     ~Buffer();
 
     AHardwareBuffer* hardwareBuffer() const { return m_hardwareBuffer; }
+    RendererHostClientProxy* client() const { return m_client; }
     uint32_t bufferID() const { return m_bufferID; }
     uint32_t poolID() const { return m_poolID; }
 
+    // 0 for the buffers the page is rendered into, see BufferPool::Layer.
+    uint32_t layerID() const { return m_layerID; }
+    void setLayerID(uint32_t layerID) { m_layerID = layerID; }
+
+    uint32_t contentWidth() const { return m_contentWidth; }
+    uint32_t contentHeight() const { return m_contentHeight; }
+    void setContentSize(uint32_t width, uint32_t height) { m_contentWidth = width; m_contentHeight = height; }
+
     bool locked() const { return m_locked; }
     void setLocked(bool locked) { m_locked = locked; }
 
     bool pendingDelete() const { return m_pendingDelete; }
     void setSPendingDelete(bool pendingDelete) { m_pendingDelete = pendingDelete; }
 
+    // Collected by FrameStats for the frame currently held by the application.
+    struct Timing {
+        uint64_t renderedTime { 0 };
+        uint64_t commitTime { 0 };
+        int fenceFD { -1 };
+    };
+    Timing& timing() { return m_timing; }
+
+    // A duplicate of the fence the buffer was last released with, handed on along with the
+    // buffer when another pool adopts it. Replacing it closes the previous one.
+    int releaseFenceFD() const { return m_releaseFenceFD; }
+    void setReleaseFenceFD(int);
+    int takeReleaseFenceFD();
+
+    struct Rect {
+        int32_t x;
+        int32_t y;
+        int32_t width;
+        int32_t height;
+    };
+
+    // Changed since the previous frame of the pool, no rectangles mean everything changed.
+    // BufferDamage adds to the frame which is committed next, a commit without any resets it.
+    const Rect* damageRects() const { return m_damageRects.data(); }
+    uint32_t damageRectCount() const { return m_damageRectCount; }
+    void addDamage(const Rect&);
+    void commitDamage();
+
 private:
 
     AHardwareBuffer* m_hardwareBuffer;
+    RendererHostClientProxy* m_client;
     uint32_t m_bufferID;
     uint32_t m_poolID;
+    uint32_t m_layerID { 0 };
+    uint32_t m_contentWidth;
+    uint32_t m_contentHeight;
     bool m_locked;
     bool m_pendingDelete;
+    Timing m_timing;
+    int m_releaseFenceFD { -1 };
+
+    std::array<Rect, IPC::maxDamageRects> m_damageRects;
+    uint32_t m_damageRectCount { 0 };
+    bool m_damagePending { false };
 };
 
 class BufferPool {
 public:
-    BufferPool(uint32_t id, RendererHostClientProxy* client);
+    BufferPool(uint32_t id, RendererHostClientProxy* client, uint32_t bufferCount);
 
     uint32_t id() const { return m_id; }
 
     RendererHostClientProxy* client() const { return m_client; }
 
-    size_t size() const { return m_buffers.size(); }
+    // Set while the pool is registered with a view backend through RegisterPool.
+    ViewBackend* viewBackend() const { return m_viewBackend; }
+    void setViewBackend(ViewBackend* viewBackend) { m_viewBackend = viewBackend; }
+
+    // A buffer was committed to the view backend and the web process waits for its FrameComplete.
+    bool frameCompletePending() const { return m_frameCompletePending; }
+    void setFrameCompletePending(bool pending) { m_frameCompletePending = pending; }
+
+    // AHardwareBuffer format and extra usage of the buffers, see IPC::PoolUsageChange.
+    uint32_t bufferFormat() const { return m_bufferFormat; }
+    uint32_t bufferUsage() const { return m_bufferUsage; }
+    void setBufferFormat(uint32_t format, uint32_t usage) { m_bufferFormat = format; m_bufferUsage = usage; }
+
+    size_t size() const { return m_size; }
 
     Buffer* getBuffer(int bufferId) const { return m_buffers[bufferId]; }
     void setBuffer(int bufferId, Buffer* buffer) { m_buffers[bufferId] = buffer; }
 
     Buffer* releaseBuffer(int bufferId);
 
+    // Buffers the web process shows beside the page content, with their own slots.
+    struct Layer {
+        WPEAndroidLayer geometry;
+        std::array<Buffer*, IPC::maxLayerBufferCount> buffers;
+    };
+    std::vector<Layer>& layers() { return m_layers; }
+    Layer* findLayer(uint32_t layerID);
+    // Returns nullptr once the pool has as many layers as it can have.
+    Layer* addLayer(uint32_t layerID);
+
 private:
     uint32_t m_id;
     RendererHostClientProxy* m_client;
-    std::array<Buffer*, 4> m_buffers;
+    ViewBackend* m_viewBackend { nullptr };
+    bool m_frameCompletePending { false };
+    uint32_t m_bufferFormat { 0 };
+    uint32_t m_bufferUsage { 0 };
+    std::array<Buffer*, IPC::maxPoolBufferCount> m_buffers;
+    size_t m_size;
+    std::vector<Layer> m_layers;
 };
 
 class RendererHost final {
@@ -66,9 +150,35 @@ public:
 
     static RendererHost& instance();
 
+    IPC::Transport ipcTransport() const { return m_ipcTransport; }
+    void setIPCTransport(IPC::Transport transport) { m_ipcTransport = transport; }
+
+    bool messageRingEnabled() const { return m_messageRingEnabled; }
+    void setMessageRingEnabled(bool enabled) { m_messageRingEnabled = enabled; }
+
+    bool ipcThreadEnabled() const { return m_ipcThreadEnabled; }
+    void setIPCThreadEnabled(bool enabled) { m_ipcThreadEnabled = enabled; }
+
+    // Off until started through WPEAndroidRendererHost_startRecording().
+    FrameRecorder& recorder() { return m_recorder; }
+
+    // Context the client sockets are dispatched from, null for the thread default one.
+    GMainContext* ipcContext();
+
+    // Guards all pool, buffer and view backend state once client messages are handled on
+    // the IPC thread. Recursive since commit handlers may release buffers right away.
+    std::recursive_mutex& lock() { return m_lock; }
+
     int createClient();
 
-    uint32_t createBufferPool(RendererHostClientProxy* client);
+    // Called once the web process has gone away and the client has released its pools.
+    void removeClient(RendererHostClientProxy*);
+
+    // IDs are reserved ahead for the web process to construct pools under without a round trip,
+    // they resolve to no pool until one is registered under them.
+    uint32_t reserveBufferPoolID();
+    void registerBufferPool(BufferPool*);
+    void unregisterBufferPool(uint32_t);
 
     BufferPool* findBufferPool(uint32_t);
 
@@ -77,18 +187,69 @@ public:
 
     ViewBackend* findViewBackend(uint32_t);
 
-    void releaseBuffer(Buffer* buffer);
-    void frameComplete();
+    void registerViewBackendToken(uint64_t token, ViewBackend* viewBackend);
+    void unregisterViewBackendToken(uint64_t token);
+
+    ViewBackend* findViewBackendByToken(uint64_t);
+
+    // The web process waits for the optional release fence before rendering into the buffer
+    // again, ownership of the descriptor is taken.
+    void releaseBuffer(Buffer* buffer, int releaseFenceFD = -1);
+    // Completes the frame of every given pool with a commit outstanding.
+    void frameComplete(const std::vector<uint32_t>& poolIds);
+    // Has the web process free the unused buffers of the given pools, see IPC::TrimMemory.
+    void trimMemory(const std::vector<uint32_t>& poolIds, uint32_t keepBufferCount);
+
+    // Buffers left behind by a pool which went away are kept for a while, so that the next
+    // pool of the same view and web process can adopt them instead of allocating. Contents
+    // never cross over to another web process. The cache holds a reference of its own and
+    // takes over the release fence, which goes along with the buffer when it is taken.
+    void cacheBuffer(ViewBackend*, const BufferPool&, AHardwareBuffer*, int releaseFenceFD);
+    AHardwareBuffer* takeCachedBuffer(ViewBackend*, const BufferPool&, int& releaseFenceFD);
+    void dropCachedBuffers(ViewBackend*);
+    void dropCachedBuffers(RendererHostClientProxy*);
 
 private:
 
-    // (poolId -> BufferPool)
-    std::unordered_map<uint32_t, BufferPool*> m_bufferPoolMap;
+    void expireCachedBuffers();
 
-    // (poolId -> ViewBackend)
-    std::unordered_map<uint32_t, ViewBackend*> m_viewBackendMap;
+    static gpointer ipcThreadMain(gpointer);
+
+    IPC::Transport m_ipcTransport { IPC::Transport::Stream };
+    bool m_messageRingEnabled { false };
+    bool m_ipcThreadEnabled { false };
+
+    std::recursive_mutex m_lock;
+
+    FrameRecorder m_recorder;
+
+    struct {
+        GMainContext* context { nullptr };
+        GMainLoop* loop { nullptr };
+        GThread* thread { nullptr };
+    } m_ipcThread;
+
+    // (poolId -> BufferPool), pools also point to the view backend they are registered with.
+    IPC::SlotTable<BufferPool> m_bufferPools;
+
+    // (IPC::Host::clientToken() -> ViewBackend)
+    std::unordered_map<uint64_t, ViewBackend*> m_viewBackendTokenMap;
 
     std::vector<RendererHostClientProxy*> m_clients;
+
+    struct CachedBuffer {
+        ViewBackend* viewBackend;
+        RendererHostClientProxy* client;
+        AHardwareBuffer* hardwareBuffer;
+        int releaseFenceFD;
+        uint32_t width;
+        uint32_t height;
+        uint32_t format;
+        uint32_t usage;
+        uint64_t cachedTime;
+    };
+    static void releaseCachedBuffer(const CachedBuffer&);
+    std::vector<CachedBuffer> m_bufferCache;
 };
 
 } // namespace WPEAndroid
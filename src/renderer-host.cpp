@@ -1,21 +1,24 @@
 #include "renderer-host-private.h"
 
+#include <algorithm>
 #include <android/hardware_buffer.h>
 #include <cstdint>
 #include <memory>
 #include <unistd.h>
+#include <wpe-android/renderer-host.h>
 #include <wpe-android/view-backend.h>
 
 #include "interfaces.h"
 #include "ipc.h"
 #include "ipc-messages.h"
+#include "ipc-ring.h"
 #include "logging.h"
+#include "slab.h"
+#include "tracing.h"
 #include "view-backend-private.h"
 
 namespace WPEAndroid {
 
-uint32_t m_lastExportedPoolID = 0;
-
 class RendererHostClientProxy final : public IPC::Host::Handler {
 public:
     RendererHostClientProxy(RendererHost& host);
@@ -25,42 +28,150 @@ public:
 
     IPC::Host& ipc() { return m_ipcHost; }
 
+    // Sends a message which carries no file descriptors and doesn't need to stay ordered
+    // with the rest of the socket traffic, through the message ring when there is one.
+    void sendControlMessage(IPC::Message&);
+
+    // Messages which have to stay ordered with the rest of the socket traffic.
+    void sendMessage(IPC::Message&);
+
+    // Messages carrying a file descriptor always take the socket, the descriptor is closed.
+    void sendMessageWithFileDescriptor(IPC::Message&, int fd);
+
+    // Gives the buffer back to the web process along with the optional release fence.
+    void sendRelease(const Buffer&, int releaseFenceFD);
+
+    // Buffers and pools are carved out of per-client slabs, which go away all at once
+    // along with the client after the web process has disconnected.
+    Buffer* createBuffer(AHardwareBuffer*, uint32_t poolID, uint32_t bufferID);
+    void destroyBuffer(Buffer*);
+
+    // Hands the buffers of a pool leaving the view which aren't in use to the host cache.
+    void cacheBuffers(BufferPool&, ViewBackend*);
+    // Fills the empty slots of a pool from the buffers cached for the view.
+    void adoptCachedBuffers(BufferPool&, ViewBackend*);
+
+    bool disconnected() const { return m_disconnected; }
+    bool hasLockedBuffers();
+
 private:
 
-    void constructPool();
+    void disconnect();
+
+    void reservePoolIDs(uint32_t count);
+    void constructPool(uint64_t viewToken, uint32_t poolID);
     void purgePool(uint32_t poolId);
-    void bufferAllocation(AHardwareBuffer* buffer, uint32_t, uint32_t);
-    void bufferCommit(uint32_t, uint32_t, int);
+    void bufferAllocation(AHardwareBuffer* buffer, uint32_t, uint32_t, uint32_t layerID);
+    void bufferDestruction(const IPC::BufferDestruction&);
+    void layerCommit(const IPC::LayerCommit&, int fenceFD);
+    void layerRemoval(const IPC::LayerRemoval&);
+    void removeLayerBuffers(BufferPool::Layer&);
+    void bufferDamage(const IPC::BufferDamage&);
+    void bufferWait(const IPC::BufferWait&);
+    void bufferCommit(const IPC::BufferCommit&, int fenceFD);
 
     // IPC::Host::Handle
     void handleMessage(char*, size_t) override;
+    void connectionClosed() override;
+    bool readyForMessage() override;
+
+    // Reads the buffer handle following a BufferAllocation off the socket, false while it
+    // hasn't arrived yet.
+    bool receivePendingAllocation();
 
     RendererHost& m_host;
 
     IPC::Host m_ipcHost;
+
+    std::unique_ptr<IPC::MessageRing> m_messageRing;
+
+    Slab<Buffer> m_buffers;
+    Slab<BufferPool> m_bufferPools;
+    std::vector<uint32_t> m_reservedPoolIDs;
+    bool m_disconnected { false };
+
+    // A BufferAllocation whose buffer handle is still on its way.
+    bool m_allocationPending { false };
+    IPC::BufferAllocation m_pendingAllocation;
+
+    // Tells the connection apart in frame recordings.
+    uint32_t m_recordingID;
 };
 
+// Pool IDs a web process has at hand, enough for the targets of a process swap.
+static const uint32_t reservedPoolIDCount = 2;
+
 // Buffer
 
-Buffer::Buffer(AHardwareBuffer* hardwareBuffer, uint32_t poolID, uint32_t bufferID) {
+Buffer::Buffer(AHardwareBuffer* hardwareBuffer, RendererHostClientProxy* client, uint32_t poolID, uint32_t bufferID) {
     // Buffer has been received from socket and ref count has been increased
     // by AHardwareBuffer_recvHandleFromUnixSocket
     m_hardwareBuffer = hardwareBuffer;
+    m_client = client;
     m_poolID = poolID;
     m_bufferID = bufferID;
+    m_contentWidth = 0;
+    m_contentHeight = 0;
     m_locked = false;
     m_pendingDelete = false;
 }
 
 Buffer::~Buffer() {
+    if (m_timing.fenceFD != -1)
+        close(m_timing.fenceFD);
+    if (m_releaseFenceFD != -1)
+        close(m_releaseFenceFD);
     AHardwareBuffer_release(m_hardwareBuffer);
 }
 
+void Buffer::setReleaseFenceFD(int releaseFenceFD)
+{
+    if (m_releaseFenceFD != -1)
+        close(m_releaseFenceFD);
+    m_releaseFenceFD = releaseFenceFD;
+}
+
+int Buffer::takeReleaseFenceFD()
+{
+    int releaseFenceFD = m_releaseFenceFD;
+    m_releaseFenceFD = -1;
+    return releaseFenceFD;
+}
+
+void Buffer::addDamage(const Rect& rect)
+{
+    if (!m_damagePending) {
+        m_damagePending = true;
+        m_damageRectCount = 0;
+    }
+
+    if (m_damageRectCount < m_damageRects.size()) {
+        m_damageRects[m_damageRectCount++] = rect;
+        return;
+    }
+
+    // More than the web process should ever send, keep the region covered anyway.
+    auto& last = m_damageRects[m_damageRectCount - 1];
+    int32_t x = std::min(last.x, rect.x);
+    int32_t y = std::min(last.y, rect.y);
+    last.width = std::max(last.x + last.width, rect.x + rect.width) - x;
+    last.height = std::max(last.y + last.height, rect.y + rect.height) - y;
+    last.x = x;
+    last.y = y;
+}
+
+void Buffer::commitDamage()
+{
+    if (!m_damagePending)
+        m_damageRectCount = 0;
+    m_damagePending = false;
+}
+
 // BufferPool
 
-BufferPool::BufferPool(uint32_t id, RendererHostClientProxy* client)
-    : m_id(id), m_client(client) {
-    m_buffers = { nullptr, nullptr, nullptr, nullptr };
+BufferPool::BufferPool(uint32_t id, RendererHostClientProxy* client, uint32_t bufferCount)
+    : m_id(id), m_client(client), m_size(std::min<size_t>(bufferCount, IPC::maxPoolBufferCount)) {
+    m_buffers.fill(nullptr);
 }
 
 Buffer* BufferPool::releaseBuffer(int bufferId) {
@@ -69,6 +180,25 @@ Buffer* BufferPool::releaseBuffer(int bufferId) {
     return buffer;
 }
 
+BufferPool::Layer* BufferPool::findLayer(uint32_t layerID) {
+    for (auto& layer : m_layers) {
+        if (layer.geometry.id == layerID)
+            return &layer;
+    }
+    return nullptr;
+}
+
+BufferPool::Layer* BufferPool::addLayer(uint32_t layerID) {
+    if (m_layers.size() >= IPC::maxPoolLayers)
+        return nullptr;
+
+    Layer layer;
+    layer.geometry = { layerID, { 0, 0, 0, 0 }, 0 };
+    layer.buffers.fill(nullptr);
+    m_layers.push_back(layer);
+    return &m_layers.back();
+}
+
 // RendereHost
 
 RendererHost::RendererHost() = default;
@@ -78,91 +208,326 @@ RendererHost& RendererHost::instance() {
     return host;
 }
 
+GMainContext* RendererHost::ipcContext() {
+    if (!m_ipcThreadEnabled)
+        return nullptr;
+
+    // Started along with the first client and kept running for the lifetime of the process,
+    // like the renderer host itself.
+    if (!m_ipcThread.context) {
+        m_ipcThread.context = g_main_context_new();
+        m_ipcThread.loop = g_main_loop_new(m_ipcThread.context, FALSE);
+        m_ipcThread.thread = g_thread_new("WPEBackend-android::ipc", ipcThreadMain, this);
+    }
+    return m_ipcThread.context;
+}
+
+gpointer RendererHost::ipcThreadMain(gpointer data) {
+    auto& host = *static_cast<RendererHost*>(data);
+
+    g_main_context_push_thread_default(host.m_ipcThread.context);
+    g_main_loop_run(host.m_ipcThread.loop);
+    g_main_context_pop_thread_default(host.m_ipcThread.context);
+    return nullptr;
+}
+
 // There's one client created per webprocess
 int RendererHost::createClient() {
     ALOGD("RendererHost::createClient()");
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
 
     auto* clientProxy = new RendererHostClientProxy(*this);
     m_clients.push_back(clientProxy);
     return clientProxy->releaseClientFD();
 }
 
-uint32_t RendererHost::createBufferPool(RendererHostClientProxy* client) {
-    ALOGD("RendererHost::createBufferPool()");
-    static uint32_t poolID = 0;
+void RendererHost::removeClient(RendererHostClientProxy* client) {
+    ALOGD("RendererHost::removeClient()");
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+
+    auto it = std::find(m_clients.begin(), m_clients.end(), client);
+    if (it != m_clients.end())
+        m_clients.erase(it);
+
+    // Otherwise the client goes away with the last buffer the application gives back.
+    if (!client->hasLockedBuffers())
+        delete client;
+}
+
+uint32_t RendererHost::reserveBufferPoolID() {
+    return m_bufferPools.insert(nullptr);
+}
+
+void RendererHost::registerBufferPool(BufferPool* bufferPool) {
+    ALOGD("RendererHost::registerBufferPool() poolID %" PRIu32 ", bufferCount %zu", bufferPool->id(), bufferPool->size());
 
-    auto* bufferPool = new BufferPool(poolID++, client);
-    m_bufferPoolMap.insert({ bufferPool->id(), bufferPool });
-    return bufferPool->id();
+    m_bufferPools.set(bufferPool->id(), bufferPool);
+}
+
+void RendererHost::unregisterBufferPool(uint32_t poolID) {
+    m_bufferPools.remove(poolID);
 }
 
 BufferPool* RendererHost::findBufferPool(uint32_t poolID) {
-    auto it = m_bufferPoolMap.find(poolID);
-    if (it == m_bufferPoolMap.end()) {
+    auto* bufferPool = m_bufferPools.get(poolID);
+    if (!bufferPool)
         ALOGW("RendererHost::findBufferPool(): " "Cannot find buffer pool with poolId %" PRIu32 " in render host.", poolID);
-        return nullptr;
-    }
-    return it->second;
+    return bufferPool;
 }
 
 void RendererHost::registerViewBackend(uint32_t poolId, ViewBackend* viewBackend) {
-    m_viewBackendMap.insert({ poolId, viewBackend });
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+
+    auto* bufferPool = findBufferPool(poolId);
+    if (bufferPool)
+        bufferPool->setViewBackend(viewBackend);
 }
 
 void RendererHost::unregisterViewBackend(uint32_t poolId) {
-    auto it = m_viewBackendMap.find(poolId);
-    if (it != m_viewBackendMap.end()) {
-        m_viewBackendMap.erase(it);
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+
+    auto* bufferPool = m_bufferPools.get(poolId);
+    if (!bufferPool)
+        return;
+
+    auto* viewBackend = bufferPool->viewBackend();
+    bufferPool->setViewBackend(nullptr);
+    if (!viewBackend)
+        return;
+
+    for (auto& layer : bufferPool->layers())
+        viewBackend->removeLayer(layer.geometry.id);
+
+    // A pool which the view keeps rendering with takes what this one leaves behind.
+    bufferPool->client()->cacheBuffers(*bufferPool, viewBackend);
+    for (uint32_t otherPoolId : viewBackend->poolIds()) {
+        auto* otherPool = m_bufferPools.get(otherPoolId);
+        if (otherPool && otherPool != bufferPool)
+            otherPool->client()->adoptCachedBuffers(*otherPool, viewBackend);
     }
 }
 
 ViewBackend* RendererHost::findViewBackend(uint32_t poolId) {
-    auto it = m_viewBackendMap.find(poolId);
-    if (it == m_viewBackendMap.end()) {
+    auto* bufferPool = m_bufferPools.get(poolId);
+    if (!bufferPool || !bufferPool->viewBackend()) {
         ALOGW("RendererHost::findViewBackend(): " "Cannot find view backend with poolId %" PRIu32 " in render host.", poolId);
         return nullptr;
     }
+    return bufferPool->viewBackend();
+}
+
+void RendererHost::registerViewBackendToken(uint64_t token, ViewBackend* viewBackend) {
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+
+    m_viewBackendTokenMap[token] = viewBackend;
+}
+
+void RendererHost::unregisterViewBackendToken(uint64_t token) {
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+
+    auto it = m_viewBackendTokenMap.find(token);
+    if (it != m_viewBackendTokenMap.end()) {
+        m_viewBackendTokenMap.erase(it);
+    }
+}
+
+ViewBackend* RendererHost::findViewBackendByToken(uint64_t token) {
+    auto it = m_viewBackendTokenMap.find(token);
+    if (it == m_viewBackendTokenMap.end())
+        return nullptr;
     return it->second;
 }
 
-void RendererHost::releaseBuffer(Buffer* buffer) {
+void RendererHost::releaseBuffer(Buffer* buffer, int releaseFenceFD) {
+    WPE_ANDROID_TRACE_SCOPE("RendererHost::releaseBuffer");
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+
     buffer->setLocked(false);
 
+    auto* bufferPool = m_bufferPools.get(buffer->poolID());
+    if (bufferPool && bufferPool->viewBackend() && bufferPool->viewBackend()->androidBackend())
+        bufferPool->viewBackend()->androidBackend()->frameStats().bufferReleased(*buffer);
+
+    auto* client = buffer->client();
     if (buffer->pendingDelete()) {
-        delete buffer;
+        // Buffers of removed layers still belong to their producer in the web process.
+        if (buffer->layerID() && !client->disconnected()) {
+            client->sendRelease(*buffer, releaseFenceFD);
+            releaseFenceFD = -1;
+        }
+        if (releaseFenceFD >= 0)
+            close(releaseFenceFD);
+        client->destroyBuffer(buffer);
+        if (client->disconnected() && !client->hasLockedBuffers())
+            delete client;
         return;
     }
 
-    auto* bufferPool = findBufferPool(buffer->poolID());
+    // The buffer may be cached before the web process rendered into it again.
+    if (!buffer->layerID())
+        buffer->setReleaseFenceFD(releaseFenceFD >= 0 ? dup(releaseFenceFD) : -1);
+    client->sendRelease(*buffer, releaseFenceFD);
+}
+
+void RendererHost::frameComplete(const std::vector<uint32_t>& poolIds) {
+    WPE_ANDROID_TRACE_SCOPE("RendererHost::frameComplete");
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
 
-    IPC::ReleaseBuffer release;
-    release.poolID = buffer->poolID();
-    release.bufferID = buffer->bufferID();
+    uint64_t completeTime = monotonicTime();
+    for (uint32_t poolId : poolIds) {
+        auto* bufferPool = m_bufferPools.get(poolId);
+        if (!bufferPool || !bufferPool->frameCompletePending())
+            continue;
+        bufferPool->setFrameCompletePending(false);
 
-    IPC::Message message;
-    IPC::ReleaseBuffer::construct(message, release);
-    bufferPool->client()->ipc().sendMessage(IPC::Message::data(message), IPC::Message::size);
+        IPC::FrameComplete frameComplete;
+        frameComplete.poolID = poolId;
+        frameComplete.completeTime = completeTime;
+
+        IPC::Message message;
+        IPC::FrameComplete::construct(message, frameComplete);
+        bufferPool->client()->sendControlMessage(message);
+    }
 }
 
-void RendererHost::frameComplete() {
-    auto* bufferPool = findBufferPool(m_lastExportedPoolID);
+void RendererHost::trimMemory(const std::vector<uint32_t>& poolIds, uint32_t keepBufferCount) {
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
 
-    IPC::FrameComplete frameComplete;
-    frameComplete.poolID = m_lastExportedPoolID;
+    for (uint32_t poolId : poolIds) {
+        auto* bufferPool = m_bufferPools.get(poolId);
+        if (!bufferPool)
+            continue;
 
-    IPC::Message message;
-    IPC::FrameComplete::construct(message, frameComplete);
-    bufferPool->client()->ipc().sendMessage(IPC::Message::data(message), IPC::Message::size);
+        IPC::TrimMemory trim;
+        trim.poolID = poolId;
+        trim.keepBufferCount = keepBufferCount;
+
+        IPC::Message message;
+        IPC::TrimMemory::construct(message, trim);
+        bufferPool->client()->sendControlMessage(message);
+    }
+}
+
+static const size_t maxCachedBuffers = IPC::maxPoolBufferCount;
+// Ten seconds, in nanoseconds.
+static const uint64_t cachedBufferLifetime = 10000000000ull;
+
+static uint32_t bucketSize(uint32_t size, uint32_t bucket)
+{
+    if (!bucket)
+        return size;
+    return ((size + bucket - 1) / bucket) * bucket;
+}
+
+void RendererHost::cacheBuffer(ViewBackend* viewBackend, const BufferPool& bufferPool, AHardwareBuffer* hardwareBuffer, int releaseFenceFD) {
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+
+    expireCachedBuffers();
+    if (m_bufferCache.size() >= maxCachedBuffers) {
+        releaseCachedBuffer(m_bufferCache.front());
+        m_bufferCache.erase(m_bufferCache.begin());
+    }
+
+    AHardwareBuffer_Desc description;
+    AHardwareBuffer_describe(hardwareBuffer, &description);
+    m_bufferCache.push_back({ viewBackend, bufferPool.client(), hardwareBuffer, releaseFenceFD,
+        description.width, description.height, bufferPool.bufferFormat(), bufferPool.bufferUsage(), monotonicTime() });
+}
+
+AHardwareBuffer* RendererHost::takeCachedBuffer(ViewBackend* viewBackend, const BufferPool& bufferPool, int& releaseFenceFD) {
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+
+    expireCachedBuffers();
+
+    // The web process allocates for the size the view last showed a frame at, anything else
+    // would be replaced right away.
+    uint32_t bucket = viewBackend->androidBackend() ? viewBackend->androidBackend()->resizeBucket() : 0;
+    uint32_t width = bucketSize(viewBackend->frameWidth(), bucket);
+    uint32_t height = bucketSize(viewBackend->frameHeight(), bucket);
+
+    for (auto it = m_bufferCache.rbegin(); it != m_bufferCache.rend(); ++it) {
+        if (it->viewBackend != viewBackend || it->client != bufferPool.client()
+            || it->width != width || it->height != height
+            || it->format != bufferPool.bufferFormat() || it->usage != bufferPool.bufferUsage())
+            continue;
+
+        AHardwareBuffer* hardwareBuffer = it->hardwareBuffer;
+        releaseFenceFD = it->releaseFenceFD;
+        m_bufferCache.erase(std::next(it).base());
+        return hardwareBuffer;
+    }
+    return nullptr;
+}
+
+void RendererHost::dropCachedBuffers(ViewBackend* viewBackend) {
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+
+    auto it = std::remove_if(m_bufferCache.begin(), m_bufferCache.end(), [viewBackend] (const CachedBuffer& cachedBuffer) {
+        if (cachedBuffer.viewBackend != viewBackend)
+            return false;
+        releaseCachedBuffer(cachedBuffer);
+        return true;
+    });
+    m_bufferCache.erase(it, m_bufferCache.end());
+}
+
+void RendererHost::dropCachedBuffers(RendererHostClientProxy* client) {
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+
+    auto it = std::remove_if(m_bufferCache.begin(), m_bufferCache.end(), [client] (const CachedBuffer& cachedBuffer) {
+        if (cachedBuffer.client != client)
+            return false;
+        releaseCachedBuffer(cachedBuffer);
+        return true;
+    });
+    m_bufferCache.erase(it, m_bufferCache.end());
+}
+
+void RendererHost::expireCachedBuffers() {
+    uint64_t now = monotonicTime();
+    auto it = std::remove_if(m_bufferCache.begin(), m_bufferCache.end(), [now] (const CachedBuffer& cachedBuffer) {
+        if (now - cachedBuffer.cachedTime < cachedBufferLifetime)
+            return false;
+        releaseCachedBuffer(cachedBuffer);
+        return true;
+    });
+    m_bufferCache.erase(it, m_bufferCache.end());
+}
+
+void RendererHost::releaseCachedBuffer(const CachedBuffer& cachedBuffer) {
+    if (cachedBuffer.releaseFenceFD != -1)
+        close(cachedBuffer.releaseFenceFD);
+    AHardwareBuffer_release(cachedBuffer.hardwareBuffer);
 }
 
 // RendereHostClientProxy
 
 RendererHostClientProxy::RendererHostClientProxy(RendererHost& host)
-    : m_host(host) {
-    m_ipcHost.initialize(*this);
+    : m_host(host)
+    , m_recordingID(host.recorder().nextClientID()) {
+    m_ipcHost.initialize(*this, host.ipcTransport(), host.ipcContext());
+
+    if (host.messageRingEnabled()) {
+        m_messageRing.reset(new IPC::MessageRing);
+        if (m_messageRing->create(host.ipcContext())) {
+            // Queued in the socket before the web process even gets its end of it.
+            IPC::MessageRingSetup setup;
+
+            IPC::Message message;
+            IPC::MessageRingSetup::construct(message, setup);
+
+            int fds[3] = { m_messageRing->memoryFd(), m_messageRing->doorbellFd(), m_messageRing->spaceFd() };
+            m_ipcHost.sendMessageWithFileDescriptors(IPC::Message::data(message), IPC::Message::size, fds, 3);
+        } else
+            m_messageRing = nullptr;
+    }
+
+    reservePoolIDs(reservedPoolIDCount);
 }
 
 RendererHostClientProxy::~RendererHostClientProxy() {
+    // The cache only hands buffers back to the process they came from.
+    m_host.dropCachedBuffers(this);
     m_ipcHost.deinitialize();
 }
 
@@ -170,20 +535,247 @@ int RendererHostClientProxy::releaseClientFD() {
     return m_ipcHost.releaseClientFD(true);
 }
 
-void RendererHostClientProxy::constructPool()
+void RendererHostClientProxy::sendMessage(IPC::Message& message) {
+    if (m_host.recorder().recording())
+        m_host.recorder().record(FrameRecorder::Direction::ToWebProcess, m_recordingID, message);
+    m_ipcHost.sendMessage(IPC::Message::data(message), IPC::Message::size);
+}
+
+void RendererHostClientProxy::sendControlMessage(IPC::Message& message) {
+    if (m_host.recorder().recording())
+        m_host.recorder().record(FrameRecorder::Direction::ToWebProcess, m_recordingID, message);
+    if (m_messageRing) {
+        m_messageRing->push(message);
+        return;
+    }
+    m_ipcHost.sendMessage(IPC::Message::data(message), IPC::Message::size);
+}
+
+void RendererHostClientProxy::sendMessageWithFileDescriptor(IPC::Message& message, int fd) {
+    if (m_host.recorder().recording())
+        m_host.recorder().record(FrameRecorder::Direction::ToWebProcess, m_recordingID, message);
+    m_ipcHost.sendMessageWithFileDescriptor(IPC::Message::data(message), IPC::Message::size, fd);
+    close(fd);
+}
+
+void RendererHostClientProxy::sendRelease(const Buffer& buffer, int releaseFenceFD) {
+    IPC::ReleaseBuffer release;
+    release.poolID = buffer.poolID();
+    release.bufferID = buffer.bufferID();
+    release.releaseTime = monotonicTime();
+    release.layerID = buffer.layerID();
+
+    IPC::Message message;
+    IPC::ReleaseBuffer::construct(message, release);
+    if (releaseFenceFD >= 0)
+        sendMessageWithFileDescriptor(message, releaseFenceFD);
+    else
+        sendControlMessage(message);
+}
+
+Buffer* RendererHostClientProxy::createBuffer(AHardwareBuffer* hardwareBuffer, uint32_t poolID, uint32_t bufferID) {
+    return m_buffers.create(hardwareBuffer, this, poolID, bufferID);
+}
+
+void RendererHostClientProxy::destroyBuffer(Buffer* buffer) {
+    m_buffers.destroy(buffer);
+}
+
+bool RendererHostClientProxy::hasLockedBuffers() {
+    bool locked = false;
+    m_buffers.forEach([&locked](Buffer* buffer) { locked |= buffer->locked(); });
+    return locked;
+}
+
+void RendererHostClientProxy::disconnect() {
+    ALOGD("RendererHostClientProxy::disconnect()");
+    m_disconnected = true;
+
+    if (m_host.recorder().recording())
+        m_host.recorder().clientDisconnected(m_recordingID);
+
+    // Buffers still held by the application stay around until they are given back,
+    // everything else is reclaimed right away.
+    m_bufferPools.forEach([this](BufferPool* bufferPool) {
+        m_host.unregisterBufferPool(bufferPool->id());
+
+        for (size_t i = 0; i < bufferPool->size(); i++) {
+            auto* buffer = bufferPool->releaseBuffer(i);
+            if (!buffer)
+                continue;
+
+            if (buffer->locked())
+                buffer->setSPendingDelete(true);
+            else
+                destroyBuffer(buffer);
+        }
+        for (auto& layer : bufferPool->layers())
+            removeLayerBuffers(layer);
+    });
+    m_bufferPools.clear();
+
+    for (uint32_t poolID : m_reservedPoolIDs)
+        m_host.unregisterBufferPool(poolID);
+    m_reservedPoolIDs.clear();
+
+    m_messageRing = nullptr;
+}
+
+void RendererHostClientProxy::connectionClosed() {
+    std::lock_guard<std::recursive_mutex> lock(m_host.lock());
+
+    disconnect();
+    m_host.removeClient(this);
+}
+
+bool RendererHostClientProxy::readyForMessage() {
+    std::lock_guard<std::recursive_mutex> lock(m_host.lock());
+
+    return !m_allocationPending || receivePendingAllocation();
+}
+
+bool RendererHostClientProxy::receivePendingAllocation()
 {
-    uint32_t poolID = m_host.createBufferPool(this);
+    AHardwareBuffer* buffer = nullptr;
+    int ret = AHardwareBuffer_recvHandleFromUnixSocket(m_ipcHost.socketFd(), &buffer);
+    if (ret == -EAGAIN)
+        return false;
+
+    ALOGV("  BufferAllocation: ret %d, buffer %p\n", ret, buffer);
+    m_allocationPending = false;
+    bufferAllocation(buffer, m_pendingAllocation.poolID, m_pendingAllocation.bufferID, m_pendingAllocation.layerID);
+    return true;
+}
+
+void RendererHostClientProxy::reservePoolIDs(uint32_t count)
+{
+    IPC::PoolIDReservation reservation;
+    reservation.count = std::min<uint32_t>(count, G_N_ELEMENTS(reservation.poolIDs));
+    for (uint32_t i = 0; i < reservation.count; ++i) {
+        reservation.poolIDs[i] = m_host.reserveBufferPoolID();
+        m_reservedPoolIDs.push_back(reservation.poolIDs[i]);
+    }
+
+    IPC::Message message;
+    IPC::PoolIDReservation::construct(message, reservation);
+    sendMessage(message);
+}
+
+void RendererHostClientProxy::constructPool(uint64_t viewToken, uint32_t poolID)
+{
+    auto it = std::find(m_reservedPoolIDs.begin(), m_reservedPoolIDs.end(), poolID);
+    if (it == m_reservedPoolIDs.end()) {
+        ALOGE("RendererHostClientProxy: PoolConstruction with unreserved poolID %" PRIu32, poolID);
+        return;
+    }
+    m_reservedPoolIDs.erase(it);
+
+    // The pool is not registered with its view backend until RegisterPool arrives on the view
+    // socket, so the socket token is what ties the pool to the per-view configuration here.
+    uint32_t bufferCount = IPC::defaultPoolBufferCount;
+    uint32_t resizeBucket = 0;
+    uint32_t usage = 0;
+    uint32_t format = AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM;
+    uint16_t flags = IPC::PoolDepthStencil;
+    uint32_t releaseWaitTimeout = 0;
+    auto* viewBackend = m_host.findViewBackendByToken(viewToken);
+    if (viewBackend && viewBackend->androidBackend()) {
+        auto& androidBackend = *viewBackend->androidBackend();
+        bufferCount = androidBackend.bufferCount();
+        resizeBucket = androidBackend.resizeBucket();
+        if (androidBackend.hasReadbackCallback())
+            usage |= AHARDWAREBUFFER_USAGE_CPU_READ_OFTEN;
+        else if (androidBackend.protectedContentEnabled())
+            usage |= AHARDWAREBUFFER_USAGE_PROTECTED_CONTENT;
+        format = androidBackend.bufferFormat();
+        if (!androidBackend.depthStencilEnabled())
+            flags &= ~IPC::PoolDepthStencil;
+        releaseWaitTimeout = androidBackend.bufferReleaseTimeout();
+        if (viewBackend->acceptsLayers())
+            flags |= IPC::PoolLayers;
+    }
+    bufferCount = std::min(std::max(bufferCount, IPC::minPoolBufferCount), IPC::maxPoolBufferCount);
+
+    auto* bufferPool = m_bufferPools.create(poolID, this, bufferCount);
+    bufferPool->setBufferFormat(format, usage);
+    m_host.registerBufferPool(bufferPool);
+
+    // RegisterPool travels on the view socket and may well have been handled already.
+    if (viewBackend) {
+        auto& poolIds = viewBackend->poolIds();
+        if (std::find(poolIds.begin(), poolIds.end(), poolID) != poolIds.end())
+            bufferPool->setViewBackend(viewBackend);
+    }
 
     IPC::PoolConstructionReply poolConstructionReply;
     poolConstructionReply.poolID = poolID;
+    poolConstructionReply.bufferCount = bufferCount;
+    poolConstructionReply.resizeBucket = resizeBucket;
+    poolConstructionReply.usage = usage;
+    poolConstructionReply.format = format;
+    poolConstructionReply.flags = flags;
+    poolConstructionReply.releaseWaitTimeout = std::min<uint32_t>(releaseWaitTimeout, UINT16_MAX);
 
     IPC::Message message;
     IPC::PoolConstructionReply::construct(message, poolConstructionReply);
-    m_ipcHost.sendMessage(IPC::Message::data(message), IPC::Message::size);
+    sendMessage(message);
+
+    if (viewBackend)
+        adoptCachedBuffers(*bufferPool, viewBackend);
+
+    reservePoolIDs(1);
+}
+
+void RendererHostClientProxy::cacheBuffers(BufferPool& bufferPool, ViewBackend* viewBackend)
+{
+    for (size_t i = 0; i < bufferPool.size(); ++i) {
+        auto* buffer = bufferPool.getBuffer(i);
+        if (!buffer || buffer->locked())
+            continue;
+
+        AHardwareBuffer_acquire(buffer->hardwareBuffer());
+        m_host.cacheBuffer(viewBackend, bufferPool, buffer->hardwareBuffer(), buffer->takeReleaseFenceFD());
+        destroyBuffer(bufferPool.releaseBuffer(i));
+    }
+}
+
+void RendererHostClientProxy::adoptCachedBuffers(BufferPool& bufferPool, ViewBackend* viewBackend)
+{
+    if (m_disconnected)
+        return;
+
+    for (size_t i = 0; i < bufferPool.size(); ++i) {
+        if (bufferPool.getBuffer(i))
+            continue;
+
+        int releaseFenceFD = -1;
+        AHardwareBuffer* hardwareBuffer = m_host.takeCachedBuffer(viewBackend, bufferPool, releaseFenceFD);
+        if (!hardwareBuffer)
+            break;
+
+        // Should the web process have allocated this slot meanwhile, its BufferAllocation
+        // replaces the adopted buffer and the adoption is dropped on the other side.
+        bufferPool.setBuffer(i, createBuffer(hardwareBuffer, bufferPool.id(), i));
+
+        IPC::BufferAdoption adoption;
+        adoption.poolID = bufferPool.id();
+        adoption.bufferID = i;
+
+        // The application may still be reading the buffer until the fence signals.
+        IPC::Message message;
+        IPC::BufferAdoption::construct(message, adoption);
+        if (releaseFenceFD >= 0)
+            sendMessageWithFileDescriptor(message, releaseFenceFD);
+        else
+            sendMessage(message);
+        m_ipcHost.sendHardwareBuffer(hardwareBuffer);
+    }
 }
 
 void RendererHostClientProxy::purgePool(uint32_t poolId) {
     auto* bufferPool = m_host.findBufferPool(poolId);
+    if (!bufferPool || bufferPool->client() != this)
+        return;
 
     for(int i=0; i<bufferPool->size(); i++) {
         auto* buffer = bufferPool->getBuffer(i);
@@ -191,51 +783,198 @@ void RendererHostClientProxy::purgePool(uint32_t poolId) {
             if (buffer->locked()) {
                 buffer->setSPendingDelete(true);
             } else {
-                delete buffer;
+                destroyBuffer(buffer);
             }
             bufferPool->setBuffer(i, nullptr);
         }
     }
 }
 
-void RendererHostClientProxy::bufferAllocation(AHardwareBuffer* hardwareBuffer, uint32_t poolID, uint32_t bufferID)
+void RendererHostClientProxy::bufferAllocation(AHardwareBuffer* hardwareBuffer, uint32_t poolID, uint32_t bufferID, uint32_t layerID)
 {
     auto* bufferPool = m_host.findBufferPool(poolID);
 
-    if (bufferID >= bufferPool->size()) {
+    // Buffers come from this client's slab, so they can only go into pools of its own.
+    BufferPool::Layer* layer = nullptr;
+    bool valid = bufferPool && bufferPool->client() == this;
+    if (valid && layerID) {
+        layer = bufferPool->findLayer(layerID);
+        if (!layer)
+            layer = bufferPool->addLayer(layerID);
+        valid = layer && bufferID < layer->buffers.size();
+    } else if (valid)
+        valid = bufferID < bufferPool->size();
+    if (!valid) {
         if (hardwareBuffer)
             AHardwareBuffer_release(hardwareBuffer);
         return;
     }
 
-    auto* oldBuffer = bufferPool->releaseBuffer(bufferID);
-    if (oldBuffer)
-        delete oldBuffer;
+    // The web process reallocates a slot after resizing, or hands a layer another buffer of
+    // its producer, the previous buffer goes away as soon as nobody is using it anymore.
+    auto* oldBuffer = layer ? layer->buffers[bufferID] : bufferPool->releaseBuffer(bufferID);
+    if (oldBuffer) {
+        if (oldBuffer->locked())
+            oldBuffer->setSPendingDelete(true);
+        else
+            destroyBuffer(oldBuffer);
+    }
+
+    auto* buffer = createBuffer(hardwareBuffer, poolID, bufferID);
+    buffer->setLayerID(layerID);
+    if (layer)
+        layer->buffers[bufferID] = buffer;
+    else
+        bufferPool->setBuffer(bufferID, buffer);
+}
+
+void RendererHostClientProxy::bufferDestruction(const IPC::BufferDestruction& destruction)
+{
+    auto* bufferPool = m_host.findBufferPool(destruction.poolID);
+    if (!bufferPool || bufferPool->client() != this || destruction.bufferID >= bufferPool->size())
+        return;
+
+    auto* buffer = bufferPool->releaseBuffer(destruction.bufferID);
+    if (!buffer)
+        return;
+    if (buffer->locked())
+        buffer->setSPendingDelete(true);
+    else
+        destroyBuffer(buffer);
+}
+
+void RendererHostClientProxy::layerCommit(const IPC::LayerCommit& commit, int fenceFD)
+{
+    WPE_ANDROID_TRACE_SCOPE("RendererHostClientProxy::layerCommit");
+
+    auto* bufferPool = m_host.findBufferPool(commit.poolID);
+    auto* layer = bufferPool && bufferPool->client() == this ? bufferPool->findLayer(commit.layerID) : nullptr;
+    auto* buffer = layer && commit.bufferID < layer->buffers.size() ? layer->buffers[commit.bufferID] : nullptr;
+    if (!buffer || buffer->locked()) {
+        if (fenceFD >= 0)
+            close(fenceFD);
+        return;
+    }
+
+    layer->geometry.frame = { commit.x, commit.y, commit.width, commit.height };
+    layer->geometry.zOrder = commit.zOrder;
+    buffer->setContentSize(commit.width, commit.height);
+    buffer->setLocked(true);
+
+    // Without a view there is nobody to show the layer, the acquire fence then tells the web
+    // process when the buffer can be reused.
+    auto* viewBackend = bufferPool->viewBackend();
+    if (viewBackend)
+        viewBackend->commitLayer(layer->geometry, buffer, fenceFD);
+    else
+        m_host.releaseBuffer(buffer, fenceFD);
+}
+
+void RendererHostClientProxy::removeLayerBuffers(BufferPool::Layer& layer)
+{
+    for (auto*& buffer : layer.buffers) {
+        if (!buffer)
+            continue;
+        if (buffer->locked())
+            buffer->setSPendingDelete(true);
+        else
+            destroyBuffer(buffer);
+        buffer = nullptr;
+    }
+}
+
+void RendererHostClientProxy::layerRemoval(const IPC::LayerRemoval& removal)
+{
+    auto* bufferPool = m_host.findBufferPool(removal.poolID);
+    auto* layer = bufferPool && bufferPool->client() == this ? bufferPool->findLayer(removal.layerID) : nullptr;
+    if (!layer)
+        return;
+
+    if (bufferPool->viewBackend())
+        bufferPool->viewBackend()->removeLayer(removal.layerID);
+
+    removeLayerBuffers(*layer);
+    auto& layers = bufferPool->layers();
+    layers.erase(layers.begin() + std::distance(layers.data(), layer));
+}
+
+void RendererHostClientProxy::bufferDamage(const IPC::BufferDamage& damage)
+{
+    auto* bufferPool = m_host.findBufferPool(damage.poolID);
+    if (!bufferPool || bufferPool->client() != this || damage.bufferID >= bufferPool->size())
+        return;
+
+    auto* buffer = bufferPool->getBuffer(damage.bufferID);
+    if (!buffer)
+        return;
+
+    for (auto& rect : damage.rects) {
+        if (rect[2] && rect[3])
+            buffer->addDamage({ rect[0], rect[1], rect[2], rect[3] });
+    }
+}
+
+void RendererHostClientProxy::bufferWait(const IPC::BufferWait& wait)
+{
+    auto* bufferPool = m_host.findBufferPool(wait.poolID);
+    if (!bufferPool || bufferPool->client() != this)
+        return;
 
-    auto* buffer = new Buffer(hardwareBuffer, poolID, bufferID);
-    bufferPool->setBuffer(bufferID, buffer);
+    auto* viewBackend = bufferPool->viewBackend();
+    if (viewBackend && viewBackend->androidBackend())
+        viewBackend->androidBackend()->frameStats().bufferWaited(wait.waitTime, !!wait.timedOut);
 }
 
-void RendererHostClientProxy::bufferCommit(uint32_t poolID, uint32_t bufferID, int fenceFD)
+void RendererHostClientProxy::bufferCommit(const IPC::BufferCommit& commit, int fenceFD)
 {
+    WPE_ANDROID_TRACE_SCOPE("RendererHostClientProxy::bufferCommit");
+    uint32_t poolID = commit.poolID;
+    uint32_t bufferID = commit.bufferID;
+
     auto* bufferPool = m_host.findBufferPool(poolID);
 
-    if (bufferID >= bufferPool->size())
+    if (!bufferPool || bufferPool->client() != this || bufferID >= bufferPool->size()) {
+        if (fenceFD >= 0)
+            close(fenceFD);
         return;
+    }
 
+    // A buffer still held by the application can't be committed again.
     auto* buffer = bufferPool->getBuffer(bufferID);
+    if (buffer && buffer->locked()) {
+        if (fenceFD >= 0)
+            close(fenceFD);
+        return;
+    }
 
-    // TODO: This is only temprorary solution for PSON support. To make this work correctly
-    // interface change is needed where we received pool id from frame complete callback.
-    m_lastExportedPoolID = poolID;
+    if (buffer) {
+        buffer->setContentSize(commit.width, commit.height);
+        buffer->commitDamage();
+        // Rendering waited for the release fence already.
+        buffer->setReleaseFenceFD(-1);
+    }
 
-    auto* viewBackend = m_host.findViewBackend(poolID);
+    // Resolved straight from the pool, which the view backend registered itself with.
+    auto* viewBackend = bufferPool->viewBackend();
     if (viewBackend) {
         auto* androidBackend = viewBackend->androidBackend();
-        if (androidBackend) {
-            buffer->setLocked(true);
-            androidBackend->commitBuffer(buffer, fenceFD);
+        if (!androidBackend || !buffer) {
+            // Nothing takes the fence over then.
+            if (fenceFD >= 0)
+                close(fenceFD);
+            return;
         }
+
+        viewBackend->setFrameSize(commit.width, commit.height);
+        buffer->setLocked(true);
+        bufferPool->setFrameCompletePending(true);
+        androidBackend->frameStats().frameCommitted(*buffer, commit.renderedTime, commit.skippedFrames, fenceFD);
+
+        {
+            WPE_ANDROID_TRACE_SCOPE("WPEAndroidViewBackend_CommitBuffer");
+            viewBackend->commitBuffer(buffer, fenceFD);
+        }
+        viewBackend->frameCommitted();
     } else {
         // In some cases viewbackend might have been already destroyed when buffer commit message
         // is dispatched from ipc queue. It means that webview is already destroyed or being destroyed
@@ -243,8 +982,10 @@ void RendererHostClientProxy::bufferCommit(uint32_t poolID, uint32_t bufferID, i
         //
         // In such case all we can do is to release the buffer
         if (buffer) {
-            delete bufferPool->releaseBuffer(bufferID);
+            destroyBuffer(bufferPool->releaseBuffer(bufferID));
         }
+        if (fenceFD >= 0)
+            close(fenceFD);
     }
 }
 
@@ -253,12 +994,18 @@ void RendererHostClientProxy::handleMessage(char*data, size_t size) {
     if (size != IPC::Message::size)
         return;
 
+    std::lock_guard<std::recursive_mutex> lock(m_host.lock());
+
     auto& message = IPC::Message::cast(data);
+    if (m_host.recorder().recording())
+        m_host.recorder().record(FrameRecorder::Direction::FromWebProcess, m_recordingID, message);
+
     switch (message.messageCode) {
     case IPC::PoolConstruction::code:
     {
-        ALOGV("  PoolConstruction");
-        constructPool();
+        auto construction = IPC::PoolConstruction::from(message);
+        ALOGV("  PoolConstruction: viewToken %" PRIu64 ", poolID %u", construction.viewToken, construction.poolID);
+        constructPool(construction.viewToken, construction.poolID);
         break;
     }
     case IPC::PoolPurge::code:
@@ -268,35 +1015,72 @@ void RendererHostClientProxy::handleMessage(char*data, size_t size) {
         purgePool(purge.poolID);
         break;
     }
+    case IPC::PoolUsageChange::code:
+    {
+        auto change = IPC::PoolUsageChange::from(message);
+        ALOGV("  PoolUsageChange: poolID %u, usage 0x%x", change.poolID, change.usage);
+        auto* bufferPool = m_host.findBufferPool(change.poolID);
+        if (bufferPool && bufferPool->client() == this)
+            bufferPool->setBufferFormat(bufferPool->bufferFormat(), change.usage);
+        break;
+    }
     case IPC::BufferAllocation::code:
     {
         auto allocation = IPC::BufferAllocation::from(message);
 
-        ALOGV("  BufferAllocation: poolID %u, bufferID %u", allocation.poolID, allocation.bufferID);
+        ALOGV("  BufferAllocation: poolID %u, bufferID %u, layerID %u", allocation.poolID, allocation.bufferID, allocation.layerID);
 
-        AHardwareBuffer* buffer = nullptr;
-        int ret = 0;
-        while (true) {
-            ret = AHardwareBuffer_recvHandleFromUnixSocket(m_ipcHost.socketFd(), &buffer);
-            if (!ret || ret != -EAGAIN)
-                break;
-        }
-        ALOGV("  BufferAllocation: ret %d, buffer %p\n", ret, buffer);
-
-        bufferAllocation(buffer, allocation.poolID, allocation.bufferID);
+        // The handle follows on the socket. Until it is there no further messages are read,
+        // but the dispatch loop isn't held up waiting for it either.
+        m_pendingAllocation = allocation;
+        m_allocationPending = true;
+        receivePendingAllocation();
+        break;
+    }
+    case IPC::BufferDestruction::code:
+    {
+        auto destruction = IPC::BufferDestruction::from(message);
+        ALOGV("  BufferDestruction: poolID %u, bufferID %u", destruction.poolID, destruction.bufferID);
+        bufferDestruction(destruction);
+        break;
+    }
+    case IPC::LayerCommit::code:
+    {
+        auto commit = IPC::LayerCommit::from(message);
+        ALOGV("  LayerCommit: poolID %u, layerID %u, bufferID %u", commit.poolID, commit.layerID, commit.bufferID);
+        int fenceFD = m_ipcHost.takeFileDescriptor();
+        m_host.recorder().fenceReceived(commit.poolID, commit.layerID, commit.bufferID, fenceFD);
+        layerCommit(commit, fenceFD);
+        break;
+    }
+    case IPC::LayerRemoval::code:
+    {
+        auto removal = IPC::LayerRemoval::from(message);
+        ALOGV("  LayerRemoval: poolID %u, layerID %u", removal.poolID, removal.layerID);
+        layerRemoval(removal);
+        break;
+    }
+    case IPC::BufferDamage::code:
+    {
+        auto damage = IPC::BufferDamage::from(message);
+        bufferDamage(damage);
+        break;
+    }
+    case IPC::BufferWait::code:
+    {
+        auto wait = IPC::BufferWait::from(message);
+        ALOGV("  BufferWait: poolID %u, waitTime %" PRIu64 ", timedOut %u", wait.poolID, wait.waitTime, wait.timedOut);
+        bufferWait(wait);
         break;
     }
     case IPC::BufferCommit::code:
     {
         auto commit = IPC::BufferCommit::from(message);
-        ALOGV("  BufferCommit: poolID %u, bufferID %u", commit.poolID, commit.bufferID);
-        int fenceFD = -1;
-        while (true) {
-            fenceFD = m_ipcHost.receiveFileDescriptor();
-            if (!fenceFD || fenceFD != -EAGAIN)
-                break;
-        }
-        bufferCommit(commit.poolID, commit.bufferID, fenceFD);
+        ALOGV("  BufferCommit: poolID %u, bufferID %u, size (%u,%u)", commit.poolID, commit.bufferID, commit.width, commit.height);
+        // The fence travels as SCM_RIGHTS ancillary data of the BufferCommit message itself.
+        int fenceFD = m_ipcHost.takeFileDescriptor();
+        m_host.recorder().fenceReceived(commit.poolID, 0, commit.bufferID, fenceFD);
+        bufferCommit(commit, fenceFD);
         break;
     }
     default:
@@ -307,6 +1091,41 @@ void RendererHostClientProxy::handleMessage(char*data, size_t size) {
 
 } // namespace WPEAndroid
 
+extern "C" {
+
+__attribute__((visibility("default")))
+void WPEAndroidRendererHost_setIPCTransport(WPEAndroidIPCTransport transport)
+{
+    WPEAndroid::RendererHost::instance().setIPCTransport(
+        transport == WPEAndroidIPCTransport_SeqPacket ? IPC::Transport::SeqPacket : IPC::Transport::Stream);
+}
+
+__attribute__((visibility("default")))
+void WPEAndroidRendererHost_setMessageRingEnabled(bool enabled)
+{
+    WPEAndroid::RendererHost::instance().setMessageRingEnabled(enabled);
+}
+
+__attribute__((visibility("default")))
+void WPEAndroidRendererHost_setIPCThreadEnabled(bool enabled)
+{
+    WPEAndroid::RendererHost::instance().setIPCThreadEnabled(enabled);
+}
+
+__attribute__((visibility("default")))
+bool WPEAndroidRendererHost_startRecording(const char* path, uint32_t capacity)
+{
+    return WPEAndroid::RendererHost::instance().recorder().start(path, capacity);
+}
+
+__attribute__((visibility("default")))
+void WPEAndroidRendererHost_stopRecording()
+{
+    WPEAndroid::RendererHost::instance().recorder().stop();
+}
+
+} // extern "C"
+
 struct wpe_renderer_host_interface android_renderer_host_impl = {
     // create
     [] () -> void* {
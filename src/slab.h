@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace WPEAndroid {
+
+// Hands out objects from fixed-size chunks which are only ever returned to the heap along
+// with the slab itself. Destroyed objects leave their slot on a free list for the next one,
+// so a steady stream of allocations and deallocations causes no heap traffic at all.
+template<typename T, size_t ChunkCapacity = 16>
+class Slab {
+public:
+    Slab() = default;
+    Slab(const Slab&) = delete;
+    Slab& operator=(const Slab&) = delete;
+
+    ~Slab() { clear(); }
+
+    template<typename... Args>
+    T* create(Args&&... args)
+    {
+        if (!m_freeList)
+            grow();
+
+        Slot* slot = m_freeList;
+        m_freeList = slot->nextFree;
+
+        T* object = new (&slot->storage) T(std::forward<Args>(args)...);
+        slot->live = true;
+        ++m_size;
+        return object;
+    }
+
+    void destroy(T* object)
+    {
+        // The storage is the first member of its slot.
+        auto* slot = reinterpret_cast<Slot*>(object);
+        object->~T();
+        slot->live = false;
+        slot->nextFree = m_freeList;
+        m_freeList = slot;
+        --m_size;
+    }
+
+    size_t size() const { return m_size; }
+
+    template<typename Functor>
+    void forEach(const Functor& functor)
+    {
+        for (auto& chunk : m_chunks) {
+            for (auto& slot : chunk->slots) {
+                if (slot.live)
+                    functor(reinterpret_cast<T*>(&slot.storage));
+            }
+        }
+    }
+
+    // Destroys every object still alive, the chunks are kept around for reuse.
+    void clear()
+    {
+        forEach([this](T* object) { destroy(object); });
+    }
+
+private:
+    struct Slot {
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        Slot* nextFree { nullptr };
+        bool live { false };
+    };
+
+    struct Chunk {
+        Slot slots[ChunkCapacity];
+    };
+
+    void grow()
+    {
+        m_chunks.emplace_back(new Chunk);
+        auto& chunk = *m_chunks.back();
+        for (size_t i = ChunkCapacity; i > 0; --i) {
+            chunk.slots[i - 1].nextFree = m_freeList;
+            m_freeList = &chunk.slots[i - 1];
+        }
+    }
+
+    std::vector<std::unique_ptr<Chunk>> m_chunks;
+    Slot* m_freeList { nullptr };
+    size_t m_size { 0 };
+};
+
+} // namespace WPEAndroid
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace IPC {
+
+// Dense table of objects addressed by generation-tagged IDs, the low 16 bits of an ID index
+// the table and the high 16 bits tell a slot's current occupant apart from the previous ones.
+// Looking an ID up costs a single indexed load, stale IDs simply resolve to nullptr.
+template<typename T>
+class SlotTable {
+public:
+    static uint32_t index(uint32_t id) { return id & 0xffff; }
+
+    // Allocates a slot and returns the ID the object can be found with.
+    uint32_t insert(T* value)
+    {
+        uint32_t slotIndex;
+        if (!m_freeSlots.empty()) {
+            slotIndex = m_freeSlots.back();
+            m_freeSlots.pop_back();
+        } else {
+            slotIndex = m_slots.size();
+            m_slots.push_back({ slotIndex | (1 << 16), nullptr });
+        }
+
+        auto& slot = m_slots[slotIndex];
+        slot.value = value;
+        return slot.id;
+    }
+
+    // Stores an object under an ID handed out by another table across the IPC, storing
+    // nullptr clears the slot again.
+    void set(uint32_t id, T* value)
+    {
+        uint32_t slotIndex = index(id);
+        if (slotIndex >= m_slots.size())
+            m_slots.resize(slotIndex + 1, { 0, nullptr });
+        m_slots[slotIndex] = { id, value };
+    }
+
+    T* get(uint32_t id) const
+    {
+        uint32_t slotIndex = index(id);
+        if (slotIndex >= m_slots.size() || m_slots[slotIndex].id != id)
+            return nullptr;
+        return m_slots[slotIndex].value;
+    }
+
+    T* remove(uint32_t id)
+    {
+        uint32_t slotIndex = index(id);
+        if (slotIndex >= m_slots.size() || m_slots[slotIndex].id != id)
+            return nullptr;
+
+        auto& slot = m_slots[slotIndex];
+        T* value = slot.value;
+
+        // Retire the ID, generation 0 is skipped so that no valid ID is ever 0.
+        uint32_t generation = ((id >> 16) + 1) & 0xffff;
+        slot.id = slotIndex | ((generation ? generation : 1) << 16);
+        slot.value = nullptr;
+        m_freeSlots.push_back(slotIndex);
+        return value;
+    }
+
+private:
+    struct Slot {
+        uint32_t id;
+        T* value;
+    };
+
+    std::vector<Slot> m_slots;
+    std::vector<uint32_t> m_freeSlots;
+};
+
+} // namespace IPC
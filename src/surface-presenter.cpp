@@ -0,0 +1,314 @@
+#include "surface-presenter.h"
+
+#include <algorithm>
+#include <array>
+#include <android/native_window.h>
+#include <deque>
+#include <mutex>
+#include <unistd.h>
+
+#if __ANDROID_API__ >= 29
+#include <android/surface_control.h>
+#endif
+
+#include "logging.h"
+#include "renderer-host-private.h"
+#include "tracing.h"
+#include "view-backend-private.h"
+
+namespace WPEAndroid {
+
+// Filled from the binder threads the transaction callbacks arrive on and drained on the
+// view's main context. Outlives the presenter as long as transactions are in flight.
+struct SurfacePresenter::Completions {
+    struct Completion {
+        Buffer* previousBuffer;
+        int releaseFenceFD;
+        // Page transactions complete a frame, layer ones don't.
+        bool presentsFrame;
+    };
+
+    ~Completions()
+    {
+        for (auto& completion : queue) {
+            if (completion.releaseFenceFD != -1)
+                close(completion.releaseFenceFD);
+        }
+        g_source_unref(source);
+    }
+
+    std::mutex lock;
+    std::deque<Completion> queue;
+    bool closed { false };
+    GSource* source { nullptr };
+};
+
+struct SurfacePresenter::TransactionContext {
+    std::shared_ptr<Completions> completions;
+    Buffer* previousBuffer;
+    // Surface the previous buffer was shown on, whose release fence is the one to take.
+    ASurfaceControl* surfaceControl;
+    bool presentsFrame;
+    // The transaction takes the surface away, its reference is dropped once it completed.
+    bool removesSurface;
+};
+
+namespace {
+
+GSourceFuncs completionSourceFuncs = {
+    nullptr, // prepare
+    nullptr, // check
+    // dispatch
+    [] (GSource* source, GSourceFunc callback, gpointer data) -> gboolean
+    {
+        g_source_set_ready_time(source, -1);
+        return callback(data);
+    },
+    nullptr, // finalize
+    nullptr, // closure_callback
+    nullptr, // closure_marshall
+};
+
+} // namespace
+
+#if __ANDROID_API__ >= 29
+
+SurfacePresenter* SurfacePresenter::create(ViewBackend& viewBackend, ANativeWindow* window, GMainContext* context)
+{
+    ASurfaceControl* surfaceControl = ASurfaceControl_createFromWindow(window, "WPEBackend-android");
+    if (!surfaceControl) {
+        ALOGE("SurfacePresenter: failed to create surface control");
+        return nullptr;
+    }
+    return new SurfacePresenter(viewBackend, surfaceControl, context);
+}
+
+SurfacePresenter::SurfacePresenter(ViewBackend& viewBackend, ASurfaceControl* surfaceControl, GMainContext* context)
+    : m_viewBackend(viewBackend)
+    , m_surfaceControl(surfaceControl)
+    , m_context(context)
+    , m_completions(std::make_shared<Completions>())
+{
+    m_completions->source = g_source_new(&completionSourceFuncs, sizeof(GSource));
+    g_source_set_name(m_completions->source, "WPEBackend-android::surface-completions");
+    g_source_set_callback(m_completions->source, [] (gpointer data) -> gboolean {
+        static_cast<SurfacePresenter*>(data)->dispatchCompletions();
+        return G_SOURCE_CONTINUE;
+    }, this, nullptr);
+    g_source_attach(m_completions->source, m_context);
+}
+
+SurfacePresenter::~SurfacePresenter()
+{
+    // Transactions completing from now on release their buffer right from the callback.
+    std::deque<Completions::Completion> queue;
+    {
+        std::lock_guard<std::mutex> lock(m_completions->lock);
+        m_completions->closed = true;
+        queue.swap(m_completions->queue);
+    }
+    g_source_destroy(m_completions->source);
+
+    for (auto& completion : queue) {
+        if (completion.previousBuffer)
+            m_viewBackend.releaseBuffer(completion.previousBuffer, completion.releaseFenceFD);
+        else if (completion.releaseFenceFD != -1)
+            close(completion.releaseFenceFD);
+    }
+
+    while (!m_layers.empty())
+        removeLayer(m_layers.back().id);
+
+    // The compositor may still be reading the buffer shown last until the surface is gone.
+    auto* context = new TransactionContext { m_completions, m_displayedBuffer, m_surfaceControl, false, true };
+
+    ASurfaceTransaction* transaction = ASurfaceTransaction_create();
+    ASurfaceTransaction_reparent(transaction, m_surfaceControl, nullptr);
+    ASurfaceTransaction_setOnComplete(transaction, context, transactionCompleted);
+    ASurfaceTransaction_apply(transaction);
+    ASurfaceTransaction_delete(transaction);
+}
+
+void SurfacePresenter::present(Buffer* buffer, int fenceFD)
+{
+    WPE_ANDROID_TRACE_SCOPE("SurfacePresenter::present");
+
+    auto* context = new TransactionContext { m_completions, m_displayedBuffer, m_surfaceControl, true, false };
+    if (m_displayedBuffer)
+        m_replacedBuffers.push_back(m_displayedBuffer);
+    m_displayedBuffer = buffer;
+
+    ARect contentRect { 0, 0, int32_t(buffer->contentWidth()), int32_t(buffer->contentHeight()) };
+
+    ASurfaceTransaction* transaction = ASurfaceTransaction_create();
+    // The transaction takes ownership of the acquire fence.
+    ASurfaceTransaction_setBuffer(transaction, m_surfaceControl, buffer->hardwareBuffer(), fenceFD);
+    ASurfaceTransaction_setGeometry(transaction, m_surfaceControl, contentRect, contentRect, ANATIVEWINDOW_TRANSFORM_IDENTITY);
+
+    // Lets the compositor recompose only what changed since the previously presented buffer.
+    if (uint32_t damageRectCount = buffer->damageRectCount()) {
+        std::array<ARect, IPC::maxDamageRects> damage;
+        for (uint32_t i = 0; i < damageRectCount; ++i) {
+            auto& rect = buffer->damageRects()[i];
+            damage[i] = { rect.x, rect.y, rect.x + rect.width, rect.y + rect.height };
+        }
+        ASurfaceTransaction_setDamageRegion(transaction, m_surfaceControl, damage.data(), damageRectCount);
+    }
+    ASurfaceTransaction_setVisibility(transaction, m_surfaceControl, ASURFACE_TRANSACTION_VISIBILITY_SHOW);
+    ASurfaceTransaction_setBufferTransparency(transaction, m_surfaceControl,
+        m_viewBackend.androidBackend()->opaque() ? ASURFACE_TRANSACTION_TRANSPARENCY_OPAQUE : ASURFACE_TRANSACTION_TRANSPARENCY_TRANSLUCENT);
+    ASurfaceTransaction_setOnComplete(transaction, context, transactionCompleted);
+    ASurfaceTransaction_apply(transaction);
+    ASurfaceTransaction_delete(transaction);
+}
+
+void SurfacePresenter::presentLayer(const WPEAndroidLayer& layerGeometry, Buffer* buffer, int fenceFD)
+{
+    WPE_ANDROID_TRACE_SCOPE("SurfacePresenter::presentLayer");
+
+    auto it = std::find_if(m_layers.begin(), m_layers.end(), [&layerGeometry](const Layer& layer) { return layer.id == layerGeometry.id; });
+    if (it == m_layers.end()) {
+        ASurfaceControl* surfaceControl = ASurfaceControl_create(m_surfaceControl, "WPEBackend-android layer");
+        if (!surfaceControl) {
+            ALOGE("SurfacePresenter: failed to create surface control for layer %u", layerGeometry.id);
+            m_viewBackend.releaseBuffer(buffer, fenceFD);
+            return;
+        }
+        m_layers.push_back({ layerGeometry.id, surfaceControl, nullptr });
+        it = std::prev(m_layers.end());
+    }
+    auto& layer = *it;
+
+    auto* context = new TransactionContext { m_completions, layer.displayedBuffer, layer.surfaceControl, false, false };
+    if (layer.displayedBuffer)
+        m_replacedBuffers.push_back(layer.displayedBuffer);
+    layer.displayedBuffer = buffer;
+
+    AHardwareBuffer_Desc description;
+    AHardwareBuffer_describe(buffer->hardwareBuffer(), &description);
+    ARect sourceRect { 0, 0, int32_t(description.width), int32_t(description.height) };
+    auto& frame = layerGeometry.frame;
+    ARect destinationRect { frame.x, frame.y, frame.x + frame.width, frame.y + frame.height };
+
+    ASurfaceTransaction* transaction = ASurfaceTransaction_create();
+    ASurfaceTransaction_setBuffer(transaction, layer.surfaceControl, buffer->hardwareBuffer(), fenceFD);
+    ASurfaceTransaction_setGeometry(transaction, layer.surfaceControl, sourceRect, destinationRect, ANATIVEWINDOW_TRANSFORM_IDENTITY);
+    ASurfaceTransaction_setZOrder(transaction, layer.surfaceControl, layerGeometry.zOrder);
+    ASurfaceTransaction_setVisibility(transaction, layer.surfaceControl, ASURFACE_TRANSACTION_VISIBILITY_SHOW);
+    ASurfaceTransaction_setOnComplete(transaction, context, transactionCompleted);
+    ASurfaceTransaction_apply(transaction);
+    ASurfaceTransaction_delete(transaction);
+}
+
+void SurfacePresenter::removeLayer(uint32_t layerID)
+{
+    auto it = std::find_if(m_layers.begin(), m_layers.end(), [layerID](const Layer& layer) { return layer.id == layerID; });
+    if (it == m_layers.end())
+        return;
+
+    // The compositor may still be reading the buffer shown last, which goes back along with
+    // its release fence once the removal completed, like the ones it replaced before.
+    auto* context = new TransactionContext { m_completions, it->displayedBuffer, it->surfaceControl, false, true };
+    if (it->displayedBuffer)
+        m_replacedBuffers.push_back(it->displayedBuffer);
+
+    ASurfaceTransaction* transaction = ASurfaceTransaction_create();
+    ASurfaceTransaction_reparent(transaction, it->surfaceControl, nullptr);
+    ASurfaceTransaction_setOnComplete(transaction, context, transactionCompleted);
+    ASurfaceTransaction_apply(transaction);
+    ASurfaceTransaction_delete(transaction);
+    m_layers.erase(it);
+}
+
+void SurfacePresenter::transactionCompleted(void* data, ASurfaceTransactionStats* stats)
+{
+    std::unique_ptr<TransactionContext> context(static_cast<TransactionContext*>(data));
+    auto& completions = *context->completions;
+
+    int releaseFenceFD = -1;
+    std::unique_lock<std::mutex> lock(completions.lock);
+    if (context->previousBuffer) {
+        ASurfaceControl** surfaceControls = nullptr;
+        size_t count = 0;
+        ASurfaceTransactionStats_getASurfaceControls(stats, &surfaceControls, &count);
+        for (size_t i = 0; i < count; ++i) {
+            if (surfaceControls[i] == context->surfaceControl) {
+                releaseFenceFD = ASurfaceTransactionStats_getPreviousReleaseFenceFd(stats, surfaceControls[i]);
+                break;
+            }
+        }
+        ASurfaceTransactionStats_releaseASurfaceControls(surfaceControls);
+    }
+    if (context->removesSurface)
+        ASurfaceControl_release(context->surfaceControl);
+
+    if (!completions.closed) {
+        completions.queue.push_back({ context->previousBuffer, releaseFenceFD, context->presentsFrame });
+        g_source_set_ready_time(completions.source, 0);
+        return;
+    }
+    lock.unlock();
+
+    // The presenter is gone and nothing is dispatched on the view's context anymore, the
+    // buffer goes back from here. Held buffers outlive their pool until they are released.
+    if (context->previousBuffer)
+        RendererHost::instance().releaseBuffer(context->previousBuffer, releaseFenceFD);
+    else if (releaseFenceFD != -1)
+        close(releaseFenceFD);
+}
+
+#else
+
+SurfacePresenter* SurfacePresenter::create(ViewBackend&, ANativeWindow*, GMainContext*)
+{
+    ALOGE("SurfacePresenter: ASurfaceControl needs API level 29");
+    return nullptr;
+}
+
+SurfacePresenter::~SurfacePresenter() = default;
+
+void SurfacePresenter::present(Buffer*, int) { }
+
+void SurfacePresenter::presentLayer(const WPEAndroidLayer&, Buffer*, int) { }
+
+void SurfacePresenter::removeLayer(uint32_t) { }
+
+void SurfacePresenter::transactionCompleted(void*, ASurfaceTransactionStats*) { }
+
+#endif
+
+void SurfacePresenter::dispatchCompletions()
+{
+    std::lock_guard<std::recursive_mutex> hostLock(RendererHost::instance().lock());
+
+    std::deque<Completions::Completion> queue;
+    {
+        std::lock_guard<std::mutex> lock(m_completions->lock);
+        queue.swap(m_completions->queue);
+    }
+
+    for (auto& completion : queue) {
+        if (completion.previousBuffer)
+            releaseReplacedBuffer(completion.previousBuffer, completion.releaseFenceFD);
+        else if (completion.releaseFenceFD != -1)
+            close(completion.releaseFenceFD);
+        if (completion.presentsFrame)
+            m_viewBackend.framePresented();
+    }
+}
+
+void SurfacePresenter::releaseReplacedBuffer(Buffer* buffer, int releaseFenceFD)
+{
+    auto it = std::find(m_replacedBuffers.begin(), m_replacedBuffers.end(), buffer);
+    if (it == m_replacedBuffers.end()) {
+        if (releaseFenceFD != -1)
+            close(releaseFenceFD);
+        return;
+    }
+    m_replacedBuffers.erase(it);
+
+    // The web process waits for the compositor to be done reading on the GPU.
+    m_viewBackend.releaseBuffer(buffer, releaseFenceFD);
+}
+
+} // namespace WPEAndroid
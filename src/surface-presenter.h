@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <gio/gio.h>
+#include <memory>
+#include <vector>
+
+#include <wpe-android/view-backend.h>
+
+struct ANativeWindow;
+struct ASurfaceControl;
+struct ASurfaceTransactionStats;
+
+namespace WPEAndroid {
+
+class Buffer;
+class ViewBackend;
+
+// Presents committed buffers straight to the compositor through an ASurfaceControl child of
+// the application's window, instead of handing them to the commit handler. Buffers go back to
+// the web process along with their release fence as soon as a later transaction completes, and
+// frames complete when the compositor has taken the transaction that presented them. Buffers
+// still shown when the presenter goes away are released once the compositor dropped the surface.
+//
+// Everything but the transaction callbacks runs with the renderer host lock held.
+class SurfacePresenter {
+public:
+    // Returns nullptr when the platform has no ASurfaceControl support.
+    static SurfacePresenter* create(ViewBackend&, ANativeWindow*, GMainContext*);
+    ~SurfacePresenter();
+
+    void present(Buffer*, int fenceFD);
+
+    // Layers get child surfaces of their own, stacked relative to the page content.
+    void presentLayer(const WPEAndroidLayer&, Buffer*, int fenceFD);
+    void removeLayer(uint32_t layerID);
+
+private:
+    struct Completions;
+    struct TransactionContext;
+
+    SurfacePresenter(ViewBackend&, ASurfaceControl*, GMainContext*);
+
+    void dispatchCompletions();
+    void releaseReplacedBuffer(Buffer*, int releaseFenceFD);
+
+    static void transactionCompleted(void* context, ASurfaceTransactionStats*);
+
+    ViewBackend& m_viewBackend;
+    ASurfaceControl* m_surfaceControl;
+    GMainContext* m_context;
+
+    std::shared_ptr<Completions> m_completions;
+
+    // Applied last, the compositor holds on to it until the next one replaces it.
+    Buffer* m_displayedBuffer { nullptr };
+
+    // Replaced by a later transaction which hasn't completed yet, page and layer buffers alike.
+    std::vector<Buffer*> m_replacedBuffers;
+
+    struct Layer {
+        uint32_t id;
+        ASurfaceControl* surfaceControl;
+        Buffer* displayedBuffer;
+    };
+    std::vector<Layer> m_layers;
+};
+
+} // namespace WPEAndroid
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <time.h>
+
+#if defined(WPE_ANDROID_TRACING) && WPE_ANDROID_TRACING
+#include <android/trace.h>
+#endif
+
+namespace WPEAndroid {
+
+// CLOCK_MONOTONIC is shared by all processes, so these timestamps can travel over the IPC.
+inline uint64_t monotonicTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+#if defined(WPE_ANDROID_TRACING) && WPE_ANDROID_TRACING
+
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) { ATrace_beginSection(name); }
+    ~TraceScope() { ATrace_endSection(); }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
+
+#define WPE_ANDROID_TRACE_CONCAT_(a, b) a##b
+#define WPE_ANDROID_TRACE_CONCAT(a, b) WPE_ANDROID_TRACE_CONCAT_(a, b)
+#define WPE_ANDROID_TRACE_SCOPE(name) WPEAndroid::TraceScope WPE_ANDROID_TRACE_CONCAT(traceScope, __LINE__)(name)
+#define WPE_ANDROID_TRACE_COUNTER(name, value) ATrace_setCounter(name, int64_t(value))
+
+#else
+
+#define WPE_ANDROID_TRACE_SCOPE(name) ((void)0)
+#define WPE_ANDROID_TRACE_COUNTER(name, value) ((void)0)
+
+#endif
+
+} // namespace WPEAndroid
@@ -1,18 +1,26 @@
 #pragma once
 
+#include <android/hardware_buffer.h>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include <wpe-android/view-backend.h>
 
+#include "frame-stats.h"
 #include "ipc.h"
 
 struct AHardwareBuffer;
+struct ANativeWindow;
 
 namespace WPEAndroid {
 
 class Buffer;
+class FrameReader;
+class SurfacePresenter;
 class ViewBackend;
+class VsyncPacer;
 
 class AndroidViewBackend {
 public:
@@ -22,6 +30,38 @@ public:
     uint32_t initialWidth() const { return m_initialWidth; }
     uint32_t initialHeight() const { return m_initialHeight; }
 
+    uint32_t bufferCount() const { return m_bufferCount; }
+    void setBufferCount(uint32_t bufferCount) { m_bufferCount = bufferCount; }
+
+    uint32_t resizeBucket() const { return m_resizeBucket; }
+    void setResizeBucket(uint32_t resizeBucket) { m_resizeBucket = resizeBucket; }
+
+    // AHardwareBuffer format of the buffers.
+    uint32_t bufferFormat() const { return m_bufferFormat; }
+    void setBufferFormat(WPEAndroidBufferFormat);
+
+    bool opaque() const { return m_opaque || m_bufferFormat == AHARDWAREBUFFER_FORMAT_R8G8B8X8_UNORM || m_bufferFormat == AHARDWAREBUFFER_FORMAT_R5G6B5_UNORM; }
+    void setOpaque(bool opaque) { m_opaque = opaque; }
+
+    bool depthStencilEnabled() const { return m_depthStencilEnabled; }
+    void setDepthStencilEnabled(bool enabled) { m_depthStencilEnabled = enabled; }
+
+    // Milliseconds the web process waits for a buffer when all of them are held.
+    uint32_t bufferReleaseTimeout() const { return m_bufferReleaseTimeout; }
+    void setBufferReleaseTimeout(uint32_t timeout) { m_bufferReleaseTimeout = timeout; }
+
+    // Ignored along with readback, protected buffers can't be read by the CPU.
+    bool protectedContentEnabled() const { return m_protectedContentEnabled; }
+    void setProtectedContentEnabled(bool enabled) { m_protectedContentEnabled = enabled; }
+
+    bool mailboxEnabled() const { return m_mailboxEnabled; }
+    void setMailboxEnabled(bool enabled) { m_mailboxEnabled = enabled; }
+
+    const WPEAndroidDisplay& display() const { return m_display; }
+    void setDisplay(const WPEAndroidDisplay& display) { m_display = display; }
+
+    FrameStats& frameStats() { return m_frameStats; }
+
     ViewBackend* impl() const { return m_impl; }
     void setImpl(ViewBackend* impl) { m_impl = impl; }
 
@@ -29,15 +69,46 @@ public:
 
     void commitBuffer(Buffer* buffer, int fenceID);
 
+    bool hasCommitLayerCallback() const { return !!m_commitLayerCallback; }
+    void setCommitLayerCallback(void* context, WPEAndroidViewBackend_CommitLayer func);
+
+    // A null buffer removes the layer.
+    void commitLayer(const WPEAndroidLayer&, Buffer*, int fenceFD);
+
+    bool hasReadbackCallback() const;
+    void setReadbackCallback(void* context, WPEAndroidViewBackend_ReadbackFrame func);
+
+    // Called on the FrameReader thread, frames read after the handler was cleared are dropped.
+    void readbackFrame(const void* pixels, uint32_t width, uint32_t height, uint32_t stride);
+
 private:
 
     ViewBackend *m_impl = nullptr;
 
     uint32_t m_initialWidth;
     uint32_t m_initialHeight;
+    uint32_t m_bufferCount;
+    uint32_t m_resizeBucket { 0 };
+    uint32_t m_bufferFormat;
+    bool m_opaque { false };
+    bool m_depthStencilEnabled { true };
+    uint32_t m_bufferReleaseTimeout { 0 };
+    bool m_mailboxEnabled { false };
+    bool m_protectedContentEnabled { false };
+    WPEAndroidDisplay m_display { 0, 1, 0 };
+
+    FrameStats m_frameStats;
 
     using CommitBufferCallback = std::function<void(Buffer* buffer, int fenceID)>;
     CommitBufferCallback m_commitBufferCallback;
+
+    using CommitLayerCallback = std::function<void(const WPEAndroidLayer&, Buffer* buffer, int fenceFD)>;
+    CommitLayerCallback m_commitLayerCallback;
+
+    using ReadbackCallback = std::function<void(const void* pixels, uint32_t width, uint32_t height, uint32_t stride)>;
+    // The handler can be changed from the application's thread while a frame is being read.
+    mutable std::mutex m_readbackLock;
+    ReadbackCallback m_readbackCallback;
 };
 
 class ViewBackend : public IPC::Host::Handler {
@@ -55,14 +126,66 @@ public:
 
     void setWPEBackend(WPEViewBackend* backend);
 
+    // Only to be read with RendererHost::lock() held.
+    const std::vector<uint32_t>& poolIds() const { return m_poolIds; }
+
+    // Rendered size of the last frame committed to the view, the initial size before that.
+    // Guarded by RendererHost::lock().
+    uint32_t frameWidth() const { return m_frameWidth; }
+    uint32_t frameHeight() const { return m_frameHeight; }
+    void setFrameSize(uint32_t width, uint32_t height) { m_frameWidth = width; m_frameHeight = height; }
+
     void frameComplete();
-    void releaseBuffer(Buffer*);
+    void releaseBuffer(Buffer*, int releaseFenceFD = -1);
+
+    // Completes frames on vsync instead of waiting for the application, see VsyncPacer.
+    bool setVsyncPacingEnabled(bool);
+    void setPreferredFrameRate(float);
+
+    // Sends the scale factor to WPE once the view is initialized, and has the vsync pacer
+    // follow the refresh rate of a display other than the default one.
+    void setDisplay(const WPEAndroidDisplay&);
+
+    // Presents committed buffers on a child surface of the window, see SurfacePresenter.
+    // A null window hands them to the commit handler again.
+    bool setPresentationWindow(ANativeWindow*);
+
+    // Hands a buffer committed by the web process to the presenter, the frame reader or the
+    // application.
+    void commitBuffer(Buffer*, int fenceFD);
+
+    // Takes an onTrimMemory() level, see WPEAndroidViewBackend_trimMemory().
+    void trimMemory(int level);
+
+    // Layers of the view's pools go to the presenter when there is one, to the application
+    // otherwise.
+    bool acceptsLayers() const;
+    void commitLayer(const WPEAndroidLayer&, Buffer*, int fenceFD);
+    void removeLayer(uint32_t layerID);
+
+    // Called by the renderer host whenever a buffer has been committed to the application.
+    void frameCommitted();
+
+    // The compositor has taken a frame shown through the presenter.
+    void framePresented();
+
+    // Dispatches frameComplete() on the view's main context at the given CLOCK_MONOTONIC time.
+    void scheduleFrameComplete(int64_t time);
 
 private:
 
     void registerPool(uint32_t poolId);
     void unregisterPool(uint32_t poolId);
 
+    // Refresh rate the vsync pacer has to follow over the AChoreographer one, 0 for none.
+    float pacedDisplayRefreshRate() const;
+
+    // Hands the buffer to the application unless it is still busy with the previous one,
+    // in which case it replaces whatever is waiting for the next frameComplete().
+    void commitToMailbox(Buffer*, int fenceFD);
+    // Hands the buffer waiting in the mailbox to the application, on the view's context.
+    void commitMailbox();
+
     // IPC::Host::Handler
     void handleMessage(char*, size_t) override;
 
@@ -70,8 +193,33 @@ private:
     WPEViewBackend* m_wpeViewBackend;
 
     IPC::Host m_ipcHost;
-
+    uint64_t m_ipcToken { 0 };
+
+    // Hands frame-displayed notifications over to the main context the view backend was
+    // initialized on, when frames are completed from other threads.
+    GMainContext* m_context { nullptr };
+    GSource* m_frameDisplayedSource { nullptr };
+
+    std::unique_ptr<SurfacePresenter> m_surfacePresenter;
+    std::unique_ptr<FrameReader> m_frameReader;
+    std::unique_ptr<VsyncPacer> m_vsyncPacer;
+    float m_preferredFrameRate { 0 };
+    GSource* m_pacedFrameCompleteSource { nullptr };
+
+    GSource* m_mailboxCommitSource { nullptr };
+
+    // Guarded by the renderer host lock.
+    struct {
+        Buffer* buffer { nullptr };
+        int fenceFD { -1 };
+        // The application got a buffer and hasn't completed the frame yet.
+        bool consumerBusy { false };
+    } m_mailbox;
+
+    // Changed from the IPC thread, guarded by RendererHost::lock().
     std::vector<uint32_t> m_poolIds;
+    uint32_t m_frameWidth { 0 };
+    uint32_t m_frameHeight { 0 };
 };
 
 } // namespace WPEAndroid
@@ -6,8 +6,12 @@
 #include <errno.h>
 
 #include "ipc-messages.h"
+#include "frame-reader.h"
 #include "logging.h"
 #include "renderer-host-private.h"
+#include "surface-presenter.h"
+#include "tracing.h"
+#include "vsync-pacer.h"
 
 namespace WPEAndroid {
 
@@ -22,8 +26,41 @@ Buffer* toAndroidBuffer(WPEAndroidBuffer* buffer)
 }
 
 
+static GSourceFuncs readySourceFuncs = {
+    nullptr, // prepare
+    nullptr, // check
+    // dispatch
+    [] (GSource* source, GSourceFunc callback, gpointer data) -> gboolean
+    {
+        g_source_set_ready_time(source, -1);
+        return callback(data);
+    },
+    nullptr, // finalize
+    nullptr, // closure_callback
+    nullptr, // closure_marshall
+};
+
 AndroidViewBackend::AndroidViewBackend(uint32_t initialWidth, uint32_t initialHeight)
-    : m_initialWidth(initialWidth), m_initialHeight(initialHeight) { }
+    : m_initialWidth(initialWidth), m_initialHeight(initialHeight), m_bufferCount(IPC::defaultPoolBufferCount)
+    , m_bufferFormat(AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM) { }
+
+void AndroidViewBackend::setBufferFormat(WPEAndroidBufferFormat format)
+{
+    switch (format) {
+    case WPEAndroidBufferFormat_RGBA8888:
+        m_bufferFormat = AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM;
+        break;
+    case WPEAndroidBufferFormat_RGBX8888:
+        m_bufferFormat = AHARDWAREBUFFER_FORMAT_R8G8B8X8_UNORM;
+        break;
+    case WPEAndroidBufferFormat_RGB565:
+        m_bufferFormat = AHARDWAREBUFFER_FORMAT_R5G6B5_UNORM;
+        break;
+    case WPEAndroidBufferFormat_RGBA1010102:
+        m_bufferFormat = AHARDWAREBUFFER_FORMAT_R10G10B10A2_UNORM;
+        break;
+    }
+}
 
 void AndroidViewBackend::setCommitBufferCallback(void* context, WPEAndroidViewBackend_CommitBuffer func)
 {
@@ -38,13 +75,89 @@ void AndroidViewBackend::commitBuffer(Buffer* buffer, int fenceID)
     m_commitBufferCallback(buffer, fenceID);
 }
 
+void AndroidViewBackend::setCommitLayerCallback(void* context, WPEAndroidViewBackend_CommitLayer func)
+{
+    if (!func) {
+        m_commitLayerCallback = nullptr;
+        return;
+    }
+
+    m_commitLayerCallback = [context, func](const WPEAndroidLayer& layer, Buffer* buffer, int fenceFD) {
+        func(context, &layer, reinterpret_cast<WPEAndroidBuffer*>(buffer), fenceFD);
+    };
+}
+
+void AndroidViewBackend::commitLayer(const WPEAndroidLayer& layer, Buffer* buffer, int fenceFD)
+{
+    m_commitLayerCallback(layer, buffer, fenceFD);
+}
+
+bool AndroidViewBackend::hasReadbackCallback() const
+{
+    std::lock_guard<std::mutex> lock(m_readbackLock);
+    return !!m_readbackCallback;
+}
+
+void AndroidViewBackend::setReadbackCallback(void* context, WPEAndroidViewBackend_ReadbackFrame func)
+{
+    // Waits for a frame being handed to the previous handler, which is never called again
+    // once this returns.
+    std::lock_guard<std::mutex> lock(m_readbackLock);
+    if (!func) {
+        m_readbackCallback = nullptr;
+        return;
+    }
+
+    m_readbackCallback = [context, func](const void* pixels, uint32_t width, uint32_t height, uint32_t stride) {
+        func(context, pixels, width, height, stride);
+    };
+}
+
+void AndroidViewBackend::readbackFrame(const void* pixels, uint32_t width, uint32_t height, uint32_t stride)
+{
+    std::lock_guard<std::mutex> lock(m_readbackLock);
+    if (m_readbackCallback)
+        m_readbackCallback(pixels, width, height, stride);
+}
+
 ViewBackend::ViewBackend(AndroidViewBackend *androidViewBackend, WPEViewBackend* wpeViewBackend)
     : m_androidViewBackend(androidViewBackend), m_wpeViewBackend(wpeViewBackend) { }
 
 ViewBackend::~ViewBackend()
 {
-    while (!m_poolIds.empty())
-        unregisterPool(m_poolIds.front());
+    setPresentationWindow(nullptr);
+    setVsyncPacingEnabled(false);
+    {
+        std::lock_guard<std::recursive_mutex> lock(RendererHost::instance().lock());
+        m_frameReader = nullptr;
+
+        if (m_mailbox.buffer)
+            releaseBuffer(m_mailbox.buffer, m_mailbox.fenceFD);
+        m_mailbox.buffer = nullptr;
+    }
+    if (m_mailboxCommitSource) {
+        g_source_destroy(m_mailboxCommitSource);
+        g_source_unref(m_mailboxCommitSource);
+    }
+    if (m_pacedFrameCompleteSource) {
+        g_source_destroy(m_pacedFrameCompleteSource);
+        g_source_unref(m_pacedFrameCompleteSource);
+    }
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(RendererHost::instance().lock());
+        while (!m_poolIds.empty())
+            unregisterPool(m_poolIds.front());
+    }
+    RendererHost::instance().dropCachedBuffers(this);
+
+    if (m_ipcToken)
+        RendererHost::instance().unregisterViewBackendToken(m_ipcToken);
+
+    if (m_frameDisplayedSource) {
+        g_source_destroy(m_frameDisplayedSource);
+        g_source_unref(m_frameDisplayedSource);
+    }
 
     m_ipcHost.deinitialize();
     m_androidViewBackend = nullptr;
@@ -53,26 +166,301 @@ ViewBackend::~ViewBackend()
 
 void ViewBackend::initialize()
 {
-    m_ipcHost.initialize(*this);
+    m_ipcHost.initialize(*this, RendererHost::instance().ipcTransport());
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(RendererHost::instance().lock());
+        setFrameSize(m_androidViewBackend->initialWidth(), m_androidViewBackend->initialHeight());
+    }
+
+    m_ipcToken = m_ipcHost.clientToken();
+    if (m_ipcToken)
+        RendererHost::instance().registerViewBackendToken(m_ipcToken, this);
+
+    m_context = g_main_context_get_thread_default();
+    if (!m_context)
+        m_context = g_main_context_default();
+
+    m_frameDisplayedSource = g_source_new(&readySourceFuncs, sizeof(GSource));
+    g_source_set_name(m_frameDisplayedSource, "WPEBackend-android::frame-displayed");
+    g_source_set_callback(m_frameDisplayedSource, [] (gpointer data) -> gboolean {
+        auto& viewBackend = *static_cast<ViewBackend*>(data);
+        wpe_view_backend_dispatch_frame_displayed(viewBackend.wpeBackend());
+        return G_SOURCE_CONTINUE;
+    }, this, nullptr);
+    g_source_attach(m_frameDisplayedSource, m_context);
+
+    m_pacedFrameCompleteSource = g_source_new(&readySourceFuncs, sizeof(GSource));
+    g_source_set_name(m_pacedFrameCompleteSource, "WPEBackend-android::paced-frame-complete");
+    g_source_set_callback(m_pacedFrameCompleteSource, [] (gpointer data) -> gboolean {
+        auto& viewBackend = *static_cast<ViewBackend*>(data);
+        {
+            std::lock_guard<std::recursive_mutex> lock(RendererHost::instance().lock());
+            if (viewBackend.m_vsyncPacer)
+                viewBackend.m_vsyncPacer->frameCompleted();
+        }
+        viewBackend.frameComplete();
+        return G_SOURCE_CONTINUE;
+    }, this, nullptr);
+    g_source_attach(m_pacedFrameCompleteSource, m_context);
+
+    m_mailboxCommitSource = g_source_new(&readySourceFuncs, sizeof(GSource));
+    g_source_set_name(m_mailboxCommitSource, "WPEBackend-android::mailbox-commit");
+    g_source_set_callback(m_mailboxCommitSource, [] (gpointer data) -> gboolean {
+        static_cast<ViewBackend*>(data)->commitMailbox();
+        return G_SOURCE_CONTINUE;
+    }, this, nullptr);
+    g_source_attach(m_mailboxCommitSource, m_context);
+
     wpe_view_backend_dispatch_set_size(wpeBackend(),
         m_androidViewBackend->initialWidth(), m_androidViewBackend->initialHeight());
+    wpe_view_backend_dispatch_set_device_scale_factor(wpeBackend(), m_androidViewBackend->display().deviceScaleFactor);
 }
 
 void ViewBackend::frameComplete()
 {
-    // Assume that last released buffer is from the completed frame
-    RendererHost::instance().frameComplete();
+    {
+        std::lock_guard<std::recursive_mutex> lock(RendererHost::instance().lock());
+        // The web process was completed when the buffer went into the mailbox already. The
+        // application may complete the frame from within its commit handler, the buffer is
+        // handed over from the view's context rather than from in here.
+        if (m_mailbox.buffer)
+            g_source_set_ready_time(m_mailboxCommitSource, 0);
+        else
+            m_mailbox.consumerBusy = false;
+
+        // Only pools of this view are completed, other views pace themselves.
+        RendererHost::instance().frameComplete(m_poolIds);
+    }
+
+    // WPE has to be notified from the thread the view lives on, commit handlers run on
+    // the renderer host IPC thread when that is enabled.
+    if (RendererHost::instance().ipcThreadEnabled() && !g_main_context_is_owner(m_context))
+        g_source_set_ready_time(m_frameDisplayedSource, 0);
+    else
+        wpe_view_backend_dispatch_frame_displayed(wpeBackend());
+}
+
+void ViewBackend::releaseBuffer(Buffer* buffer, int releaseFenceFD)
+{
+    RendererHost::instance().releaseBuffer(buffer, releaseFenceFD);
+}
+
+bool ViewBackend::setVsyncPacingEnabled(bool enabled)
+{
+    std::lock_guard<std::recursive_mutex> lock(RendererHost::instance().lock());
+
+    if (!enabled) {
+        m_vsyncPacer = nullptr;
+        return true;
+    }
+
+    if (!m_vsyncPacer) {
+        m_vsyncPacer.reset(VsyncPacer::create(*this));
+        if (!m_vsyncPacer)
+            return false;
+        m_vsyncPacer->setPreferredFrameRate(m_preferredFrameRate);
+        m_vsyncPacer->setDisplayRefreshRate(pacedDisplayRefreshRate());
+    }
+    return true;
+}
+
+void ViewBackend::setPreferredFrameRate(float frameRate)
+{
+    std::lock_guard<std::recursive_mutex> lock(RendererHost::instance().lock());
 
-    wpe_view_backend_dispatch_frame_displayed(wpeBackend());
+    m_preferredFrameRate = frameRate;
+    if (m_vsyncPacer)
+        m_vsyncPacer->setPreferredFrameRate(frameRate);
+}
+
+float ViewBackend::pacedDisplayRefreshRate() const
+{
+    // AChoreographer reports the default display's own rate, and tracks its mode changes.
+    auto& display = m_androidViewBackend->display();
+    return display.id ? display.refreshRate : 0;
 }
 
-void ViewBackend::releaseBuffer(Buffer* buffer)
+void ViewBackend::setDisplay(const WPEAndroidDisplay& display)
 {
-    RendererHost::instance().releaseBuffer(buffer);
+    ALOGD("ViewBackend: display %d, scale %.2f, %.2fHz", display.id, display.deviceScaleFactor, display.refreshRate);
+
+    WPEAndroidDisplay previous = m_androidViewBackend->display();
+    {
+        std::lock_guard<std::recursive_mutex> lock(RendererHost::instance().lock());
+        m_androidViewBackend->setDisplay(display);
+        if (m_vsyncPacer)
+            m_vsyncPacer->setDisplayRefreshRate(pacedDisplayRefreshRate());
+
+        // Buffers kept for the view were sized for the previous scale.
+        if (display.deviceScaleFactor != previous.deviceScaleFactor)
+            RendererHost::instance().dropCachedBuffers(this);
+    }
+
+    if (m_context && display.deviceScaleFactor != previous.deviceScaleFactor)
+        wpe_view_backend_dispatch_set_device_scale_factor(wpeBackend(), display.deviceScaleFactor);
+}
+
+bool ViewBackend::setPresentationWindow(ANativeWindow* window)
+{
+    std::lock_guard<std::recursive_mutex> lock(RendererHost::instance().lock());
+
+    m_surfacePresenter = nullptr;
+    if (!window)
+        return true;
+
+    if (!m_context) {
+        ALOGE("ViewBackend: the presentation window can only be set once the view is initialized");
+        return false;
+    }
+
+    m_surfacePresenter.reset(SurfacePresenter::create(*this, window, m_context));
+    return !!m_surfacePresenter;
+}
+
+void ViewBackend::commitBuffer(Buffer* buffer, int fenceFD)
+{
+    if (m_surfacePresenter) {
+        m_surfacePresenter->present(buffer, fenceFD);
+        return;
+    }
+
+    if (m_androidViewBackend->hasReadbackCallback()) {
+        if (!m_frameReader)
+            m_frameReader.reset(new FrameReader(*this, m_context));
+        m_frameReader->read(buffer, fenceFD);
+        return;
+    }
+
+    if (m_androidViewBackend->mailboxEnabled()) {
+        commitToMailbox(buffer, fenceFD);
+        return;
+    }
+
+    m_androidViewBackend->commitBuffer(buffer, fenceFD);
+}
+
+void ViewBackend::commitToMailbox(Buffer* buffer, int fenceFD)
+{
+    if (!m_mailbox.consumerBusy) {
+        m_mailbox.consumerBusy = true;
+        m_androidViewBackend->commitBuffer(buffer, fenceFD);
+    } else {
+        if (m_mailbox.buffer) {
+            // The acquire fence of the replaced frame doubles as its release fence, the web
+            // process renders into the buffer again once the GPU is done with the old frame.
+            m_androidViewBackend->frameStats().frameReplaced();
+            releaseBuffer(m_mailbox.buffer, m_mailbox.fenceFD);
+        }
+        m_mailbox.buffer = buffer;
+        m_mailbox.fenceFD = fenceFD;
+    }
+
+    // The web process goes on with the next frame without waiting for the application.
+    RendererHost::instance().frameComplete(m_poolIds);
+}
+
+void ViewBackend::commitMailbox()
+{
+    Buffer* buffer;
+    int fenceFD;
+    {
+        std::lock_guard<std::recursive_mutex> lock(RendererHost::instance().lock());
+        // The view was torn down or the frame completed again without a new buffer.
+        if (!m_mailbox.buffer) {
+            m_mailbox.consumerBusy = false;
+            return;
+        }
+
+        buffer = m_mailbox.buffer;
+        fenceFD = m_mailbox.fenceFD;
+        m_mailbox.buffer = nullptr;
+        m_mailbox.fenceFD = -1;
+    }
+
+    {
+        WPE_ANDROID_TRACE_SCOPE("WPEAndroidViewBackend_CommitBuffer");
+        m_androidViewBackend->commitBuffer(buffer, fenceFD);
+    }
+
+    // Paced like any other commit, the pacer completes the frame the buffer was kept for.
+    std::lock_guard<std::recursive_mutex> lock(RendererHost::instance().lock());
+    frameCommitted();
+}
+
+// From android.content.ComponentCallbacks2.
+static const int trimMemoryRunningModerate = 5;
+static const int trimMemoryUIHidden = 20;
+
+void ViewBackend::trimMemory(int level)
+{
+    if (level < trimMemoryRunningModerate)
+        return;
+
+    std::lock_guard<std::recursive_mutex> lock(RendererHost::instance().lock());
+
+    // Nothing is shown anymore once the UI is hidden, the next frame allocates what it needs.
+    RendererHost::instance().dropCachedBuffers(this);
+    RendererHost::instance().trimMemory(m_poolIds, level >= trimMemoryUIHidden ? 0 : 1);
+}
+
+bool ViewBackend::acceptsLayers() const
+{
+    return m_surfacePresenter || m_androidViewBackend->hasCommitLayerCallback();
+}
+
+void ViewBackend::commitLayer(const WPEAndroidLayer& layer, Buffer* buffer, int fenceFD)
+{
+    if (m_surfacePresenter) {
+        m_surfacePresenter->presentLayer(layer, buffer, fenceFD);
+        return;
+    }
+
+    if (m_androidViewBackend->hasCommitLayerCallback()) {
+        m_androidViewBackend->commitLayer(layer, buffer, fenceFD);
+        return;
+    }
+
+    // Nobody shows layers, the buffer can be reused as soon as it has been produced.
+    releaseBuffer(buffer, fenceFD);
+}
+
+void ViewBackend::removeLayer(uint32_t layerID)
+{
+    if (m_surfacePresenter) {
+        m_surfacePresenter->removeLayer(layerID);
+        return;
+    }
+
+    if (m_androidViewBackend->hasCommitLayerCallback()) {
+        WPEAndroidLayer layer { layerID, { 0, 0, 0, 0 }, 0 };
+        m_androidViewBackend->commitLayer(layer, nullptr, -1);
+    }
+}
+
+void ViewBackend::framePresented()
+{
+    // The vsync pacer completes frames on its own schedule.
+    if (!m_vsyncPacer)
+        frameComplete();
+}
+
+void ViewBackend::frameCommitted()
+{
+    if (m_vsyncPacer)
+        m_vsyncPacer->frameCommitted();
+}
+
+void ViewBackend::scheduleFrameComplete(int64_t time)
+{
+    // GLib's monotonic clock is CLOCK_MONOTONIC in microseconds.
+    if (m_pacedFrameCompleteSource)
+        g_source_set_ready_time(m_pacedFrameCompleteSource, time / 1000);
 }
 
 void ViewBackend::registerPool(uint32_t poolId)
 {
+    std::lock_guard<std::recursive_mutex> lock(RendererHost::instance().lock());
     m_poolIds.push_back(poolId);
     RendererHost::instance().registerViewBackend(poolId, this);
 }
@@ -80,7 +468,8 @@ void ViewBackend::registerPool(uint32_t poolId)
 void ViewBackend::unregisterPool(uint32_t poolId)
 {
     ALOGV("ViewBackend::unregisterPool() %d", poolId);
-     auto it = std::find(m_poolIds.begin(), m_poolIds.end(), poolId);
+    std::lock_guard<std::recursive_mutex> lock(RendererHost::instance().lock());
+    auto it = std::find(m_poolIds.begin(), m_poolIds.end(), poolId);
     if (it == m_poolIds.end())
         return;
 
@@ -95,6 +484,10 @@ void ViewBackend::handleMessage(char* data, size_t size)
         return;
 
     auto& message = IPC::Message::cast(data);
+    auto& recorder = RendererHost::instance().recorder();
+    if (recorder.recording())
+        recorder.record(FrameRecorder::Direction::FromView, 0, message);
+
     switch (message.messageCode) {
     case IPC::RegisterPool::code:
     {
@@ -173,6 +566,70 @@ WPEViewBackend* WPEAndroidViewBackend_getWPEViewBackend(WPEAndroidViewBackend* b
     return androidViewBackend->impl()->wpeBackend();
 }
 
+__attribute__((visibility("default")))
+void WPEAndroidViewBackend_setBufferCount(WPEAndroidViewBackend* backend, uint32_t bufferCount)
+{
+    auto* androidViewBackend = WPEAndroid::toAndroidViewBackend(backend);
+    androidViewBackend->setBufferCount(bufferCount);
+}
+
+__attribute__((visibility("default")))
+void WPEAndroidViewBackend_setResizeBucket(WPEAndroidViewBackend* backend, uint32_t resizeBucket)
+{
+    auto* androidViewBackend = WPEAndroid::toAndroidViewBackend(backend);
+    androidViewBackend->setResizeBucket(resizeBucket);
+}
+
+__attribute__((visibility("default")))
+void WPEAndroidViewBackend_setBufferFormat(WPEAndroidViewBackend* backend, WPEAndroidBufferFormat format)
+{
+    auto* androidViewBackend = WPEAndroid::toAndroidViewBackend(backend);
+    androidViewBackend->setBufferFormat(format);
+}
+
+__attribute__((visibility("default")))
+void WPEAndroidViewBackend_setOpaque(WPEAndroidViewBackend* backend, bool opaque)
+{
+    auto* androidViewBackend = WPEAndroid::toAndroidViewBackend(backend);
+    androidViewBackend->setOpaque(opaque);
+}
+
+__attribute__((visibility("default")))
+void WPEAndroidViewBackend_setDepthStencilEnabled(WPEAndroidViewBackend* backend, bool enabled)
+{
+    auto* androidViewBackend = WPEAndroid::toAndroidViewBackend(backend);
+    androidViewBackend->setDepthStencilEnabled(enabled);
+}
+
+__attribute__((visibility("default")))
+void WPEAndroidViewBackend_setBufferReleaseTimeout(WPEAndroidViewBackend* backend, uint32_t milliseconds)
+{
+    auto* androidViewBackend = WPEAndroid::toAndroidViewBackend(backend);
+    androidViewBackend->setBufferReleaseTimeout(milliseconds);
+}
+
+__attribute__((visibility("default")))
+void WPEAndroidViewBackend_setProtectedContentEnabled(WPEAndroidViewBackend* backend, bool enabled)
+{
+    auto* androidViewBackend = WPEAndroid::toAndroidViewBackend(backend);
+    androidViewBackend->setProtectedContentEnabled(enabled);
+}
+
+__attribute__((visibility("default")))
+void WPEAndroidViewBackend_setMailboxEnabled(WPEAndroidViewBackend* backend, bool enabled)
+{
+    auto* androidViewBackend = WPEAndroid::toAndroidViewBackend(backend);
+    androidViewBackend->setMailboxEnabled(enabled);
+}
+
+__attribute__((visibility("default")))
+void WPEAndroidViewBackend_trimMemory(WPEAndroidViewBackend* backend, int level)
+{
+    auto* androidViewBackend = WPEAndroid::toAndroidViewBackend(backend);
+    if (androidViewBackend->impl())
+        androidViewBackend->impl()->trimMemory(level);
+}
+
 __attribute__((visibility("default")))
 void WPEAndroidViewBackend_dispatchReleaseBuffer(WPEAndroidViewBackend* backend, WPEAndroidBuffer* buffer)
 {
@@ -181,6 +638,14 @@ void WPEAndroidViewBackend_dispatchReleaseBuffer(WPEAndroidViewBackend* backend,
     androidViewBackend->impl()->releaseBuffer(androidBuffer);
 }
 
+__attribute__((visibility("default")))
+void WPEAndroidViewBackend_dispatchReleaseBufferWithFence(WPEAndroidViewBackend* backend, WPEAndroidBuffer* buffer, int releaseFenceFD)
+{
+    auto* androidViewBackend = WPEAndroid::toAndroidViewBackend(backend);
+    auto* androidBuffer = WPEAndroid::toAndroidBuffer(buffer);
+    androidViewBackend->impl()->releaseBuffer(androidBuffer, releaseFenceFD);
+}
+
 __attribute__((visibility("default")))
 void WPEAndroidViewBackend_dispatchFrameComplete(WPEAndroidViewBackend* backend)
 {
@@ -195,6 +660,20 @@ void WPEAndroidViewBackend_setCommitBufferHandler(WPEAndroidViewBackend* backend
     androidViewBackend->setCommitBufferCallback(context, func);
 }
 
+__attribute__((visibility("default")))
+void WPEAndroidViewBackend_setCommitLayerHandler(WPEAndroidViewBackend* backend, void* context, WPEAndroidViewBackend_CommitLayer func)
+{
+    auto* androidViewBackend = WPEAndroid::toAndroidViewBackend(backend);
+    androidViewBackend->setCommitLayerCallback(context, func);
+}
+
+__attribute__((visibility("default")))
+void WPEAndroidViewBackend_setReadbackHandler(WPEAndroidViewBackend* backend, void* context, WPEAndroidViewBackend_ReadbackFrame func)
+{
+    auto* androidViewBackend = WPEAndroid::toAndroidViewBackend(backend);
+    androidViewBackend->setReadbackCallback(context, func);
+}
+
 __attribute__((visibility("default")))
 AHardwareBuffer* WPEAndroidBuffer_getAHardwareBuffer(WPEAndroidBuffer* buffer)
 {
@@ -202,4 +681,96 @@ AHardwareBuffer* WPEAndroidBuffer_getAHardwareBuffer(WPEAndroidBuffer* buffer)
     return androidBuffer->hardwareBuffer();
 }
 
+__attribute__((visibility("default")))
+void WPEAndroidBuffer_getContentSize(WPEAndroidBuffer* buffer, uint32_t* width, uint32_t* height)
+{
+    auto* androidBuffer = WPEAndroid::toAndroidBuffer(buffer);
+    if (width)
+        *width = androidBuffer->contentWidth();
+    if (height)
+        *height = androidBuffer->contentHeight();
+}
+
+__attribute__((visibility("default")))
+bool WPEAndroidBuffer_isProtected(WPEAndroidBuffer* buffer)
+{
+    auto* androidBuffer = WPEAndroid::toAndroidBuffer(buffer);
+    AHardwareBuffer_Desc description;
+    AHardwareBuffer_describe(androidBuffer->hardwareBuffer(), &description);
+    return !!(description.usage & AHARDWAREBUFFER_USAGE_PROTECTED_CONTENT);
+}
+
+static_assert(WPE_ANDROID_MAX_DAMAGE_RECTS == IPC::maxDamageRects, "damage rect limits match");
+
+__attribute__((visibility("default")))
+uint32_t WPEAndroidBuffer_getDamage(WPEAndroidBuffer* buffer, WPEAndroidRect* rects, uint32_t capacity)
+{
+    auto* androidBuffer = WPEAndroid::toAndroidBuffer(buffer);
+    uint32_t count = androidBuffer->damageRectCount();
+    for (uint32_t i = 0; i < std::min(count, capacity); ++i) {
+        auto& rect = androidBuffer->damageRects()[i];
+        rects[i] = { rect.x, rect.y, rect.width, rect.height };
+    }
+    return count;
+}
+
+__attribute__((visibility("default")))
+bool WPEAndroidViewBackend_setPresentationWindow(WPEAndroidViewBackend* backend, ANativeWindow* window)
+{
+    auto* androidViewBackend = WPEAndroid::toAndroidViewBackend(backend);
+    return androidViewBackend->impl()->setPresentationWindow(window);
+}
+
+__attribute__((visibility("default")))
+bool WPEAndroidViewBackend_setVsyncPacingEnabled(WPEAndroidViewBackend* backend, bool enabled)
+{
+    auto* androidViewBackend = WPEAndroid::toAndroidViewBackend(backend);
+    return androidViewBackend->impl()->setVsyncPacingEnabled(enabled);
+}
+
+__attribute__((visibility("default")))
+void WPEAndroidViewBackend_setPreferredFrameRate(WPEAndroidViewBackend* backend, float frameRate)
+{
+    auto* androidViewBackend = WPEAndroid::toAndroidViewBackend(backend);
+    androidViewBackend->impl()->setPreferredFrameRate(frameRate);
+}
+
+__attribute__((visibility("default")))
+void WPEAndroidViewBackend_setDisplay(WPEAndroidViewBackend* backend, const WPEAndroidDisplay* display)
+{
+    if (!display)
+        return;
+
+    WPEAndroidDisplay sanitized = *display;
+    if (!(sanitized.deviceScaleFactor > 0))
+        sanitized.deviceScaleFactor = 1;
+    if (!(sanitized.refreshRate > 0))
+        sanitized.refreshRate = 0;
+
+    auto* androidViewBackend = WPEAndroid::toAndroidViewBackend(backend);
+    androidViewBackend->impl()->setDisplay(sanitized);
+}
+
+__attribute__((visibility("default")))
+void WPEAndroidViewBackend_setFrameStatsEnabled(WPEAndroidViewBackend* backend, bool enabled)
+{
+    auto* androidViewBackend = WPEAndroid::toAndroidViewBackend(backend);
+    androidViewBackend->frameStats().setEnabled(enabled);
+}
+
+__attribute__((visibility("default")))
+void WPEAndroidViewBackend_getFrameStats(WPEAndroidViewBackend* backend, WPEAndroidFrameStats* stats)
+{
+    auto* androidViewBackend = WPEAndroid::toAndroidViewBackend(backend);
+    if (stats)
+        androidViewBackend->frameStats().get(*stats);
+}
+
+__attribute__((visibility("default")))
+void WPEAndroidViewBackend_resetFrameStats(WPEAndroidViewBackend* backend)
+{
+    auto* androidViewBackend = WPEAndroid::toAndroidViewBackend(backend);
+    androidViewBackend->frameStats().reset();
+}
+
 } // extern "C"
@@ -0,0 +1,288 @@
+#include "vsync-pacer.h"
+
+#include <algorithm>
+#include <android/choreographer.h>
+#include <android/looper.h>
+#include <cinttypes>
+#include <cmath>
+#include <cstring>
+#include <dlfcn.h>
+#include <errno.h>
+#include <mutex>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "tracing.h"
+#include "view-backend-private.h"
+
+namespace WPEAndroid {
+
+// AChoreographer_postFrameCallback64() and the refresh rate callbacks are newer than the
+// API level this library targets, so they are looked up at runtime.
+struct ChoreographerFunctions {
+    using PostFrameCallback64 = void (*)(AChoreographer*, AChoreographer_frameCallback64, void*);
+    using RegisterRefreshRateCallback = void (*)(AChoreographer*, AChoreographer_refreshRateCallback, void*);
+
+    PostFrameCallback64 postFrameCallback64 { nullptr };
+    RegisterRefreshRateCallback registerRefreshRateCallback { nullptr };
+    RegisterRefreshRateCallback unregisterRefreshRateCallback { nullptr };
+
+    static const ChoreographerFunctions& get()
+    {
+        static ChoreographerFunctions functions = [] {
+            ChoreographerFunctions functions;
+            void* library = dlopen("libandroid.so", RTLD_NOW | RTLD_NOLOAD);
+            if (library) {
+                functions.postFrameCallback64 = reinterpret_cast<PostFrameCallback64>(
+                    dlsym(library, "AChoreographer_postFrameCallback64"));
+                functions.registerRefreshRateCallback = reinterpret_cast<RegisterRefreshRateCallback>(
+                    dlsym(library, "AChoreographer_registerRefreshRateCallback"));
+                functions.unregisterRefreshRateCallback = reinterpret_cast<RegisterRefreshRateCallback>(
+                    dlsym(library, "AChoreographer_unregisterRefreshRateCallback"));
+            }
+            return functions;
+        }();
+        return functions;
+    }
+};
+
+// Shared with the looper thread, which holds its own references while a frame callback is
+// posted and while the wakeup descriptor is registered, since neither can be revoked from
+// another thread.
+struct VsyncPacer::State {
+    std::atomic<int> refCount { 1 };
+
+    ALooper* looper { nullptr };
+    AChoreographer* choreographer { nullptr };
+    int wakeFd { -1 };
+
+    // Cleared when the pacer goes away, guarded by the lock.
+    std::mutex lock;
+    ViewBackend* viewBackend { nullptr };
+
+    std::atomic<bool> stopping { false };
+    std::atomic<bool> framePending { false };
+    std::atomic<float> preferredFrameRate { 0 };
+    std::atomic<float> displayRefreshRate { 0 };
+
+    // Looper thread only.
+    bool frameCallbackPosted { false };
+    bool refreshRateCallbackRegistered { false };
+    int64_t lastFrameTime { 0 };
+    uint64_t vsyncCount { 0 };
+
+    std::atomic<int64_t> vsyncPeriod { 16666667 };
+    bool vsyncPeriodFromDisplay { false };
+
+    // How long the web process takes from the frame completion until the next commit,
+    // smoothed over the last frames.
+    std::atomic<int64_t> completeTime { 0 };
+    std::atomic<int64_t> turnaroundTime { 0 };
+};
+
+VsyncPacer* VsyncPacer::create(ViewBackend& viewBackend)
+{
+    ALooper* looper = ALooper_forThread();
+    AChoreographer* choreographer = looper ? AChoreographer_getInstance() : nullptr;
+    if (!choreographer) {
+        ALOGE("VsyncPacer: vsync pacing needs to be enabled from a thread with an ALooper");
+        return nullptr;
+    }
+
+    int wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeFd == -1) {
+        ALOGE("VsyncPacer: failed to create wakeup descriptor: %s", strerror(errno));
+        return nullptr;
+    }
+
+    auto* state = new State;
+    state->looper = looper;
+    state->choreographer = choreographer;
+    state->wakeFd = wakeFd;
+    state->viewBackend = &viewBackend;
+    ALooper_acquire(looper);
+
+    state->refCount++;
+    if (ALooper_addFd(looper, wakeFd, ALOOPER_POLL_CALLBACK, ALOOPER_EVENT_INPUT, looperCallback, state) == -1) {
+        ALOGE("VsyncPacer: failed to watch wakeup descriptor");
+        state->refCount = 1;
+        unref(state);
+        return nullptr;
+    }
+
+    auto& functions = ChoreographerFunctions::get();
+    if (functions.registerRefreshRateCallback) {
+        functions.registerRefreshRateCallback(choreographer, refreshRateCallback, state);
+        state->refreshRateCallbackRegistered = true;
+    }
+
+    return new VsyncPacer(state);
+}
+
+VsyncPacer::VsyncPacer(State* state)
+    : m_state(state) { }
+
+VsyncPacer::~VsyncPacer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_state->lock);
+        m_state->viewBackend = nullptr;
+    }
+
+    // The looper thread tears down its side on the next wakeup.
+    m_state->stopping.store(true);
+    uint64_t value = 1;
+    while (write(m_state->wakeFd, &value, sizeof(value)) == -1 && errno == EINTR) { }
+
+    unref(m_state);
+}
+
+void VsyncPacer::setPreferredFrameRate(float frameRate)
+{
+    m_state->preferredFrameRate.store(std::max(frameRate, 0.0f));
+}
+
+void VsyncPacer::setDisplayRefreshRate(float refreshRate)
+{
+    m_state->displayRefreshRate.store(std::max(refreshRate, 0.0f));
+}
+
+void VsyncPacer::unref(State* state)
+{
+    if (--state->refCount)
+        return;
+
+    close(state->wakeFd);
+    ALooper_release(state->looper);
+    delete state;
+}
+
+void VsyncPacer::frameCommitted()
+{
+    auto& state = *m_state;
+
+    int64_t completeTime = state.completeTime.exchange(0);
+    if (completeTime) {
+        int64_t turnaround = std::max<int64_t>(int64_t(monotonicTime()) - completeTime, 0);
+        int64_t previous = state.turnaroundTime.load();
+        state.turnaroundTime.store(previous ? previous + (turnaround - previous) / 4 : turnaround);
+    }
+
+    if (state.framePending.exchange(true))
+        return;
+
+    uint64_t value = 1;
+    while (write(state.wakeFd, &value, sizeof(value)) == -1 && errno == EINTR) { }
+}
+
+void VsyncPacer::frameCompleted()
+{
+    m_state->completeTime.store(monotonicTime());
+}
+
+int VsyncPacer::looperCallback(int fd, int, void* data)
+{
+    auto& state = *static_cast<State*>(data);
+
+    uint64_t value;
+    while (read(fd, &value, sizeof(value)) == -1 && errno == EINTR) { }
+
+    if (state.stopping.load()) {
+        if (state.refreshRateCallbackRegistered) {
+            ChoreographerFunctions::get().unregisterRefreshRateCallback(state.choreographer, refreshRateCallback, &state);
+            state.refreshRateCallbackRegistered = false;
+        }
+
+        // Returning 0 unregisters the descriptor.
+        unref(&state);
+        return 0;
+    }
+
+    if (state.framePending.load() && !state.frameCallbackPosted)
+        postFrameCallback(state);
+    return 1;
+}
+
+void VsyncPacer::postFrameCallback(State& state)
+{
+    state.frameCallbackPosted = true;
+    state.refCount++;
+
+    auto& functions = ChoreographerFunctions::get();
+    if (functions.postFrameCallback64)
+        functions.postFrameCallback64(state.choreographer, frameCallback, &state);
+    else
+        AChoreographer_postFrameCallback(state.choreographer, frameCallbackLong, &state);
+}
+
+void VsyncPacer::frameCallback(int64_t frameTimeNanos, void* data)
+{
+    auto* state = static_cast<State*>(data);
+    state->frameCallbackPosted = false;
+    if (!state->stopping.load())
+        vsync(*state, frameTimeNanos);
+    unref(state);
+}
+
+void VsyncPacer::frameCallbackLong(long frameTimeNanos, void* data)
+{
+    frameCallback(int64_t(frameTimeNanos), data);
+}
+
+void VsyncPacer::refreshRateCallback(int64_t vsyncPeriodNanos, void* data)
+{
+    auto& state = *static_cast<State*>(data);
+    if (vsyncPeriodNanos <= 0)
+        return;
+
+    ALOGV("VsyncPacer: vsync period %" PRId64 "ns", vsyncPeriodNanos);
+    state.vsyncPeriod.store(vsyncPeriodNanos);
+    state.vsyncPeriodFromDisplay = true;
+}
+
+void VsyncPacer::vsync(State& state, int64_t frameTime)
+{
+    WPE_ANDROID_TRACE_SCOPE("VsyncPacer::vsync");
+
+    // Without refresh rate callbacks the period is estimated from consecutive vsyncs,
+    // longer gaps are skipped frames and say nothing about the display.
+    int64_t period = state.vsyncPeriod.load();
+    if (!state.vsyncPeriodFromDisplay && state.lastFrameTime) {
+        int64_t delta = frameTime - state.lastFrameTime;
+        if (delta > 0 && delta < period + period / 2)
+            state.vsyncPeriod.store(period = period + (delta - period) / 8);
+    }
+    state.lastFrameTime = frameTime;
+
+    // Below the display rate only every n-th vsync presents a frame of this view. A view on a
+    // slower display than the one the vsyncs come from is paced at the rate of its own.
+    uint64_t divisor = 1;
+    float frameRate = state.preferredFrameRate.load();
+    float viewDisplayRate = state.displayRefreshRate.load();
+    if (viewDisplayRate > 0 && (frameRate <= 0 || viewDisplayRate < frameRate))
+        frameRate = viewDisplayRate;
+    if (frameRate > 0) {
+        double displayRate = 1e9 / double(period);
+        divisor = std::max<uint64_t>(1, uint64_t(std::lround(displayRate / frameRate)));
+    }
+    if (++state.vsyncCount % divisor) {
+        postFrameCallback(state);
+        return;
+    }
+
+    if (!state.framePending.exchange(false))
+        return;
+
+    // Complete the frame early enough for the next one to be committed before the vsync
+    // which it is meant for, leaving a quarter of a period of slack.
+    int64_t deadline = frameTime + int64_t(divisor) * period;
+    int64_t completeTime = deadline - state.turnaroundTime.load() - period / 4;
+    completeTime = std::max(completeTime, int64_t(monotonicTime()));
+
+    std::lock_guard<std::mutex> lock(state.lock);
+    if (state.viewBackend)
+        state.viewBackend->scheduleFrameComplete(completeTime);
+}
+
+} // namespace WPEAndroid
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace WPEAndroid {
+
+class ViewBackend;
+
+// Drives the frame completion of a view backend from AChoreographer vsync callbacks instead
+// of the application. Every vsync with a committed frame schedules the completion so that
+// the web process, going by how long it took to turn the previous frames around, has its
+// next frame committed right before the following vsync.
+class VsyncPacer {
+public:
+    // Vsync callbacks are run on the ALooper of the calling thread, which needs to have one.
+    static VsyncPacer* create(ViewBackend&);
+
+    // Can be called from any thread, vsync callbacks stop right away.
+    ~VsyncPacer();
+
+    // Frame rate the view should be paced at, below the display refresh rate.
+    // 0 paces the view at the display refresh rate.
+    void setPreferredFrameRate(float);
+
+    // Refresh rate of the display the view is shown on when that isn't the one AChoreographer
+    // follows, which caps the rate the view is paced at. 0 follows AChoreographer.
+    void setDisplayRefreshRate(float);
+
+    // A buffer was handed to the application, from any thread.
+    void frameCommitted();
+
+    // The completion scheduled from the last vsync is being dispatched, from the view's thread.
+    void frameCompleted();
+
+private:
+    struct State;
+
+    explicit VsyncPacer(State*);
+
+    static int looperCallback(int fd, int events, void* data);
+    static void frameCallback(int64_t frameTimeNanos, void* data);
+    static void frameCallbackLong(long frameTimeNanos, void* data);
+    static void refreshRateCallback(int64_t vsyncPeriodNanos, void* data);
+
+    static void postFrameCallback(State&);
+    static void vsync(State&, int64_t frameTime);
+    static void unref(State*);
+
+    State* m_state;
+};
+
+} // namespace WPEAndroid